@@ -1,16 +1,70 @@
 #include <microscopes/irm/model.hpp>
+#include <microscopes/irm/runner.hpp>
 #include <microscopes/models/distributions.hpp>
+#include <microscopes/models/noconj.hpp>
 #include <microscopes/common/relation/dataview.hpp>
 
 #include <distributions/models/bb.hpp>
+#include <distributions/models/nich.hpp>
 
-#include <memory>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace std;
 using namespace microscopes;
 using namespace distributions;
 
+// gibbs sweeps of the assignments of one domain (assign_resample with 10
+// fresh groups for bbnc, assign otherwise), over a grid of model
+// shapes. each point of the grid varies one axis of a base configuration:
+//
+//   arity:     of the relations, on each of state<2>, <3>, <4> and <-1>
+//              which can hold it
+//   entities:  of the domain being swept
+//   groups:    it starts out with
+//   relations: over the domains
+//   density:   the fraction of observed (unmasked) cells
+//   model:     bb, nich, or the non-conjugate bbnc of microscopes-common
+//
+// and the results are printed as a json array, one object per point:
+// steps (entity reassignments) per second, ns per observation touched (the
+// observed cells of the swept entities), and the peak rss of the process
+// since the point started (linux; elsewhere, since the process started).
+//
+// usage: bench [sweeps] [scale]
+//
+// scale multiplies the entity counts, to size hardware.
+
+struct config_t {
+  string axis_;
+  size_t arity_;
+  ssize_t max_arity_;
+  size_t entities_;
+  size_t groups_;
+  size_t relations_;
+  float density_;
+  string model_;
+};
+
+struct result_t {
+  size_t steps_;
+  size_t observations_;
+  double seconds_;
+  long peak_rss_kb_;
+};
+
 static common::hyperparam_bag_t
 crp_hp_messsage(float alpha)
 {
@@ -28,85 +82,263 @@ bb_hp_messsage(float alpha, float beta)
   return common::util::protobuf_to_string(m);
 }
 
-static pair<
-  shared_ptr<irm::state<4>>,
-  vector<shared_ptr<common::relation::dataview>>
->
-make_irm(size_t groups,
-         size_t entities_per_group,
-         size_t relations,
-         common::rng_t &r)
+static common::hyperparam_bag_t
+nich_hp_messsage(float mu, float kappa, float sigmasq, float nu)
+{
+  distributions::protobuf::NormalInverseChiSq::Shared m;
+  m.set_mu(mu);
+  m.set_kappa(kappa);
+  m.set_sigmasq(sigmasq);
+  m.set_nu(nu);
+  return common::util::protobuf_to_string(m);
+}
+
+// linux only: resets the peak rss of the process to its current rss
+static void
+reset_peak_rss()
 {
-  cout << "entities_per_group: " << entities_per_group << ", "
-       << "relations: " << relations << ", "
-       << "groups: " << groups << endl;
+  ofstream f("/proc/self/clear_refs");
+  if (f)
+    f << "5";
+}
 
-  const size_t n = groups * entities_per_group;
+static long
+peak_rss_kb()
+{
+  ifstream f("/proc/self/status");
+  string line;
+  while (getline(f, line))
+    if (!line.compare(0, 6, "VmHWM:"))
+      return atol(line.c_str() + 6);
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
 
-  irm::relation_definition reldef({0, 0},
-      make_shared<models::distributions_model<BetaBernoulli>>());
-  vector<irm::relation_definition> reldefs(relations, reldef);
+// the cells of a relation over domains 0..arity-1, with the entities of the
+// other domains scaled down so that the number of cells stays near
+// entities^2
+class relation_data {
+public:
+  relation_data(const config_t &c,
+                const vector<size_t> &shape,
+                common::rng_t &r)
+    : boolean_(c.model_ != "nich"),
+      ncells_(1), data_(), mask_(), observed_(shape.front())
+  {
+    for (auto n : shape)
+      ncells_ *= n;
+    const size_t size = boolean_ ? sizeof(bool) : sizeof(float);
+    data_.reset(new uint8_t[ncells_ * size]);
+    mask_.reset(new bool[ncells_]);
+    const size_t inner = ncells_ / shape.front();
+    bernoulli_distribution observe(c.density_), heads(0.3);
+    normal_distribution<float> value(0., 1.);
+    for (size_t i = 0; i < ncells_; i++) {
+      mask_[i] = !observe(r);
+      if (!mask_[i])
+        observed_[i / inner]++;
+      if (boolean_)
+        reinterpret_cast<bool *>(data_.get())[i] = heads(r);
+      else
+        reinterpret_cast<float *>(data_.get())[i] = value(r);
+    }
+    view_ = make_shared<common::relation::row_major_dense_dataview>(
+        data_.get(), mask_.get(), shape,
+        common::runtime_type(boolean_ ? TYPE_B : TYPE_F32));
+  }
 
-  irm::model_definition defn({n}, reldefs);
+  inline const shared_ptr<common::relation::dataview> & view() const { return view_; }
 
-  vector<common::hyperparam_bag_t> cluster_inits({crp_hp_messsage(1.)});
-  vector<common::hyperparam_bag_t> relation_inits({bb_hp_messsage(1., 1.)});
+  // of each entity of domain 0
+  inline const vector<size_t> & observed() const { return observed_; }
 
-  vector<size_t> assignment0;
-  for (size_t i = 0; i < groups; i++)
-    for (size_t j = 0; j < entities_per_group; j++)
-      assignment0.push_back(i);
+private:
+  bool boolean_;
+  size_t ncells_;
+  unique_ptr<uint8_t[]> data_;
+  unique_ptr<bool[]> mask_;
+  vector<size_t> observed_;
+  shared_ptr<common::relation::dataview> view_;
+};
 
-  // memory leaks
-  bool * data = new bool[n * n];
-  for (size_t i = 0; i < (n * n); i++)
-    data[i] = bernoulli_distribution()(r);
+template <ssize_t MaxArity>
+static result_t
+run(const config_t &c, size_t sweeps, common::rng_t &r)
+{
+  reset_peak_rss();
 
-  auto view = shared_ptr<common::relation::row_major_dense_dataview>(
-      new common::relation::row_major_dense_dataview(
-        reinterpret_cast<const uint8_t *>(data),
-        nullptr,
-        {n, n},
-        common::runtime_type(TYPE_B)));
+  // domain 0 is swept; the others are sized to keep the cells in check
+  vector<size_t> shape(c.arity_, c.entities_);
+  const size_t others = max<size_t>(2,
+      size_t(pow(double(c.entities_), 1. / double(c.arity_ - 1))));
+  for (size_t i = 1; i < c.arity_; i++)
+    shape[i] = c.arity_ == 2 ? c.entities_ : others;
 
-  auto latent = irm::state<4>::initialize(
+  vector<size_t> doms(c.arity_);
+  for (size_t i = 0; i < c.arity_; i++)
+    doms[i] = i;
+  vector<irm::relation_definition> reldefs;
+  vector<common::hyperparam_bag_t> relation_inits;
+  for (size_t i = 0; i < c.relations_; i++) {
+    if (c.model_ == "bb") {
+      reldefs.emplace_back(doms,
+          make_shared<models::distributions_model<BetaBernoulli>>(), true);
+      relation_inits.push_back(bb_hp_messsage(1., 1.));
+    } else if (c.model_ == "bbnc") {
+      // its groups are sampled, so blocks are kept until their groups go
+      const auto m = make_shared<models::bbnc_model>();
+      reldefs.emplace_back(doms, m);
+      relation_inits.push_back(m->create_hypers()->get_hp());
+    } else {
+      reldefs.emplace_back(doms,
+          make_shared<models::distributions_model<NormalInverseChiSq>>(), true);
+      relation_inits.push_back(nich_hp_messsage(0., 1., 1., 1.));
+    }
+  }
+  const irm::model_definition defn(shape, reldefs);
+
+  vector<unique_ptr<relation_data>> data;
+  vector<shared_ptr<common::relation::dataview>> views;
+  irm::dataset_t raw;
+  size_t observations = 0;
+  for (size_t i = 0; i < c.relations_; i++) {
+    data.emplace_back(new relation_data(c, shape, r));
+    views.push_back(data.back()->view());
+    raw.push_back(views.back().get());
+    for (auto n : data.back()->observed())
+      observations += n;
+  }
+
+  vector<vector<size_t>> assignments(c.arity_);
+  for (size_t i = 0; i < c.arity_; i++) {
+    const size_t groups = i ? min(c.groups_, shape[i]) : c.groups_;
+    for (size_t j = 0; j < shape[i]; j++)
+      assignments[i].push_back(j % groups);
+  }
+  auto s = irm::state<MaxArity>::initialize(
       defn,
-      cluster_inits,
+      vector<common::hyperparam_bag_t>(c.arity_, crp_hp_messsage(1.)),
       relation_inits,
-      {assignment0},
-      {view.get()},
+      assignments,
+      raw,
       r);
 
-  vector<shared_ptr<common::relation::dataview>> dataset({view});
+  vector<shared_ptr<common::entity_based_state_object>> models;
+  for (size_t i = 0; i < c.arity_; i++)
+    models.push_back(make_shared<irm::model<MaxArity>>(s, i, views));
+  irm::runner runner(models);
+  if (c.model_ == "bbnc")
+    // as the python runner does for non-conjugate domains
+    runner.add_assign_resample(0, 10);
+  else
+    runner.add_assign(0);
+
+  const auto start = chrono::steady_clock::now();
+  runner.run(r, sweeps);
+  const double seconds =
+    chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-  return make_pair(latent, dataset);
+  result_t res;
+  res.steps_ = sweeps * c.entities_;
+  res.observations_ = sweeps * observations;
+  res.seconds_ = seconds;
+  res.peak_rss_kb_ = peak_rss_kb();
+  return res;
 }
 
-// for performance debugging purposes
-// doesn't change the group assignments
-void
-perftest(common::entity_based_state_object &s, rng_t &rng)
+static result_t
+dispatch(const config_t &c, size_t sweeps, common::rng_t &r)
 {
-  pair<vector<size_t>, vector<float>> scores;
-  for (auto i : common::util::permute(s.nentities(), rng)) {
-    const size_t gid = s.remove_value(i, rng);
-    s.inplace_score_value(scores, i, rng);
-    const auto choice = scores.first[common::util::sample_discrete_log(scores.second, rng)];
-    (void)choice; // XXX: make sure compiler does not optimize this out
-    s.add_value(gid, i, rng);
+  switch (c.max_arity_) {
+  case 2: return run<2>(c, sweeps, r);
+  case 3: return run<3>(c, sweeps, r);
+  case 4: return run<4>(c, sweeps, r);
+  default: return run<-1>(c, sweeps, r);
   }
 }
 
+static string
+to_json(const config_t &c, size_t sweeps, const result_t &res)
+{
+  ostringstream o;
+  o << "{\"axis\": \"" << c.axis_ << "\""
+    << ", \"arity\": " << c.arity_
+    << ", \"max_arity\": " << c.max_arity_
+    << ", \"entities\": " << c.entities_
+    << ", \"groups\": " << c.groups_
+    << ", \"relations\": " << c.relations_
+    << ", \"density\": " << c.density_
+    << ", \"model\": \"" << c.model_ << "\""
+    << ", \"sweeps\": " << sweeps
+    << ", \"seconds\": " << res.seconds_
+    << ", \"steps_per_sec\": " << res.steps_ / max(res.seconds_, 1e-9)
+    << ", \"ns_per_observation\": "
+    << (res.observations_ ? res.seconds_ * 1e9 / res.observations_ : 0.)
+    << ", \"peak_rss_kb\": " << res.peak_rss_kb_
+    << "}";
+  return o.str();
+}
+
 int
 main(int argc, char **argv)
 {
-  random_device rd;
-  common::rng_t r(rd());
-  auto p = make_irm(100, 100, 1, r);
-  irm::model<4> m(p.first, 0, p.second);
+  const size_t sweeps = argc > 1 ? atoi(argv[1]) : 5;
+  const double scale = argc > 2 ? atof(argv[2]) : 1.;
+  const auto scaled = [scale](size_t n) {
+    return max<size_t>(4, size_t(n * scale));
+  };
 
-  for (;;)
-    perftest(m, r);
+  const config_t base{"base", 2, 4, scaled(400), 20, 1, 0.5, "bb"};
+  vector<config_t> grid({base});
+  for (size_t arity = 2; arity <= 4; arity++)
+    for (ssize_t max_arity : {2, 3, 4, -1}) {
+      if (max_arity != -1 && size_t(max_arity) < arity)
+        continue;
+      config_t c = base;
+      c.axis_ = "arity";
+      c.arity_ = arity;
+      c.max_arity_ = max_arity;
+      grid.push_back(c);
+    }
+  for (size_t n : {100, 200, 800, 1600}) {
+    config_t c = base;
+    c.axis_ = "entities";
+    c.entities_ = scaled(n);
+    grid.push_back(c);
+  }
+  for (size_t g : {1, 5, 50, 200}) {
+    config_t c = base;
+    c.axis_ = "groups";
+    c.groups_ = g;
+    grid.push_back(c);
+  }
+  for (size_t k : {2, 4, 8}) {
+    config_t c = base;
+    c.axis_ = "relations";
+    c.relations_ = k;
+    grid.push_back(c);
+  }
+  for (float p : {0.05f, 0.2f, 1.f}) {
+    config_t c = base;
+    c.axis_ = "density";
+    c.density_ = p;
+    grid.push_back(c);
+  }
+  for (const char *model : {"nich", "bbnc"}) {
+    config_t c = base;
+    c.axis_ = "model";
+    c.model_ = model;
+    grid.push_back(c);
+  }
 
+  common::rng_t r(0);
+  cout << "[" << endl;
+  for (size_t i = 0; i < grid.size(); i++) {
+    const auto res = dispatch(grid[i], sweeps, r);
+    cout << "  " << to_json(grid[i], sweeps, res)
+         << (i + 1 < grid.size() ? "," : "") << endl;
+  }
+  cout << "]" << endl;
   return 0;
 }
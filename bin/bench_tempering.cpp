@@ -0,0 +1,190 @@
+#include <microscopes/irm/model.hpp>
+#include <microscopes/irm/runner.hpp>
+#include <microscopes/models/distributions.hpp>
+#include <microscopes/common/relation/dataview.hpp>
+
+#include <distributions/models/bb.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace microscopes;
+using namespace distributions;
+
+// compares the time to an effective sample of the log joint of the
+// posterior chain, between plain gibbs and parallel tempering, on a
+// planted partition which plain gibbs is slow to mix over.
+//
+// usage: bench_tempering [entities] [groups] [sweeps] [replicas]
+
+static common::hyperparam_bag_t
+crp_hp_messsage(float alpha)
+{
+  io::CRP m;
+  m.set_alpha(alpha);
+  return common::util::protobuf_to_string(m);
+}
+
+static common::hyperparam_bag_t
+bb_hp_messsage(float alpha, float beta)
+{
+  distributions::protobuf::BetaBernoulli::Shared m;
+  m.set_alpha(alpha);
+  m.set_beta(beta);
+  return common::util::protobuf_to_string(m);
+}
+
+// Geyer's initial monotone sequence estimator
+static double
+effective_sample_size(const vector<double> &xs)
+{
+  const size_t n = xs.size();
+  if (n < 4)
+    return n;
+  const double mean = accumulate(xs.begin(), xs.end(), 0.) / n;
+  auto autocov = [&xs, n, mean](size_t lag) {
+    double s = 0.;
+    for (size_t i = 0; i + lag < n; i++)
+      s += (xs[i] - mean) * (xs[i + lag] - mean);
+    return s / n;
+  };
+  const double var = autocov(0);
+  if (var <= 0.)
+    // a chain which never moved
+    return 1.;
+  double sum = 0., prev = numeric_limits<double>::infinity();
+  for (size_t lag = 0; lag + 1 < n; lag += 2) {
+    double pair = (autocov(lag) + autocov(lag + 1)) / var;
+    if (pair <= 0.)
+      break;
+    pair = min(pair, prev);
+    sum += pair;
+    prev = pair;
+  }
+  return n / max(1., 2. * sum - 1.);
+}
+
+struct result_t {
+  double seconds_;
+  double ess_;
+};
+
+static void
+report(const string &name, const result_t &res, size_t samples)
+{
+  cout << name << ": " << res.seconds_ << "s, ess " << res.ess_ << "/"
+       << samples << ", " << res.seconds_ / max(res.ess_, 1e-9)
+       << "s per effective sample" << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+  const size_t n = argc > 1 ? atoi(argv[1]) : 200;
+  const size_t groups = argc > 2 ? atoi(argv[2]) : 8;
+  const size_t sweeps = argc > 3 ? atoi(argv[3]) : 400;
+  const size_t nreplicas = argc > 4 ? atoi(argv[4]) : 4;
+  // the log joint is recorded every this many sweeps, which is also how
+  // often swaps are proposed
+  const size_t every = 2;
+
+  random_device rd;
+  common::rng_t r(rd());
+
+  // strong blocks on the diagonal, weak ones elsewhere
+  unique_ptr<bool[]> data(new bool[n * n]);
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      data[i * n + j] = bernoulli_distribution(
+          (i % groups) == (j % groups) ? 0.85 : 0.1)(r);
+  const vector<shared_ptr<common::relation::dataview>> views({
+      make_shared<common::relation::row_major_dense_dataview>(
+          reinterpret_cast<const uint8_t *>(data.get()),
+          nullptr,
+          vector<size_t>({n, n}),
+          common::runtime_type(TYPE_B))});
+
+  const irm::model_definition defn({n},
+      {irm::relation_definition({0, 0},
+          make_shared<models::distributions_model<BetaBernoulli>>(), true)});
+
+  // every chain starts from the same assignment
+  vector<size_t> assignment0(n);
+  for (size_t i = 0; i < n; i++)
+    assignment0[i] = i % 2;
+  auto initialize = [&]() {
+    return irm::state<4>::initialize(
+        defn, {crp_hp_messsage(1.)}, {bb_hp_messsage(1., 1.)},
+        {assignment0}, {views[0].get()}, r);
+  };
+
+  cout << "entities: " << n << ", groups: " << groups << ", sweeps: "
+       << sweeps << ", replicas: " << nreplicas << endl;
+
+  auto timed = [&](const function<void()> &f) {
+    const auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  };
+
+  vector<double> trace;
+  result_t plain;
+  {
+    const auto s = initialize();
+    irm::multi_chain_runner runner(irm::bind_chains<4, void>({s}, views), 1);
+    runner.add_assign(0);
+    trace.clear();
+    plain.seconds_ = timed([&]() {
+      for (size_t i = 0; i < sweeps; i += every) {
+        runner.run(r, every);
+        trace.push_back(s->score_assignment() + s->score_likelihood(r));
+      }
+    });
+    plain.ess_ = effective_sample_size(trace);
+  }
+  report("gibbs", plain, trace.size());
+
+  result_t tempered;
+  {
+    vector<shared_ptr<irm::state<4>>> states;
+    vector<float> betas;
+    for (size_t k = 0; k < nreplicas; k++) {
+      states.push_back(initialize());
+      // geometric ladder down to 0.1
+      betas.push_back(pow(0.1, float(k) / max<size_t>(nreplicas - 1, 1)));
+    }
+    irm::tempering_runner runner(
+        irm::bind_chains(states, views), betas, nreplicas);
+    runner.add_assign(0);
+    trace.clear();
+    tempered.seconds_ = timed([&]() {
+      for (size_t i = 0; i < sweeps; i += every) {
+        runner.run(r, every, every);
+        const auto &s = *states[runner.replica(0)];
+        trace.push_back(s.score_assignment() + s.score_likelihood(r));
+      }
+    });
+    tempered.ess_ = effective_sample_size(trace);
+    cout << "swap rates:";
+    for (auto rate : runner.swap_rates())
+      cout << " " << rate;
+    cout << endl;
+  }
+  report("tempering", tempered, trace.size());
+
+  cout << "speedup in time per effective sample: "
+       << (plain.seconds_ / max(plain.ess_, 1e-9)) /
+          (tempered.seconds_ / max(tempered.ess_, 1e-9))
+       << "x" << endl;
+  return 0;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <microscopes/common/assert.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+/**
+ * The binary checkpoint of a state (see state::save_checkpoint()). Unlike
+ * serialize(), it is written as it goes, and loaded off a read only mapping
+ * of the file: the assignments and the blocks of the relations are laid out
+ * as arrays, which are read in place.
+ *
+ * Every field is in the byte order of the writer (which the reader checks),
+ * and starts at a multiple of 8:
+ *
+ *   header    magic, u32 version, u32 byte order mark,
+ *             u64 ndomains, u64 nrelations
+ *   settings  u64 score_threads, u64 relation_threads
+ *   domain    bytes hp, u64 nentities, i64 assignments[nentities],
+ *             u64 ngroups
+ *   relation  bytes hp, u64 arity, u64 nblocks, u64 ident_gen,
+ *             u64 encoding, u64 dense, u64 gids[nblocks * arity],
+ *             u64 idents[nblocks],
+ *             u64 counts[nblocks], then the suffstats by encoding:
+ *
+ *     none    implicit zero relations, whose blocks only have counts
+ *     bb      i32 heads[nblocks], i32 tails[nblocks]
+ *     nich    i32 count[nblocks], f32 mean[nblocks],
+ *             f32 count_times_variance[nblocks]
+ *     bytes   any other model: u64 offsets[nblocks + 1], and the
+ *             concatenated suffstat bags of the blocks (see get_ss())
+ *
+ * where bytes is a u64 length followed by the bytes. The gids of a domain
+ * are written as their rank among its groups, so the groups of a restored
+ * domain are 0 to ngroups - 1, in the order of the saved ones
+ */
+enum checkpoint_encoding {
+  CHECKPOINT_SS_NONE = 0,
+  CHECKPOINT_SS_BB = 1,
+  CHECKPOINT_SS_NICH = 2,
+  CHECKPOINT_SS_BYTES = 3,
+};
+
+// the file is written to path.tmp, which replaces path on commit(), so an
+// interrupted write never clobbers the previous checkpoint
+class checkpoint_writer {
+public:
+  explicit checkpoint_writer(const std::string &path);
+  ~checkpoint_writer();
+
+  checkpoint_writer(const checkpoint_writer &) = delete;
+  checkpoint_writer &operator=(const checkpoint_writer &) = delete;
+
+  void header(size_t ndomains, size_t nrelations);
+
+  // one element of an array; arrays end with align()
+  template <typename T>
+  inline void
+  append(const T &v)
+  {
+    static_assert(std::is_arithmetic<T>::value, "only numbers are written");
+    buffer_.append(reinterpret_cast<const char *>(&v), sizeof(T));
+    if (buffer_.size() >= BufferSize)
+      flush();
+  }
+
+  inline void put(uint64_t v) { append(v); }
+
+  void put_bytes(const std::string &s);
+  // unaligned, like append()
+  void put_raw(const char *p, size_t n);
+
+  // pads to the next multiple of 8
+  void align();
+
+  // the offset the next write goes to
+  inline uint64_t tell() const { return written_ + buffer_.size(); }
+
+  // overwrites data already written at offset
+  void patch(uint64_t offset, const void *p, size_t n);
+
+  void commit();
+
+private:
+  static const size_t BufferSize = 1 << 20;
+
+  void flush();
+
+  std::string path_;
+  std::string tmp_path_;
+  std::ofstream out_;
+  std::string buffer_;
+  uint64_t written_;
+  bool committed_;
+};
+
+// a read only mapping of a whole file
+class mapped_file {
+public:
+  explicit mapped_file(const std::string &path);
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  inline const uint8_t * data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+private:
+  const uint8_t *data_;
+  size_t size_;
+};
+
+// walks the fields of a mapped checkpoint. every read is bounds checked
+class checkpoint_reader {
+public:
+  checkpoint_reader(const uint8_t *data, size_t size)
+    : data_(data), size_(size), pos_() {}
+
+  // checks the magic, version and byte order, and the shape against the
+  // definition
+  void header(size_t ndomains, size_t nrelations);
+
+  inline uint64_t
+  get()
+  {
+    return *array<uint64_t>(1);
+  }
+
+  std::string get_bytes();
+
+  // n elements of an array, in place
+  template <typename T>
+  inline const T *
+  array(size_t n)
+  {
+    MICROSCOPES_CHECK(n <= (size_ - pos_) / sizeof(T), "truncated checkpoint");
+    const T *p = reinterpret_cast<const T *>(data_ + pos_);
+    skip(n * sizeof(T));
+    return p;
+  }
+
+  inline const char *
+  raw(size_t n)
+  {
+    return array<char>(n);
+  }
+
+private:
+  inline void
+  skip(size_t n)
+  {
+    pos_ += n;
+    pos_ = std::min(size_, (pos_ + 7) & ~size_t(7));
+  }
+
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <microscopes/common/random_fwd.hpp>
+#include <microscopes/irm/thread_pool.hpp>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * A bound domain which supports the parallel gibbs sweep of
+ * state::chromatic_assign0()
+ */
+class chromatic_assignable {
+public:
+  virtual ~chromatic_assignable() {}
+
+  // one sweep over every entity of the domain, scored in batches of at most
+  // max_batch entities over pool
+  virtual void chromatic_assign(
+      detail::thread_pool &pool, size_t max_batch, common::rng_t &rng) = 0;
+};
+
+} // namespace irm
+} // namespace microscopes
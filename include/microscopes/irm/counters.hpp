@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * Where the time of a state goes, see state::counters(). Only counted when
+ * compiled with MICROSCOPES_IRM_COUNTERS defined; otherwise the updates
+ * compile away, and every snapshot is all zeros with enabled_ false
+ */
+struct relation_counters {
+  relation_counters()
+    : suffstats_lookups_(), suffstats_hits_(), blocks_created_(),
+      blocks_erased_(), observations_(), iterate_ns_() {}
+
+  // find_suffstats() calls, and how many found the block
+  uint64_t suffstats_lookups_;
+  uint64_t suffstats_hits_;
+  uint64_t blocks_created_;
+  // released by an empty (conjugate) block, or by delete_group()
+  uint64_t blocks_erased_;
+  // cells visited by iterate_over_entity_data(), and the time spent there
+  // (callbacks included)
+  uint64_t observations_;
+  uint64_t iterate_ns_;
+};
+
+struct domain_counters {
+  domain_counters() : entities_scored_(), candidates_scored_() {}
+
+  // calls to score an (unassigned) entity, and the candidate groups scored
+  // over all of them
+  uint64_t entities_scored_;
+  uint64_t candidates_scored_;
+};
+
+struct state_counters {
+  state_counters() : enabled_(), domains_(), relations_() {}
+  bool enabled_;
+  std::vector<domain_counters> domains_;
+  std::vector<relation_counters> relations_;
+};
+
+namespace detail {
+
+#ifdef MICROSCOPES_IRM_COUNTERS
+static const bool counters_enabled = true;
+#else
+static const bool counters_enabled = false;
+#endif
+
+// relaxed: the kernels which score concurrently bump the same counters, and
+// only the totals matter. the value is there either way, so that the
+// layout of a state does not depend on MICROSCOPES_IRM_COUNTERS; only the
+// updates compile away
+class counter {
+public:
+  counter() : value_(0) {}
+  counter(const counter &that) : value_(that.get()) {}
+  counter &
+  operator=(const counter &that)
+  {
+    value_.store(that.get(), std::memory_order_relaxed);
+    return *this;
+  }
+
+  inline void
+  add(uint64_t n = 1) const
+  {
+    if (counters_enabled)
+      value_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  inline uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+  inline void reset() { value_.store(0, std::memory_order_relaxed); }
+
+private:
+  mutable std::atomic<uint64_t> value_;
+};
+
+// charges the time since the last lap (or construction) to a counter. the
+// clock is only read when counting
+class lap_timer {
+public:
+  lap_timer() : last_()
+  {
+    if (counters_enabled)
+      last_ = std::chrono::steady_clock::now();
+  }
+
+  inline void
+  lap(const counter &c)
+  {
+    if (!counters_enabled)
+      return;
+    const auto now = std::chrono::steady_clock::now();
+    c.add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count());
+    last_ = now;
+  }
+
+private:
+  std::chrono::steady_clock::time_point last_;
+};
+
+struct relation_counters_t {
+  counter suffstats_lookups_;
+  counter suffstats_hits_;
+  counter blocks_created_;
+  counter blocks_erased_;
+  counter observations_;
+  counter iterate_ns_;
+
+  inline relation_counters
+  snapshot() const
+  {
+    relation_counters ret;
+    ret.suffstats_lookups_ = suffstats_lookups_.get();
+    ret.suffstats_hits_ = suffstats_hits_.get();
+    ret.blocks_created_ = blocks_created_.get();
+    ret.blocks_erased_ = blocks_erased_.get();
+    ret.observations_ = observations_.get();
+    ret.iterate_ns_ = iterate_ns_.get();
+    return ret;
+  }
+
+  inline void
+  reset()
+  {
+    suffstats_lookups_.reset();
+    suffstats_hits_.reset();
+    blocks_created_.reset();
+    blocks_erased_.reset();
+    observations_.reset();
+    iterate_ns_.reset();
+  }
+};
+
+struct domain_counters_t {
+  counter entities_scored_;
+  counter candidates_scored_;
+
+  inline domain_counters
+  snapshot() const
+  {
+    domain_counters ret;
+    ret.entities_scored_ = entities_scored_.get();
+    ret.candidates_scored_ = candidates_scored_.get();
+    return ret;
+  }
+
+  inline void
+  reset()
+  {
+    entities_scored_.reset();
+    candidates_scored_.reset();
+  }
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
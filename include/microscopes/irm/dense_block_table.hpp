@@ -0,0 +1,328 @@
+#pragma once
+
+#include <microscopes/common/assert.hpp>
+#include <microscopes/common/macros.hpp>
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+/**
+ * Stores one Value per block of a relation in a dense, row-major tensor
+ * indexed by gid tuple, so that a lookup is just index arithmetic.
+ *
+ * Gids are handed out by the domains and never reused, so each domain of the
+ * relation gets a small map from gid to a dense slot, and the slots of deleted
+ * groups are recycled. The tensor grows (by doubling the number of slots of
+ * the domain) whenever a domain runs out of slots.
+ *
+ * Memory is the product of the slot capacities of the positions, so this
+ * is only sensible for relations of low arity over domains with a modest
+ * number of groups.
+ */
+template <typename Tuple, typename Value>
+class dense_block_table {
+public:
+  dense_block_table() : maps_(), pos_map_(), strides_(), blocks_(), present_(), size_() {}
+
+  // domains: for each position of the relation, the domain it indexes
+  explicit dense_block_table(const std::vector<size_t> &domains)
+    : maps_(), pos_map_(), strides_(), blocks_(), present_(), size_()
+  {
+    MICROSCOPES_DCHECK(domains.size(), "arity impossible");
+    // positions which index the same domain share their slots
+    for (auto d : domains) {
+      size_t m = 0;
+      while (m < maps_.size() && maps_[m].domain_ != d)
+        m++;
+      if (m == maps_.size())
+        maps_.emplace_back(d);
+      pos_map_.push_back(m);
+    }
+    strides_.resize(domains.size());
+    compute_strides();
+    blocks_.resize(capacity());
+    present_.resize(capacity());
+  }
+
+  inline size_t size() const { return size_; }
+
+  // nullptr if the block does not exist
+  inline Value *
+  find(const Tuple &gids)
+  {
+    MICROSCOPES_ASSERT(gids.size() == pos_map_.size());
+    size_t idx = 0;
+    for (size_t i = 0; i < gids.size(); i++) {
+      const auto &map = maps_[pos_map_[i]];
+      if (unlikely(gids[i] >= map.gid_to_slot_.size()))
+        return nullptr;
+      const size_t slot = map.gid_to_slot_[gids[i]];
+      if (unlikely(slot == npos()))
+        return nullptr;
+      idx += slot * strides_[i];
+    }
+    return present_[idx] ? &blocks_[idx] : nullptr;
+  }
+
+  inline const Value *
+  find(const Tuple &gids) const
+  {
+    return const_cast<dense_block_table *>(this)->find(gids);
+  }
+
+  // the block must not exist. returns a default constructed Value
+  Value &
+  insert(const Tuple &gids)
+  {
+    MICROSCOPES_ASSERT(gids.size() == pos_map_.size());
+    for (size_t i = 0; i < gids.size(); i++)
+      acquire_slot(pos_map_[i], gids[i]);
+    size_t idx = 0;
+    for (size_t i = 0; i < gids.size(); i++)
+      idx += maps_[pos_map_[i]].gid_to_slot_[gids[i]] * strides_[i];
+    MICROSCOPES_ASSERT(!present_[idx]);
+    present_[idx] = 1;
+    size_++;
+    return blocks_[idx];
+  }
+
+  inline void
+  erase(const Tuple &gids)
+  {
+    Value *p = find(gids);
+    MICROSCOPES_ASSERT(p);
+    erase_index(p - blocks_.data());
+  }
+
+  // f(const Tuple &gids, Value &value) for each block
+  template <typename F>
+  void
+  for_each(F f)
+  {
+    Tuple gids;
+    for (size_t idx = 0; idx < blocks_.size(); idx++) {
+      if (!present_[idx])
+        continue;
+      index_to_gids(gids, idx);
+      f(const_cast<const Tuple &>(gids), blocks_[idx]);
+    }
+  }
+
+  template <typename F>
+  void
+  for_each(F f) const
+  {
+    Tuple gids;
+    for (size_t idx = 0; idx < blocks_.size(); idx++) {
+      if (!present_[idx])
+        continue;
+      index_to_gids(gids, idx);
+      f(const_cast<const Tuple &>(gids), blocks_[idx]);
+    }
+  }
+
+  // f(const Tuple &gids, Value &value) for each block which involves gid of
+  // domain, once each. only the blocks of the group are visited
+  template <typename F>
+  void
+  for_each_in_group(size_t domain, size_t gid, F f)
+  {
+    Tuple gids;
+    for (size_t m = 0; m < maps_.size(); m++) {
+      const auto &map = maps_[m];
+      if (map.domain_ != domain ||
+          gid >= map.gid_to_slot_.size() ||
+          map.gid_to_slot_[gid] == npos())
+        continue;
+      const size_t slot = map.gid_to_slot_[gid];
+      for (size_t pos = 0; pos < pos_map_.size(); pos++) {
+        if (pos_map_[pos] != m)
+          continue;
+        for_each_index_with(pos, slot, [this, m, pos, slot, &gids, &f](size_t idx) {
+          if (!this->present_[idx])
+            return;
+          // visited already, off an earlier position of the same domain
+          for (size_t i = 0; i < pos; i++)
+            if (this->pos_map_[i] == m &&
+                (idx / this->strides_[i]) % this->maps_[m].capacity_ == slot)
+              return;
+          this->index_to_gids(gids, idx);
+          f(const_cast<const Tuple &>(gids), this->blocks_[idx]);
+        });
+      }
+    }
+  }
+
+  // erases every block which involves gid of domain, and releases gid's
+  // slot. f(Value &value) is called on each block right before it is erased.
+  // only the blocks of the group are visited
+  template <typename F>
+  void
+  erase_group(size_t domain, size_t gid, F f)
+  {
+    for (size_t m = 0; m < maps_.size(); m++) {
+      auto &map = maps_[m];
+      if (map.domain_ != domain ||
+          gid >= map.gid_to_slot_.size() ||
+          map.gid_to_slot_[gid] == npos())
+        continue;
+      const size_t slot = map.gid_to_slot_[gid];
+      for (size_t pos = 0; pos < pos_map_.size(); pos++) {
+        if (pos_map_[pos] != m)
+          continue;
+        for_each_index_with(pos, slot, [this, &f](size_t idx) {
+          if (!this->present_[idx])
+            return;
+          f(this->blocks_[idx]);
+          this->erase_index(idx);
+        });
+      }
+      map.gid_to_slot_[gid] = npos();
+      map.slot_to_gid_[slot] = npos();
+      map.free_.push_back(slot);
+    }
+  }
+
+private:
+  static inline size_t npos() { return size_t(-1); }
+
+  struct slot_map_t {
+    slot_map_t(size_t domain)
+      : domain_(domain), gid_to_slot_(), slot_to_gid_(), free_(), capacity_(1) {}
+    size_t domain_;
+    std::vector<size_t> gid_to_slot_;
+    std::vector<size_t> slot_to_gid_;
+    std::vector<size_t> free_;
+    size_t capacity_;
+  };
+
+  inline size_t
+  capacity() const
+  {
+    size_t n = 1;
+    for (auto m : pos_map_)
+      n *= maps_[m].capacity_;
+    return n;
+  }
+
+  inline void
+  compute_strides()
+  {
+    size_t stride = 1;
+    for (size_t i = pos_map_.size(); i-- > 0; ) {
+      strides_[i] = stride;
+      stride *= maps_[pos_map_[i]].capacity_;
+    }
+  }
+
+  inline void
+  index_to_gids(Tuple &gids, size_t idx) const
+  {
+    gids.clear();
+    for (size_t i = 0; i < pos_map_.size(); i++) {
+      const auto &map = maps_[pos_map_[i]];
+      const size_t slot = (idx / strides_[i]) % map.capacity_;
+      MICROSCOPES_ASSERT(map.slot_to_gid_[slot] != npos());
+      gids.push_back(map.slot_to_gid_[slot]);
+    }
+  }
+
+  inline void
+  erase_index(size_t idx)
+  {
+    MICROSCOPES_ASSERT(present_[idx]);
+    blocks_[idx] = Value();
+    present_[idx] = 0;
+    size_--;
+  }
+
+  // g(idx) for every index of the tensor whose slot at pos is slot
+  template <typename G>
+  void
+  for_each_index_with(size_t pos, size_t slot, G g) const
+  {
+    const size_t n = pos_map_.size();
+    std::vector<size_t> slots(n, 0);
+    slots[pos] = slot;
+    for (;;) {
+      size_t idx = 0;
+      for (size_t i = 0; i < n; i++)
+        idx += slots[i] * strides_[i];
+      g(idx);
+      size_t i = n;
+      while (i-- > 0) {
+        if (i == pos)
+          continue;
+        if (++slots[i] < maps_[pos_map_[i]].capacity_)
+          break;
+        slots[i] = 0;
+      }
+      if (i == size_t(-1))
+        return;
+    }
+  }
+
+  void
+  acquire_slot(size_t m, size_t gid)
+  {
+    auto &map = maps_[m];
+    if (gid >= map.gid_to_slot_.size())
+      map.gid_to_slot_.resize(gid + 1, npos());
+    if (map.gid_to_slot_[gid] != npos())
+      return;
+    size_t slot;
+    if (!map.free_.empty()) {
+      slot = map.free_.back();
+      map.free_.pop_back();
+    } else {
+      slot = map.slot_to_gid_.size();
+      map.slot_to_gid_.push_back(npos());
+    }
+    map.gid_to_slot_[gid] = slot;
+    map.slot_to_gid_[slot] = gid;
+    if (slot >= map.capacity_)
+      grow(m, std::max(2 * map.capacity_, slot + 1));
+  }
+
+  void
+  grow(size_t m, size_t capacity)
+  {
+    const std::vector<size_t> old_strides(strides_);
+    std::vector<size_t> old_caps;
+    for (auto mm : pos_map_)
+      old_caps.push_back(maps_[mm].capacity_);
+
+    maps_[m].capacity_ = capacity;
+    compute_strides();
+
+    std::vector<Value> blocks(this->capacity());
+    std::vector<uint8_t> present(blocks.size());
+    for (size_t idx = 0; idx < blocks_.size(); idx++) {
+      if (!present_[idx])
+        continue;
+      size_t idx1 = 0;
+      for (size_t i = 0; i < pos_map_.size(); i++)
+        idx1 += ((idx / old_strides[i]) % old_caps[i]) * strides_[i];
+      blocks[idx1] = std::move(blocks_[idx]);
+      present[idx1] = 1;
+    }
+    blocks_.swap(blocks);
+    present_.swap(present);
+  }
+
+  std::vector<slot_map_t> maps_;
+  std::vector<size_t> pos_map_;
+  std::vector<size_t> strides_;
+  std::vector<Value> blocks_;
+  std::vector<uint8_t> present_;
+  size_t size_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <microscopes/common/runtime_type.hpp>
+#include <microscopes/common/assert.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+/**
+ * The observed data touching each entity of one domain, stored entity-major
+ * (CSR), so that an entity's neighborhood can be walked without slicing
+ * the dataviews.
+ *
+ * Each entry is (relation, the entity tuple of the entry, its value). The
+ * entries of an entity are segmented by relation, in the (increasing) order
+ * of the relations the index was built for, so that the entries of a range
+ * of relations can be walked without visiting the others; within a segment
+ * they are kept in the order they were pushed.
+ *
+ * Entries are kept compact: the entity tuple as 32-bit eids, and the value
+ * as a pointer to its data alone, since every value of a relation shares
+ * its type and observed values carry no mask. Both are widened back into a
+ * value_accessor and size_t eids as they are walked. Values point into the
+ * dataviews the index was built from, which must outlive it.
+ */
+class entity_index {
+public:
+  entity_index() : entity_index(std::vector<size_t>()) {}
+
+  // rels are the (sorted, distinct) relations the entries can belong to
+  explicit entity_index(const std::vector<size_t> &rels)
+    : rels_(rels), types_(rels.size()), arities_(rels.size()), max_arity_(),
+      nentities_(), segments_(1), eids_starts_(1), eids_(), values_()
+  {
+    MICROSCOPES_ASSERT(std::adjacent_find(rels_.begin(), rels_.end(),
+          std::greater_equal<size_t>()) == rels_.end());
+  }
+
+  inline size_t nentities() const { return nentities_; }
+  inline size_t nentries() const { return values_.size(); }
+
+  // appends an entry to the entity currently being built; the entries of an
+  // entity must be pushed in increasing relation order
+  inline void
+  push_back(size_t rel,
+            const size_t *eids,
+            size_t arity,
+            const common::value_accessor &value)
+  {
+    const size_t s = slot(rel);
+    MICROSCOPES_ASSERT(nclosed() <= s);
+    MICROSCOPES_ASSERT(!value.anymasked());
+    while (nclosed() < s)
+      segments_.push_back(nentries());
+    if (!arities_[s]) {
+      types_[s] = value.type();
+      arities_[s] = arity;
+      max_arity_ = std::max(max_arity_, arity);
+    }
+    MICROSCOPES_ASSERT(arities_[s] == arity);
+    for (size_t i = 0; i < arity; i++) {
+      MICROSCOPES_CHECK(eids[i] <= std::numeric_limits<uint32_t>::max(),
+          "eid does not fit the entity index");
+      eids_.push_back(eids[i]);
+    }
+    values_.push_back(value.data());
+  }
+
+  // finishes the entity currently being built, and starts the next one
+  inline void
+  next_entity()
+  {
+    while (nclosed() < rels_.size())
+      segments_.push_back(nentries());
+    eids_starts_.push_back(eids_.size());
+    nentities_++;
+  }
+
+  // f(size_t rel, const size_t *eids, const common::value_accessor &value)
+  // for each entry of eid
+  template <typename F>
+  inline void
+  for_each(size_t eid, F f) const
+  {
+    MICROSCOPES_ASSERT(eid < nentities());
+    walk(eid, 0, rels_.size(), f);
+  }
+
+  // same, but only for the entries of the relations in [lo, hi]
+  template <typename F>
+  inline void
+  for_each(size_t eid, size_t lo, size_t hi, F f) const
+  {
+    MICROSCOPES_ASSERT(eid < nentities());
+    walk(eid,
+         std::lower_bound(rels_.begin(), rels_.end(), lo) - rels_.begin(),
+         std::upper_bound(rels_.begin(), rels_.end(), hi) - rels_.begin(),
+         f);
+  }
+
+private:
+  // the arity up to which walk() widens eids on the stack
+  static const size_t InlineArity = 4;
+
+  inline size_t
+  slot(size_t rel) const
+  {
+    const auto it = std::lower_bound(rels_.begin(), rels_.end(), rel);
+    MICROSCOPES_ASSERT(it != rels_.end() && *it == rel);
+    return it - rels_.begin();
+  }
+
+  // the number of segments of the entity being built which are complete
+  inline size_t
+  nclosed() const
+  {
+    return segments_.size() - 1 - nentities_ * rels_.size();
+  }
+
+  template <typename F>
+  inline void
+  walk(size_t eid, size_t first, size_t last, F &f) const
+  {
+    size_t inline_buf[InlineArity];
+    std::vector<size_t> heap_buf;
+    size_t *buf = inline_buf;
+    if (max_arity_ > InlineArity) {
+      heap_buf.resize(max_arity_);
+      buf = heap_buf.data();
+    }
+    const size_t *seg = &segments_[eid * rels_.size()];
+    const uint32_t *p = &eids_[eids_starts_[eid]];
+    for (size_t s = 0; s < first; s++)
+      p += (seg[s + 1] - seg[s]) * arities_[s];
+    for (size_t s = first; s < last; s++) {
+      const size_t arity = arities_[s];
+      for (size_t i = seg[s]; i < seg[s + 1]; i++) {
+        std::copy(p, p + arity, buf);
+        p += arity;
+        f(rels_[s], buf, common::value_accessor(values_[i], nullptr, types_[s]));
+      }
+    }
+  }
+
+  std::vector<size_t> rels_;
+  // the value type and arity of rels_[s], set by its first entry
+  std::vector<common::runtime_type> types_;
+  std::vector<size_t> arities_;
+  size_t max_arity_;
+  size_t nentities_;
+  // the entries of entity eid in rels_[s] are
+  // [segments_[eid * rels_.size() + s], segments_[eid * rels_.size() + s + 1])
+  std::vector<size_t> segments_;
+  // the entity tuples of eid's entries, in entry order, start at
+  // eids_[eids_starts_[eid]]; each takes the arity of its relation
+  std::vector<size_t> eids_starts_;
+  std::vector<uint32_t> eids_;
+  std::vector<const uint8_t *> values_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <microscopes/common/assert.hpp>
+#include <microscopes/common/macros.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <functional>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+// murmur3's 64-bit finalizer
+static inline uint64_t
+hash_mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// hashes a tuple of gids. works for both common::static_vector<size_t, N>
+// (the bound makes the loop trivially unrollable) and std::vector<size_t>
+template <typename T>
+struct gid_tuple_hash {
+  inline size_t
+  operator()(const T &gids) const
+  {
+    uint64_t h = gids.size();
+    for (auto gid : gids)
+      h = (h ^ uint64_t(gid)) * 0x9e3779b97f4a7c15ULL;
+    return hash_mix(h);
+  }
+};
+
+template <typename T>
+struct gid_tuple_equal {
+  inline bool
+  operator()(const T &a, const T &b) const
+  {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); i++)
+      if (a[i] != b[i])
+        return false;
+    return true;
+  }
+};
+
+template <typename T>
+struct integer_hash {
+  inline size_t operator()(T t) const { return hash_mix(uint64_t(t)); }
+};
+
+/**
+ * An open addressing (linear probing) hash table, which stores its entries
+ * inline in a single array. Meant for small, cheap to hash keys such as gid
+ * tuples and idents.
+ *
+ * Unlike std::map:
+ *   (A) iteration order is unspecified
+ *   (B) any insertion may invalidate all iterators and references
+ *
+ * Erasing does not move any other entry (deleted slots are left as
+ * tombstones until the next rehash), so erase() while iterating is safe.
+ */
+template <typename Key,
+          typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>>
+class flat_hash_map {
+public:
+  typedef Key key_type;
+  typedef Value mapped_type;
+  typedef std::pair<Key, Value> value_type;
+
+private:
+  // the hash of an entry is never allowed to be Empty or Deleted, so that the
+  // slot state can be encoded by the cached hash
+  enum { Empty = 0, Deleted = 1, MinHash = 2 };
+
+  enum { MinCapacity = 16 };
+
+  struct slot_t {
+    slot_t() : hash_(Empty), kv_() {}
+    size_t hash_;
+    value_type kv_;
+  };
+
+  template <typename V, typename S>
+  class iterator_impl {
+    friend class flat_hash_map;
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef V value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef V * pointer;
+    typedef V & reference;
+
+    iterator_impl() : p_(), end_() {}
+    iterator_impl(S *p, S *end) : p_(p), end_(end) { skip(); }
+
+    // non-const to const conversion
+    template <typename V1, typename S1>
+    iterator_impl(const iterator_impl<V1, S1> &that)
+      : p_(that.p_), end_(that.end_) {}
+
+    inline V & operator*() const { return p_->kv_; }
+    inline V * operator->() const { return &p_->kv_; }
+
+    inline iterator_impl &
+    operator++()
+    {
+      ++p_;
+      skip();
+      return *this;
+    }
+
+    inline iterator_impl
+    operator++(int)
+    {
+      iterator_impl ret(*this);
+      ++(*this);
+      return ret;
+    }
+
+    inline bool operator==(const iterator_impl &that) const { return p_ == that.p_; }
+    inline bool operator!=(const iterator_impl &that) const { return p_ != that.p_; }
+
+  private:
+    template <typename, typename> friend class iterator_impl;
+
+    inline void
+    skip()
+    {
+      while (p_ != end_ && p_->hash_ < MinHash)
+        ++p_;
+    }
+
+    S *p_;
+    S *end_;
+  };
+
+public:
+  typedef iterator_impl<value_type, slot_t> iterator;
+  typedef iterator_impl<const value_type, const slot_t> const_iterator;
+
+  flat_hash_map() : slots_(), size_(), deleted_() {}
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return !size_; }
+
+  inline iterator begin() { return iterator(slots_.data(), slots_.data() + slots_.size()); }
+  inline iterator end() { return iterator(slots_.data() + slots_.size(), slots_.data() + slots_.size()); }
+  inline const_iterator begin() const { return const_iterator(slots_.data(), slots_.data() + slots_.size()); }
+  inline const_iterator end() const { return const_iterator(slots_.data() + slots_.size(), slots_.data() + slots_.size()); }
+
+  inline void
+  clear()
+  {
+    slots_.clear();
+    size_ = deleted_ = 0;
+  }
+
+  // make room for n entries without rehashing
+  void
+  reserve(size_t n)
+  {
+    size_t capacity = MinCapacity;
+    while (overloaded(n, capacity))
+      capacity *= 2;
+    if (capacity > slots_.size())
+      rehash(capacity);
+  }
+
+  inline iterator
+  find(const Key &key)
+  {
+    const size_t idx = locate(key, hash(key));
+    return idx == npos() ? end() : make_iterator(idx);
+  }
+
+  inline const_iterator
+  find(const Key &key) const
+  {
+    return const_cast<flat_hash_map *>(this)->find(key);
+  }
+
+  inline size_t count(const Key &key) const { return find(key) != end(); }
+
+  inline std::pair<iterator, bool>
+  insert(const value_type &kv)
+  {
+    const size_t h = hash(kv.first);
+    size_t idx = locate(kv.first, h);
+    if (idx != npos())
+      return std::make_pair(make_iterator(idx), false);
+    idx = claim(kv.first, h);
+    slots_[idx].kv_.second = kv.second;
+    return std::make_pair(make_iterator(idx), true);
+  }
+
+  inline Value &
+  operator[](const Key &key)
+  {
+    const size_t h = hash(key);
+    const size_t idx = locate(key, h);
+    if (idx != npos())
+      return slots_[idx].kv_.second;
+    return slots_[claim(key, h)].kv_.second;
+  }
+
+  // returns an iterator to the entry following it
+  inline iterator
+  erase(iterator it)
+  {
+    MICROSCOPES_ASSERT(it.p_->hash_ >= MinHash);
+    it.p_->hash_ = Deleted;
+    it.p_->kv_ = value_type();
+    size_--;
+    deleted_++;
+    return ++it;
+  }
+
+  inline size_t
+  erase(const Key &key)
+  {
+    auto it = find(key);
+    if (it == end())
+      return 0;
+    erase(it);
+    return 1;
+  }
+
+private:
+  static inline size_t npos() { return size_t(-1); }
+
+  // max load factor (counting tombstones) of 3/4
+  static inline bool
+  overloaded(size_t n, size_t capacity)
+  {
+    return n * 4 > capacity * 3;
+  }
+
+  inline size_t
+  hash(const Key &key) const
+  {
+    const size_t h = Hash()(key);
+    return likely(h >= MinHash) ? h : h + MinHash;
+  }
+
+  inline iterator
+  make_iterator(size_t idx)
+  {
+    return iterator(slots_.data() + idx, slots_.data() + slots_.size());
+  }
+
+  // index of key's slot, or npos() if key is not present
+  inline size_t
+  locate(const Key &key, size_t h) const
+  {
+    if (unlikely(slots_.empty()))
+      return npos();
+    const size_t mask = slots_.size() - 1;
+    for (size_t idx = h & mask;; idx = (idx + 1) & mask) {
+      const slot_t &slot = slots_[idx];
+      if (slot.hash_ == Empty)
+        return npos();
+      if (slot.hash_ == h && KeyEqual()(slot.kv_.first, key))
+        return idx;
+    }
+  }
+
+  // key must not be present. returns the index of a fresh slot holding key
+  // and a default constructed value
+  inline size_t
+  claim(const Key &key, size_t h)
+  {
+    if (overloaded(size_ + deleted_ + 1, slots_.size())) {
+      // if most of the load is tombstones, rehashing in place is enough
+      size_t capacity = std::max<size_t>(slots_.size(), MinCapacity);
+      if (overloaded(2 * (size_ + 1), capacity))
+        capacity *= 2;
+      rehash(capacity);
+    }
+    const size_t mask = slots_.size() - 1;
+    size_t idx = h & mask;
+    while (slots_[idx].hash_ >= MinHash)
+      idx = (idx + 1) & mask;
+    slot_t &slot = slots_[idx];
+    if (slot.hash_ == Deleted)
+      deleted_--;
+    slot.hash_ = h;
+    slot.kv_.first = key;
+    size_++;
+    return idx;
+  }
+
+  void
+  rehash(size_t capacity)
+  {
+    MICROSCOPES_ASSERT(capacity && !(capacity & (capacity - 1)));
+    std::vector<slot_t> old(capacity);
+    old.swap(slots_);
+    deleted_ = 0;
+    const size_t mask = capacity - 1;
+    for (auto &slot : old) {
+      if (slot.hash_ < MinHash)
+        continue;
+      size_t idx = slot.hash_ & mask;
+      while (slots_[idx].hash_ != Empty)
+        idx = (idx + 1) & mask;
+      slots_[idx].hash_ = slot.hash_;
+      slots_[idx].kv_ = std::move(slot.kv_);
+    }
+  }
+
+  std::vector<slot_t> slots_;
+  size_t size_;
+  size_t deleted_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
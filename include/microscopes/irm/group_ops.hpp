@@ -0,0 +1,217 @@
+#pragma once
+
+#include <microscopes/models/base.hpp>
+#include <microscopes/models/distributions.hpp>
+#include <microscopes/common/random_fwd.hpp>
+#include <microscopes/common/assert.hpp>
+
+#include <distributions/models/bb.hpp>
+#include <distributions/models/nich.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+/**
+ * The operations the state performs on the groups of its relations.
+ *
+ * For a distributions type (e.g. distributions::BetaBernoulli), every
+ * relation must be a models::distributions_model<Distribution>. The group
+ * is then known to be a models::distributions_group<Distribution>, and the
+ * calls are bound statically so that the model's arithmetic can be inlined
+ * into the sampling loops.
+ *
+ * group_ops<void> goes through the virtual models::group interface, and
+ * works for any model.
+ */
+template <typename Distribution>
+struct group_ops {
+  typedef models::distributions_model<Distribution> model_type;
+  typedef models::distributions_group<Distribution> group_type;
+
+  static inline bool
+  accepts(const models::model &m)
+  {
+    return dynamic_cast<const model_type *>(&m) != nullptr;
+  }
+
+  static inline void
+  add_value(models::group &g,
+            const models::hypers &h,
+            const common::value_accessor &value,
+            common::rng_t &rng)
+  {
+    MICROSCOPES_ASSERT(dynamic_cast<group_type *>(&g));
+    static_cast<group_type &>(g).group_type::add_value(h, value, rng);
+  }
+
+  static inline void
+  remove_value(models::group &g,
+               const models::hypers &h,
+               const common::value_accessor &value,
+               common::rng_t &rng)
+  {
+    MICROSCOPES_ASSERT(dynamic_cast<group_type *>(&g));
+    static_cast<group_type &>(g).group_type::remove_value(h, value, rng);
+  }
+
+  static inline float
+  score_value(const models::group &g,
+              const models::hypers &h,
+              const common::value_accessor &value,
+              common::rng_t &rng)
+  {
+    MICROSCOPES_ASSERT(dynamic_cast<const group_type *>(&g));
+    return static_cast<const group_type &>(g).group_type::score_value(h, value, rng);
+  }
+
+  static inline float
+  score_data(const models::group &g,
+             const models::hypers &h,
+             common::rng_t &rng)
+  {
+    MICROSCOPES_ASSERT(dynamic_cast<const group_type *>(&g));
+    return static_cast<const group_type &>(g).group_type::score_data(h, rng);
+  }
+};
+
+template <>
+struct group_ops<void> {
+  static inline bool accepts(const models::model &) { return true; }
+
+  static inline void
+  add_value(models::group &g,
+            const models::hypers &h,
+            const common::value_accessor &value,
+            common::rng_t &rng)
+  {
+    g.add_value(h, value, rng);
+  }
+
+  static inline void
+  remove_value(models::group &g,
+               const models::hypers &h,
+               const common::value_accessor &value,
+               common::rng_t &rng)
+  {
+    g.remove_value(h, value, rng);
+  }
+
+  static inline float
+  score_value(const models::group &g,
+              const models::hypers &h,
+              const common::value_accessor &value,
+              common::rng_t &rng)
+  {
+    return g.score_value(h, value, rng);
+  }
+
+  static inline float
+  score_data(const models::group &g,
+             const models::hypers &h,
+             common::rng_t &rng)
+  {
+    return g.score_data(h, rng);
+  }
+};
+
+// the suffstat field key of g. models::group only hands its fields out
+// through mutators, which this only reads
+template <typename T>
+static inline T
+get_ss_field(const models::group &g, const std::string &key)
+{
+  return const_cast<models::group &>(g).get_ss_mutator(key).accessor().get<T>();
+}
+
+/**
+ * Folds the suffstats of one group into another group of the same model, as
+ * if the values of both had been added to it. Only defined for the
+ * conjugate models whose suffstats are known to combine (BetaBernoulli and
+ * NormalInverseChiSq), which are recognized at runtime, and goes through
+ * the suffstat mutators so it works for both the static and the virtual
+ * group interfaces.
+ */
+struct group_merge {
+  typedef models::distributions_group<distributions::BetaBernoulli> bb_group_type;
+  typedef models::distributions_group<distributions::NormalInverseChiSq> nich_group_type;
+
+  static inline bool
+  supports(const models::model &m)
+  {
+    return group_ops<distributions::BetaBernoulli>::accepts(m) ||
+           group_ops<distributions::NormalInverseChiSq>::accepts(m);
+  }
+
+  // src is left untouched
+  static inline void
+  merge(models::group &dst, models::group &src)
+  {
+    if (dynamic_cast<bb_group_type *>(&dst)) {
+      MICROSCOPES_ASSERT(dynamic_cast<bb_group_type *>(&src));
+      add<int32_t>(dst, src, "heads");
+      add<int32_t>(dst, src, "tails");
+      return;
+    }
+    if (dynamic_cast<nich_group_type *>(&dst)) {
+      MICROSCOPES_ASSERT(dynamic_cast<nich_group_type *>(&src));
+      // the pairwise update of the mean and the sum of squared deviations
+      // (Chan et al)
+      const float n0 = get<int32_t>(dst, "count");
+      const float n1 = get<int32_t>(src, "count");
+      if (!n1)
+        return;
+      const float n = n0 + n1;
+      const float mean0 = get<float>(dst, "mean");
+      const float delta = get<float>(src, "mean") - mean0;
+      dst.get_ss_mutator("count").set<int32_t>(n0 + n1);
+      dst.get_ss_mutator("mean").set<float>(mean0 + delta * n1 / n);
+      dst.get_ss_mutator("count_times_variance").set<float>(
+          get<float>(dst, "count_times_variance") +
+          get<float>(src, "count_times_variance") +
+          delta * delta * n0 * n1 / n);
+      return;
+    }
+    MICROSCOPES_CHECK(false, "groups of this model cannot be merged");
+  }
+
+  // empties g, as if every value had been removed from it
+  static inline void
+  clear(models::group &g)
+  {
+    if (dynamic_cast<bb_group_type *>(&g)) {
+      g.get_ss_mutator("heads").set<int32_t>(0);
+      g.get_ss_mutator("tails").set<int32_t>(0);
+      return;
+    }
+    if (dynamic_cast<nich_group_type *>(&g)) {
+      g.get_ss_mutator("count").set<int32_t>(0);
+      g.get_ss_mutator("mean").set<float>(0.);
+      g.get_ss_mutator("count_times_variance").set<float>(0.);
+      return;
+    }
+    MICROSCOPES_CHECK(false, "groups of this model cannot be merged");
+  }
+
+private:
+  template <typename T>
+  static inline T
+  get(models::group &g, const std::string &key)
+  {
+    return g.get_ss_mutator(key).accessor().get<T>();
+  }
+
+  template <typename T>
+  static inline void
+  add(models::group &dst, models::group &src, const std::string &key)
+  {
+    dst.get_ss_mutator(key).set<T>(get<T>(dst, key) + get<T>(src, key));
+  }
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <microscopes/models/base.hpp>
+#include <microscopes/common/random_fwd.hpp>
+#include <microscopes/common/assert.hpp>
+#include <microscopes/common/macros.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+class group_pool;
+
+/**
+ * A non-owning reference to a group living in a group_pool. Cheap to copy
+ * (no refcounting); only valid until released back to its pool
+ */
+class group_handle {
+  friend class group_pool;
+public:
+  group_handle() : px_(), slot_() {}
+
+  inline models::group * get() const { return px_; }
+  inline models::group * operator->() const { MICROSCOPES_ASSERT(px_); return px_; }
+  inline models::group & operator*() const { MICROSCOPES_ASSERT(px_); return *px_; }
+  inline explicit operator bool() const { return px_ != nullptr; }
+
+private:
+  group_handle(models::group *px, size_t slot) : px_(px), slot_(slot) {}
+
+  models::group *px_;
+  size_t slot_;
+};
+
+/**
+ * Owns the groups (block suffstats) of one relation.
+ *
+ * models::hypers::create_group() hands back a freshly allocated,
+ * refcounted group, so the pool keeps those in a flat array of slots and
+ * gives out plain group_handles instead. Slots of released groups are reused.
+ *
+ * If recycling is enabled, released groups are also kept around and handed
+ * back out by acquire() instead of creating a new group. This is only valid
+ * for conjugate models, whose groups are fully described by their
+ * suffstats, and requires that groups are only released once all their
+ * values have been removed.
+ */
+class group_pool {
+public:
+  group_pool() : recycle_(), groups_(), free_(), idle_() {}
+  explicit group_pool(bool recycle)
+    : recycle_(recycle), groups_(), free_(), idle_() {}
+
+  // groups which have been handed out and not yet released
+  inline size_t
+  size() const
+  {
+    return groups_.size() - free_.size() - idle_.size();
+  }
+
+  // an empty group
+  inline group_handle
+  acquire(const models::hypers &hypers, common::rng_t &rng)
+  {
+    if (recycle_ && !idle_.empty()) {
+      const size_t slot = idle_.back();
+      idle_.pop_back();
+      return group_handle(groups_[slot].get(), slot);
+    }
+    size_t slot;
+    if (!free_.empty()) {
+      slot = free_.back();
+      free_.pop_back();
+    } else {
+      slot = groups_.size();
+      groups_.emplace_back();
+    }
+    groups_[slot] = hypers.create_group(rng);
+    return group_handle(groups_[slot].get(), slot);
+  }
+
+  // h is reset
+  inline void
+  release(group_handle &h)
+  {
+    MICROSCOPES_ASSERT(h.px_);
+    MICROSCOPES_ASSERT(h.slot_ < groups_.size());
+    MICROSCOPES_ASSERT(groups_[h.slot_].get() == h.px_);
+    if (recycle_) {
+      idle_.push_back(h.slot_);
+    } else {
+      groups_[h.slot_].reset();
+      free_.push_back(h.slot_);
+    }
+    h = group_handle();
+  }
+
+private:
+  bool recycle_;
+  std::vector<std::shared_ptr<models::group>> groups_;
+  // slots without a group
+  std::vector<size_t> free_;
+  // recycle only: slots holding an empty group, ready to be handed out
+  std::vector<size_t> idle_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
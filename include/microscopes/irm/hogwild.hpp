@@ -0,0 +1,59 @@
+#pragma once
+
+#include <microscopes/common/random_fwd.hpp>
+#include <microscopes/irm/thread_pool.hpp>
+
+#include <algorithm>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * How stale the workers of state::hogwild_assign0() were. A worker is
+ * behind by the moves other workers have published since its last sync,
+ * and pending_ sums those over every sync. Each pending move is an entity
+ * the worker scored against the wrong assignment (and the wrong block
+ * suffstats).
+ */
+struct hogwild_report {
+  hogwild_report() : nsyncs_(), nmoves_(), pending_(), max_pending_() {}
+
+  inline double
+  mean_pending() const
+  {
+    return nsyncs_ ? double(pending_) / double(nsyncs_) : 0.;
+  }
+
+  inline void
+  merge(const hogwild_report &that)
+  {
+    nsyncs_ += that.nsyncs_;
+    nmoves_ += that.nmoves_;
+    pending_ += that.pending_;
+    max_pending_ = std::max(max_pending_, that.max_pending_);
+  }
+
+  // reconciliations with the shared state, over every worker
+  size_t nsyncs_;
+  // entities which changed groups
+  size_t nmoves_;
+  size_t pending_;
+  size_t max_pending_;
+};
+
+/**
+ * A bound domain which supports the asynchronous gibbs sweep of
+ * state::hogwild_assign0()
+ */
+class hogwild_assignable {
+public:
+  virtual ~hogwild_assignable() {}
+
+  // one sweep over every entity of the domain, with one worker per thread of
+  // pool, which syncs every max_staleness entities
+  virtual hogwild_report hogwild_assign(
+      detail::thread_pool &pool, size_t max_staleness, common::rng_t &rng) = 0;
+};
+
+} // namespace irm
+} // namespace microscopes
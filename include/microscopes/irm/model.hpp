@@ -10,10 +10,25 @@
 #include <microscopes/common/static_vector.hpp>
 #include <microscopes/models/base.hpp>
 #include <microscopes/io/schema.pb.h>
+#include <microscopes/irm/flat_hash_map.hpp>
+#include <microscopes/irm/dense_block_table.hpp>
+#include <microscopes/irm/group_pool.hpp>
+#include <microscopes/irm/group_ops.hpp>
+#include <microscopes/irm/entity_index.hpp>
+#include <microscopes/irm/thread_pool.hpp>
+#include <microscopes/irm/chromatic.hpp>
+#include <microscopes/irm/hogwild.hpp>
+#include <microscopes/irm/split_merge.hpp>
+#include <microscopes/irm/tempering.hpp>
+#include <microscopes/irm/counters.hpp>
+#include <microscopes/irm/checkpoint.hpp>
 
 #include <distributions/special.hpp>
+#include <distributions/models/bb.hpp>
+#include <distributions/models/nich.hpp>
 
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <set>
 #include <functional>
@@ -23,26 +38,56 @@
 #include <utility>
 #include <stdexcept>
 #include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
 
 namespace microscopes {
 namespace irm {
 
 class relation_definition {
 public:
-  relation_definition() = default;
+  relation_definition()
+    : domains_(), model_(), conjugate_(), implicit_zeros_() {}
+
+  /**
+   * conjugate: true if the model's groups carry no state besides their
+   * sufficient statistics (in particular, nothing is sampled in
+   * create_group()). This lets the state discard a block as soon as it
+   * becomes empty. It is always safe to leave this off
+   *
+   * implicit_zeros: for binary relations with a BetaBernoulli model. Every
+   * cell which is not observed in the dataview is taken to be an observed
+   * false, and the observed cells must all be true. The state then only
+   * stores the number of true cells of each block, and the cost of a step
+   * is in the number of true cells of the entity rather than the size of
+   * the other domain. Implies conjugate
+   */
   relation_definition(const std::vector<size_t> &domains,
-                      const std::shared_ptr<models::model> &model)
-    : domains_(domains), model_(model)
+                      const std::shared_ptr<models::model> &model,
+                      bool conjugate = false,
+                      bool implicit_zeros = false)
+    : domains_(domains), model_(model),
+      conjugate_(conjugate || implicit_zeros),
+      implicit_zeros_(implicit_zeros)
   {
     MICROSCOPES_DCHECK(domains.size(), "arity impossible");
     MICROSCOPES_DCHECK(model.get(), "nullptr model");
+    MICROSCOPES_DCHECK(!implicit_zeros || domains.size() == 2,
+        "implicit zeros are only supported for binary relations");
   }
   inline const std::vector<size_t> & domains() const { return domains_; }
   inline const std::shared_ptr<models::model> & model() const { return model_; }
   inline size_t arity() const { return domains_.size(); }
+  inline bool conjugate() const { return conjugate_; }
+  inline bool implicit_zeros() const { return implicit_zeros_; }
 private:
   std::vector<size_t> domains_;
   std::shared_ptr<models::model> model_;
+  bool conjugate_;
+  bool implicit_zeros_;
 };
 
 class model_definition {
@@ -100,13 +145,23 @@ struct vector_type_selector {
 typedef std::vector<const common::relation::dataview *> dataset_t;
 typedef detail::domain domain;
 
-template <ssize_t MaxRelationArity = -1>
+/**
+ * Distribution: void for any mix of models. Otherwise a distributions type
+ * (e.g. distributions::BetaBernoulli) which every relation's model must be
+ * a models::distributions_model of, in which case the group operations are
+ * dispatched statically (see detail::group_ops). The library instantiates
+ * the void states, and the BetaBernoulli and NormalInverseChiSq ones
+ */
+template <ssize_t MaxRelationArity = -1, typename Distribution = void>
 class state {
 
   static_assert(MaxRelationArity == -1 || MaxRelationArity >= 2,
                 "Invalid MaxRelationArity, either -1 or >= 2");
 
-  template <ssize_t> friend class model;
+  template <ssize_t, typename> friend class model;
+  template <ssize_t, typename> friend class sharded_worker;
+
+  typedef detail::group_ops<Distribution> group_ops_t;
 
 public:
 
@@ -114,20 +169,104 @@ public:
   typedef std::vector<size_t> variadic_tuple_t;
 
   struct suffstats_t {
-    suffstats_t() : ident_(), count_(), ss_() {}
+    suffstats_t()
+      : ident_(), count_(), ss_(), rindex_(), score_(), dirty_(true) {}
     common::ident_t ident_; // an identifier for outside naming
     unsigned count_; // a ref count, so we know when to remove
-    // XXX: unique_ptr instead?
-    std::shared_ptr<models::group> ss_;
+    detail::group_handle ss_; // owned by the relation's groups_
+    // sparse storage only: for each position i, where this block lives in
+    // the relation's gid_index_[i] list of gids[i]. owned by the relation
+    tuple_t rindex_;
+    // the (untempered) score_data of ss_, unless dirty_. see
+    // relation_container_t::touch()
+    mutable float score_;
+    mutable bool dirty_;
+  };
+
+  typedef detail::flat_hash_map<
+      tuple_t,
+      suffstats_t,
+      detail::gid_tuple_hash<tuple_t>,
+      detail::gid_tuple_equal<tuple_t>> suffstats_table_t;
+
+  typedef detail::flat_hash_map<
+      common::ident_t,
+      tuple_t,
+      detail::integer_hash<common::ident_t>> ident_table_t;
+
+  // gid -> the gids of every block with that gid at some fixed position
+  typedef detail::flat_hash_map<
+      size_t,
+      std::vector<tuple_t>,
+      detail::integer_hash<size_t>> gid_index_t;
+
+  typedef detail::dense_block_table<tuple_t, suffstats_t> dense_table_t;
+
+  struct beta_bernoulli_hp_t {
+    float alpha_;
+    float beta_;
+  };
+
+  // a value handed out for mutation, which the cache it feeds checks for
+  // changes (see relation_container_t::likelihood() and
+  // running_assignment_score()). ident_ is the block whose suffstats it is,
+  // or NoIdent for hyperparameters. seen_ holds the value's raw bytes as of
+  // the last check, so that values of any type (and NaNs) compare exactly
+  struct value_watch_t {
+    static const common::ident_t NoIdent = -1;
+
+    common::ident_t ident_;
+    std::string key_;
+    common::value_mutator value_;
+    std::string seen_;
+
+    // refreshes seen_, true if the value changed
+    bool
+    changed()
+    {
+      const auto value = value_.accessor();
+      const char *p = reinterpret_cast<const char *>(value.data());
+      if (!std::memcmp(seen_.data(), p, seen_.size()))
+        return false;
+      seen_.assign(p, seen_.size());
+      return true;
+    }
+
+    // watches key (of ident) unless it already is
+    static void
+    add(std::vector<value_watch_t> &watches,
+        common::ident_t ident,
+        const std::string &key,
+        const common::value_mutator &value)
+    {
+      for (const auto &w : watches)
+        if (w.ident_ == ident && w.key_ == key)
+          return;
+      watches.emplace_back();
+      auto &w = watches.back();
+      w.ident_ = ident;
+      w.key_ = key;
+      w.value_ = value;
+      const auto accessor = value.accessor();
+      w.seen_.assign(
+          reinterpret_cast<const char *>(accessor.data()),
+          accessor.type().size());
+    }
   };
 
   struct relation_container_t {
     relation_container_t()
-      : desc_(), hypers_(),
-        suffstats_table_(), ident_table_(), ident_gen_() {}
+      : desc_(), hypers_(), dense_(),
+        suffstats_table_(), gid_index_(), dense_table_(),
+        ident_table_(), ident_gen_(), groups_(), scratch_(),
+        cache_valid_(), cached_score_(), dirty_(), watches_(),
+        zeros_alpha_(), zeros_beta_(), counters_() {}
     relation_container_t(const relation_definition &desc)
-      : desc_(desc), hypers_(desc.model()->create_hypers()),
-        suffstats_table_(), ident_table_(), ident_gen_()
+      : desc_(desc), hypers_(desc.model()->create_hypers()), dense_(),
+        suffstats_table_(), gid_index_(), dense_table_(),
+        ident_table_(), ident_gen_(), groups_(desc.conjugate()), scratch_(),
+        cache_valid_(), cached_score_(), dirty_(), watches_(),
+        zeros_alpha_(), zeros_beta_(), counters_()
     {
       if (MaxRelationArity != -1)
         MICROSCOPES_DCHECK(
@@ -139,31 +278,449 @@ public:
     dump(io::IrmRelation &r) const
     {
       r.set_hypers(hypers_->get_hp());
-      for (const auto &p : suffstats_table_) {
+      for_each_suffstats([&r](const tuple_t &gids, const suffstats_t &s) {
         io::IrmSuffstat &ss = *r.add_suffstats();
-        for (auto gid : p.first)
+        for (auto gid : gids)
           ss.add_gids(gid);
-        ss.set_id(p.second.ident_);
-        ss.set_count(p.second.count_);
-        ss.set_suffstat(p.second.ss_->get_ss());
+        ss.set_id(s.ident_);
+        ss.set_count(s.count_);
+        // implicit zeros: the count is the whole suffstat
+        ss.set_suffstat(s.ss_ ? s.ss_->get_ss() : "");
+      });
+    }
+
+    // the suffstats of a relation live in exactly one of suffstats_table_
+    // (sparse, the default) or dense_table_, depending on dense_. all access
+    // should go through the *_suffstats() methods below
+
+    // nullptr if the block does not exist
+    inline suffstats_t *
+    find_suffstats(const tuple_t &gids)
+    {
+      counters_.suffstats_lookups_.add();
+      suffstats_t *p;
+      if (dense_) {
+        p = dense_table_.find(gids);
+      } else {
+        auto it = suffstats_table_.find(gids);
+        p = it == suffstats_table_.end() ? nullptr : &it->second;
+      }
+      if (p)
+        counters_.suffstats_hits_.add();
+      return p;
+    }
+
+    inline const suffstats_t *
+    find_suffstats(const tuple_t &gids) const
+    {
+      return const_cast<relation_container_t *>(this)->find_suffstats(gids);
+    }
+
+    // the block must not exist. callers fill in everything but rindex_ (and
+    // the likelihood cache)
+    inline suffstats_t &
+    insert_suffstats(const tuple_t &gids)
+    {
+      counters_.blocks_created_.add();
+      if (dense_) {
+        auto &ss = dense_table_.insert(gids);
+        ss.dirty_ = true;
+        mark_dirty(gids);
+        return ss;
+      }
+      MICROSCOPES_ASSERT(suffstats_table_.find(gids) == suffstats_table_.end());
+      auto &ss = suffstats_table_[gids];
+      ss.dirty_ = true;
+      mark_dirty(gids);
+      if (gid_index_.size() != gids.size())
+        gid_index_.resize(gids.size());
+      ss.rindex_.clear();
+      for (size_t i = 0; i < gids.size(); i++) {
+        auto &blocks = gid_index_[i][gids[i]];
+        ss.rindex_.push_back(blocks.size());
+        blocks.push_back(gids);
+      }
+      return ss;
+    }
+
+    // the block must exist. its group is released to groups_
+    inline void
+    erase_suffstats(const tuple_t &gids)
+    {
+      if (dense_) {
+        release_group(*dense_table_.find(gids));
+        dense_table_.erase(gids);
+        return;
+      }
+      auto it = suffstats_table_.find(gids);
+      MICROSCOPES_ASSERT(it != suffstats_table_.end());
+      release_group(it->second);
+      for (size_t i = 0; i < gids.size(); i++) {
+        auto it1 = gid_index_[i].find(gids[i]);
+        MICROSCOPES_ASSERT(it1 != gid_index_[i].end());
+        auto &blocks = it1->second;
+        const size_t idx = it->second.rindex_[i];
+        MICROSCOPES_ASSERT(idx < blocks.size());
+        if (idx != blocks.size() - 1) {
+          blocks[idx] = blocks.back();
+          auto moved = suffstats_table_.find(blocks[idx]);
+          MICROSCOPES_ASSERT(moved != suffstats_table_.end());
+          moved->second.rindex_[i] = idx;
+        }
+        blocks.pop_back();
+        if (blocks.empty())
+          gid_index_[i].erase(it1);
+      }
+      suffstats_table_.erase(it);
+    }
+
+    // erases every block with gid at any of positions whose domain is
+    // domain. f(suffstats_t &ss) is called on each block right before it is
+    // erased. only the blocks involving gid are visited
+    template <typename F>
+    inline void
+    erase_group(size_t domain, size_t gid, F f)
+    {
+      if (dense_) {
+        dense_table_.erase_group(domain, gid, [this, &f](suffstats_t &ss) {
+          f(ss);
+          this->release_group(ss);
+        });
+        return;
+      }
+      std::vector<tuple_t> blocks;
+      for (size_t i = 0; i < gid_index_.size(); i++) {
+        if (desc_.domains()[i] != domain)
+          continue;
+        auto it = gid_index_[i].find(gid);
+        if (it == gid_index_[i].end())
+          continue;
+        // erasing a block edits the list, so work off a copy
+        blocks = it->second;
+        for (const auto &gids : blocks) {
+          auto it1 = suffstats_table_.find(gids);
+          MICROSCOPES_ASSERT(it1 != suffstats_table_.end());
+          f(it1->second);
+          erase_suffstats(gids);
+        }
+        MICROSCOPES_ASSERT(gid_index_[i].find(gid) == gid_index_[i].end());
+      }
+    }
+
+    // f(const tuple_t &gids, suffstats_t &ss) for each block with gid at
+    // some position whose domain is domain, once each. only the blocks
+    // involving gid are visited; f must not insert or erase blocks
+    template <typename F>
+    inline void
+    for_each_group_suffstats(size_t domain, size_t gid, F f)
+    {
+      if (dense_) {
+        dense_table_.for_each_in_group(domain, gid, f);
+        return;
+      }
+      const auto &doms = desc_.domains();
+      for (size_t i = 0; i < gid_index_.size(); i++) {
+        if (doms[i] != domain)
+          continue;
+        auto it = gid_index_[i].find(gid);
+        if (it == gid_index_[i].end())
+          continue;
+        for (const auto &gids : it->second) {
+          // visited already, off an earlier position of the same domain
+          size_t j = 0;
+          while (j < i && (doms[j] != domain || gids[j] != gid))
+            j++;
+          if (j < i)
+            continue;
+          auto it1 = suffstats_table_.find(gids);
+          MICROSCOPES_ASSERT(it1 != suffstats_table_.end());
+          f(gids, it1->second);
+        }
+      }
+    }
+
+    // f(const tuple_t &gids, suffstats_t &ss) for each block
+    template <typename F>
+    inline void
+    for_each_suffstats(F f)
+    {
+      if (dense_) {
+        dense_table_.for_each(f);
+        return;
+      }
+      for (auto &p : suffstats_table_)
+        f(const_cast<const tuple_t &>(p.first), p.second);
+    }
+
+    template <typename F>
+    inline void
+    for_each_suffstats(F f) const
+    {
+      if (dense_) {
+        dense_table_.for_each(f);
+        return;
+      }
+      for (const auto &p : suffstats_table_)
+        f(p.first, p.second);
+    }
+
+    inline size_t
+    nsuffstats() const
+    {
+      return dense_ ? dense_table_.size() : suffstats_table_.size();
+    }
+
+    // checks gid_index_, and the rindex_ of every block, against the table
+    void
+    check_index() const
+    {
+      if (dense_)
+        return;
+      MICROSCOPES_CHECK(gid_index_.size() || !suffstats_table_.size(),
+          "blocks without an index");
+      for (size_t i = 0; i < gid_index_.size(); i++) {
+        size_t n = 0;
+        for (const auto &p : gid_index_[i]) {
+          MICROSCOPES_CHECK(p.second.size(), "empty gid index list");
+          for (size_t j = 0; j < p.second.size(); j++) {
+            const auto &gids = p.second[j];
+            MICROSCOPES_CHECK(gids[i] == p.first, "block indexed under the wrong gid");
+            auto it = suffstats_table_.find(gids);
+            MICROSCOPES_CHECK(it != suffstats_table_.end(), "indexed block is gone");
+            MICROSCOPES_CHECK(it->second.rindex_[i] == j, "stale rindex");
+          }
+          n += p.second.size();
+        }
+        MICROSCOPES_CHECK(n == suffstats_table_.size(), "unindexed blocks");
+      }
+    }
+
+    // moves the suffstats into the requested storage
+    void
+    set_dense(bool dense)
+    {
+      if (dense == dense_)
+        return;
+      relation_container_t that;
+      that.dense_ = dense;
+      if (dense)
+        that.dense_table_ = dense_table_t(desc_.domains());
+      for_each_suffstats([&that](const tuple_t &gids, suffstats_t &ss) {
+        auto &ss1 = that.insert_suffstats(gids);
+        ss1.ident_ = ss.ident_;
+        ss1.count_ = ss.count_;
+        ss1.ss_ = ss.ss_;
+      });
+      dense_ = dense;
+      invalidate_cache();
+      suffstats_table_ = std::move(that.suffstats_table_);
+      gid_index_ = std::move(that.gid_index_);
+      dense_table_ = std::move(that.dense_table_);
+    }
+
+    // conjugate models only: an always empty group, to score against
+    // blocks which do not exist (instead of creating them). concurrent
+    // scorers each use their own slot, see reserve_scratch_groups()
+    inline models::group &
+    scratch_group(common::rng_t &rng, size_t slot = 0)
+    {
+      MICROSCOPES_ASSERT(desc_.conjugate());
+      if (unlikely(slot >= scratch_.size()))
+        scratch_.resize(slot + 1);
+      if (unlikely(!scratch_[slot]))
+        scratch_[slot] = hypers_->create_group(rng);
+      return *scratch_[slot];
+    }
+
+    // makes sure slots [0, n) exist, so that scratch_group() does not
+    // modify the relation
+    inline void
+    reserve_scratch_groups(common::rng_t &rng, size_t n)
+    {
+      for (size_t i = n; i-- > 0; )
+        scratch_group(rng, i);
+    }
+
+    // for conjugate models, groups_ hands the (empty) group out again.
+    // blocks of implicit zero relations have no group. the block leaves the
+    // likelihood cache
+    inline void
+    release_group(suffstats_t &ss)
+    {
+      counters_.blocks_erased_.add();
+      if (cache_valid_ && !ss.dirty_)
+        cached_score_ -= ss.score_;
+      ss.dirty_ = true;
+      if (!watches_.empty())
+        watches_.erase(
+            std::remove_if(watches_.begin(), watches_.end(),
+              [&ss](const value_watch_t &w) { return w.ident_ == ss.ident_; }),
+            watches_.end());
+      if (ss.ss_)
+        groups_.release(ss.ss_);
+    }
+
+    // must be called whenever the group of block gids changes, for
+    // likelihood() to rescore it
+    inline void
+    touch(const tuple_t &gids, const suffstats_t &ss) const
+    {
+      if (ss.dirty_ || !cache_valid_) {
+        ss.dirty_ = true;
+        return;
+      }
+      ss.dirty_ = true;
+      cached_score_ -= ss.score_;
+      mark_dirty(gids);
+    }
+
+    inline void
+    mark_dirty(const tuple_t &gids) const
+    {
+      if (!cache_valid_)
+        return;
+      dirty_.push_back(gids);
+      // blocks which come and go between calls to likelihood() would grow
+      // the list without bound. past this point most blocks are likely
+      // dirty, and rescoring everything costs about as much
+      if (dirty_.size() > 4 * nsuffstats() + 256)
+        invalidate_cache();
+    }
+
+    inline void
+    invalidate_cache() const
+    {
+      cache_valid_ = false;
+      dirty_.clear();
+    }
+
+    // value was handed out for mutation, see value_watch_t. likelihood()
+    // checks it for changes from then on
+    inline void
+    watch(common::ident_t ident,
+          const std::string &key,
+          const common::value_mutator &value)
+    {
+      value_watch_t::add(watches_, ident, key, value);
+    }
+
+    // the untempered likelihood of the relation's blocks: only the blocks
+    // touched since the last call are rescored, unless the hyperparameters
+    // changed, which rescores every block. not for implicit zero relations,
+    // and not thread safe
+    double
+    likelihood(common::rng_t &rng) const
+    {
+      MICROSCOPES_ASSERT(!desc_.implicit_zeros());
+      // the values handed out for mutation which changed since the last
+      // call are as good as set_*() calls
+      for (auto &w : watches_) {
+        if (!w.changed())
+          continue;
+        if (w.ident_ == value_watch_t::NoIdent) {
+          invalidate_cache();
+          continue;
+        }
+        const auto &gids = ident_table_.find(w.ident_)->second;
+        touch(gids, *find_suffstats(gids));
+      }
+      if (!cache_valid_) {
+        cached_score_ = 0.;
+        dirty_.clear();
+        const auto &m = *hypers_;
+        for_each_suffstats(
+          [this, &m, &rng](const tuple_t &, const suffstats_t &ss) {
+            ss.score_ = group_ops_t::score_data(*ss.ss_, m, rng);
+            ss.dirty_ = false;
+            this->cached_score_ += ss.score_;
+          });
+        cache_valid_ = true;
+        return cached_score_;
+      }
+      for (const auto &gids : dirty_) {
+        const auto p = find_suffstats(gids);
+        // erased since (see release_group()), or seen already
+        if (!p || !p->dirty_)
+          continue;
+        p->score_ = group_ops_t::score_data(*p->ss_, *hypers_, rng);
+        p->dirty_ = false;
+        cached_score_ += p->score_;
       }
+      dirty_.clear();
+      return cached_score_;
+    }
+
+    // implicit zero relations only: points zeros_alpha_ and zeros_beta_ at
+    // the hyperparameters held by hypers_, so that scoring reads them in
+    // place instead of parsing the hp message. set_hp() and the mutators
+    // write to the same place, so they need no refresh; replacing hypers_
+    // does
+    void
+    bind_zeros_hp()
+    {
+      if (!desc_.implicit_zeros())
+        return;
+      zeros_alpha_ = hypers_->get_hp_mutator("alpha").accessor();
+      zeros_beta_ = hypers_->get_hp_mutator("beta").accessor();
     }
 
     relation_definition desc_;
     // XXX: unique_ptr instead?
     std::shared_ptr<models::hypers> hypers_;
-    std::map<tuple_t, suffstats_t> suffstats_table_;
-    std::map<common::ident_t, tuple_t> ident_table_;
+    bool dense_;
+    suffstats_table_t suffstats_table_;
+    // sparse storage only: for each position, the blocks touching each gid
+    std::vector<gid_index_t> gid_index_;
+    dense_table_t dense_table_;
+    ident_table_t ident_table_;
     common::ident_t ident_gen_;
+    detail::group_pool groups_;
+    std::vector<std::shared_ptr<models::group>> scratch_;
+
+    // the likelihood cache, see likelihood(). cached_score_ is the sum of
+    // the scores of the clean blocks, and dirty_ lists the blocks touched
+    // since the last call (with repeats, and blocks erased since)
+    mutable bool cache_valid_;
+    mutable double cached_score_;
+    mutable std::vector<tuple_t> dirty_;
+
+    // see watch()
+    mutable std::vector<value_watch_t> watches_;
+
+    // see bind_zeros_hp()
+    common::value_accessor zeros_alpha_;
+    common::value_accessor zeros_beta_;
+
+    // see state::counters()
+    mutable detail::relation_counters_t counters_;
   };
 
   state(const std::vector<domain> &domains,
         const std::vector<relation_container_t> &relations)
-    : domains_(domains), relations_(relations)
+    : domains_(domains), relations_(relations),
+      score_pool_(), relation_pool_(), inverse_temperature_(1.),
+      assignment_scores_(domains.size()), group_members_(domains.size()),
+      domain_counters_(domains.size())
   {
+    for (auto &r : relations_) {
+      MICROSCOPES_CHECK(group_ops_t::accepts(*r.desc_.model()),
+          "relation model does not match the state's distribution");
+      MICROSCOPES_CHECK(!r.desc_.implicit_zeros() ||
+          detail::group_ops<distributions::BetaBernoulli>::accepts(*r.desc_.model()),
+          "implicit zeros require a BetaBernoulli model");
+      r.bind_zeros_hp();
+    }
     domain_relations_.reserve(domains_.size());
-    for (size_t i = 0; i < domains_.size(); i++)
+    relation_runs_.reserve(domains_.size());
+    for (size_t i = 0; i < domains_.size(); i++) {
       domain_relations_.emplace_back(domain_relations(i));
+      relation_runs_.emplace_back();
+      const auto &drs = domain_relations_.back();
+      for (size_t j = 0; j < drs.size(); j++)
+        if (!j || drs[j].rel_ != drs[j - 1].rel_)
+          relation_runs_.back().push_back(j);
+      relation_runs_.back().push_back(drs.size());
+    }
   }
 
   inline size_t
@@ -235,13 +792,19 @@ public:
   {
     MICROSCOPES_DCHECK(domain < domains_.size(), "invalid domain id");
     domains_[domain].set_hp(hp);
+    assignment_scores_[domain].valid_ = false;
   }
 
+  // the running assignment score of the domain watches the value from now
+  // on (see running_assignment_score())
   inline common::value_mutator
   get_domain_hp_mutator(size_t domain, const std::string &key)
   {
     MICROSCOPES_DCHECK(domain < domains_.size(), "invalid domain id");
-    return domains_[domain].get_hp_mutator(key);
+    const auto value = domains_[domain].get_hp_mutator(key);
+    value_watch_t::add(
+        assignment_scores_[domain].watches_, value_watch_t::NoIdent, key, value);
+    return value;
   }
 
   inline common::hyperparam_bag_t
@@ -256,6 +819,7 @@ public:
   {
     MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
     relations_[relation].hypers_->set_hp(hp);
+    relations_[relation].invalidate_cache();
   }
 
   inline void
@@ -263,13 +827,18 @@ public:
   {
     MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
     relations_[relation].hypers_->set_hp(proto);
+    relations_[relation].invalidate_cache();
   }
 
+  // the likelihood cache of the relation watches the value from now on
   inline common::value_mutator
   get_relation_hp_mutator(size_t relation, const std::string &key)
   {
     MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
-    return relations_[relation].hypers_->get_hp_mutator(key);
+    auto &reln = relations_[relation];
+    const auto value = reln.hypers_->get_hp_mutator(key);
+    reln.watch(value_watch_t::NoIdent, key, value);
+    return value;
   }
 
   inline std::vector<common::ident_t>
@@ -281,12 +850,15 @@ public:
     ret.reserve(tab.size());
     for (const auto &p : tab)
       ret.push_back(p.first);
+    // the table is unordered, but callers expect a stable listing
+    std::sort(ret.begin(), ret.end());
     return ret;
   }
 
   inline common::suffstats_bag_t
   get_suffstats(size_t relation, common::ident_t id) const
   {
+    check_explicit_suffstats(relation);
     return get_suffstats_t(relation, id).ss_->get_ss();
   }
 
@@ -294,27 +866,38 @@ public:
   get_suffstats(size_t relation, const variadic_tuple_t &gids, common::suffstats_bag_t &ss) const
   {
     MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
+    check_explicit_suffstats(relation);
     const auto &gids1 =
       detail::vector_type_selector<size_t, MaxRelationArity>::from_variadic(gids);
-    const auto it = relations_[relation].suffstats_table_.find(gids1);
-    if (it == relations_[relation].suffstats_table_.end())
+    const auto p = relations_[relation].find_suffstats(gids1);
+    if (!p)
       return false;
-    ss = it->second.ss_->get_ss();
+    ss = p->ss_->get_ss();
     return true;
   }
 
   inline void
   set_suffstats(size_t relation, common::ident_t id, const common::suffstats_bag_t &ss)
   {
-    get_suffstats_t(relation, id).ss_->set_ss(ss);
+    check_explicit_suffstats(relation);
+    auto &s = get_suffstats_t(relation, id);
+    s.ss_->set_ss(ss);
+    auto &reln = relations_[relation];
+    reln.touch(reln.ident_table_.find(id)->second, s);
   }
 
+  // the likelihood cache of the relation watches the value from now on,
+  // until the block goes away
   inline common::value_mutator
   get_suffstats_mutator(size_t relation, common::ident_t id, const std::string &key)
   {
-    return get_suffstats_t(relation, id).ss_->get_ss_mutator(key);
+    check_explicit_suffstats(relation);
+    const auto value = get_suffstats_t(relation, id).ss_->get_ss_mutator(key);
+    relations_[relation].watch(id, key, value);
+    return value;
   }
 
+  // for implicit zero relations, the number of true cells of the block
   inline size_t
   get_suffstats_count(size_t relation, common::ident_t id) const
   {
@@ -332,30 +915,160 @@ public:
   delete_group(size_t domain, size_t gid)
   {
     MICROSCOPES_DCHECK(domain < domains_.size(), "invalid domain id");
-    // XXX: see note in remove_value_from_feature_group()
-    // XXX: our GC strategy is currently inefficient
+    // reclaim the blocks which can no longer be used, see the note in
+    // remove_value_from_feature_group()
     for (const auto &dr : domain_relations_[domain]) {
       auto &relation = relations_[dr.rel_];
-      auto it = relation.suffstats_table_.begin();
-      while (it != relation.suffstats_table_.end()) {
-        if (it->first[dr.pos_] != gid) {
-          ++it;
-          continue;
-        }
-        MICROSCOPES_ASSERT(!it->second.count_);
-        relation.ident_table_.erase(it->second.ident_);
-        relation.suffstats_table_.erase(it++); // must use postfix add
-      }
+      // a relation with the domain at several positions is handled in full
+      // by its first one
+      const auto &doms = relation.desc_.domains();
+      if (std::find(doms.begin(), doms.begin() + dr.pos_, domain) !=
+          doms.begin() + dr.pos_)
+        continue;
+      relation.erase_group(domain, gid, [&relation](suffstats_t &ss) {
+        MICROSCOPES_ASSERT(!ss.count_);
+        relation.ident_table_.erase(ss.ident_);
+      });
     }
     domains_[domain].delete_group(gid);
   }
 
+  /**
+   * Switches the suffstats of relation between the default sparse (hash
+   * table) storage and a dense block tensor indexed by gids. Dense storage
+   * makes every lookup O(1) index arithmetic, at the cost of memory
+   * proportional to the product of the number of groups of the relation's
+   * domains
+   */
+  inline void
+  set_dense_suffstats(size_t relation, bool dense)
+  {
+    MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
+    relations_[relation].set_dense(dense);
+  }
+
+  inline bool
+  dense_suffstats(size_t relation) const
+  {
+    MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
+    return relations_[relation].dense_;
+  }
+
+  // throws unless the reverse index of the sparse blocks of relation (which
+  // erase_group() and erase_suffstats() walk) agrees with its table; meant
+  // for tests
+  inline void
+  check_suffstats_index(size_t relation) const
+  {
+    MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
+    relations_[relation].check_index();
+  }
+
+  /**
+   * Spreads the candidate groups scored by inplace_score_value() over
+   * nthreads threads (the caller's included); 1, the default, scores them
+   * serially. Each thread draws from its own rng, seeded from the caller's.
+   *
+   * Only pays off for domains with many groups and entities with a lot of
+   * data; small domains are always scored serially
+   */
+  inline void
+  set_score_threads(size_t nthreads)
+  {
+    MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+    if (nthreads == score_threads())
+      return;
+    score_pool_.reset();
+    if (nthreads > 1)
+      score_pool_ = std::make_shared<detail::thread_pool>(nthreads);
+  }
+
+  inline size_t
+  score_threads() const
+  {
+    return score_pool_ ? score_pool_->size() : 1;
+  }
+
+  /**
+   * Spreads the relations an entity's domain takes part in over nthreads
+   * threads (the caller's included) when adding, removing and scoring the
+   * entity; 1, the default, walks them serially. Each relation is handled
+   * by exactly one thread, so their suffstats need no locking, and the
+   * scores are summed at the end. Each thread draws from its own rng,
+   * seeded from the caller's.
+   *
+   * Takes precedence over set_score_threads() for domains in more than one
+   * relation
+   */
+  inline void
+  set_relation_threads(size_t nthreads)
+  {
+    MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+    if (nthreads == relation_threads())
+      return;
+    relation_pool_.reset();
+    if (nthreads > 1)
+      relation_pool_ = std::make_shared<detail::thread_pool>(nthreads);
+  }
+
+  inline size_t
+  relation_threads() const
+  {
+    return relation_pool_ ? relation_pool_->size() : 1;
+  }
+
+  /**
+   * Tempers the likelihood: the likelihood terms of score_value() and
+   * score_likelihood() are scaled by beta, so that samplers target
+   * prior * likelihood^beta (see tempering_runner). 1, the default, is the
+   * posterior. Not part of the serialized state
+   */
+  inline void
+  set_inverse_temperature(float beta)
+  {
+    MICROSCOPES_CHECK(beta > 0. && beta <= 1.,
+        "inverse temperature must be in (0, 1]");
+    inverse_temperature_ = beta;
+  }
+
+  inline float inverse_temperature() const { return inverse_temperature_; }
+
+  /**
+   * The hot path counters of the state so far (see relation_counters and
+   * domain_counters), for tuning kernels against a dataset without a
+   * profiler. Only kept when compiled with MICROSCOPES_IRM_COUNTERS,
+   * otherwise they are never updated and read as zeros.
+   *
+   * The private copies the hogwild and sharded kernels sweep are not
+   * counted, only the moves they apply back to this state
+   */
+  inline state_counters
+  counters() const
+  {
+    state_counters ret;
+    ret.enabled_ = detail::counters_enabled;
+    for (const auto &c : domain_counters_)
+      ret.domains_.push_back(c.snapshot());
+    for (const auto &r : relations_)
+      ret.relations_.push_back(r.counters_.snapshot());
+    return ret;
+  }
+
+  inline void
+  reset_counters()
+  {
+    for (auto &c : domain_counters_)
+      c.reset();
+    for (auto &r : relations_)
+      r.counters_.reset();
+  }
+
   inline void
   add_value(size_t domain, size_t gid, size_t eid, const dataset_t &d, common::rng_t &rng)
   {
     MICROSCOPES_DCHECK(domain < domains_.size(), "invalid domain");
     assert_correct_shape(d);
-    add_value0(domain, gid, eid, d, rng, nullptr);
+    add_value0(domain, gid, eid, d, rng);
   }
 
   inline size_t
@@ -404,18 +1117,23 @@ public:
   score_likelihood(size_t relation, common::ident_t id, common::rng_t &rng) const
   {
     auto &ss = get_suffstats_t(relation, id);
-    return ss.ss_->score_data(*relations_[relation].hypers_, rng);
+    const auto &reln = relations_[relation];
+    if (reln.desc_.implicit_zeros()) {
+      const auto hp = implicit_zeros_hp(reln);
+      return inverse_temperature_ * score_implicit_zeros_block(
+          hp, ss.count_, implicit_zeros_ncells(reln, reln.ident_table_.find(id)->second));
+    }
+    return inverse_temperature_ * group_ops_t::score_data(*ss.ss_, *reln.hypers_, rng);
   }
 
   inline float
   score_likelihood(size_t relation, common::rng_t &rng) const
   {
     MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
-    float score = 0.;
-    auto &m = relations_[relation].hypers_;
-    for (auto &p : relations_[relation].suffstats_table_)
-      score += p.second.ss_->score_data(*m, rng);
-    return score;
+    if (relations_[relation].desc_.implicit_zeros())
+      return inverse_temperature_ *
+        score_implicit_zeros_likelihood(relations_[relation]);
+    return inverse_temperature_ * relations_[relation].likelihood(rng);
   }
 
   inline float
@@ -427,6 +1145,43 @@ public:
     return score;
   }
 
+  /**
+   * score_assignment() + score_likelihood(rng), without recomputing either
+   * from scratch. The assignment score of each domain is kept up to date by
+   * the delta of every move (see domain_add_value()), and the likelihood by
+   * the block caches of the relations (see relation_container_t::likelihood()),
+   * so logging it every step costs little more than the moves themselves.
+   * A change to the hyperparameters of a domain, by any means, rescores
+   * that domain. In debug mode, every call is checked against the full
+   * recomputation. Not thread safe
+   */
+  float
+  score_joint(common::rng_t &rng) const
+  {
+    double score = 0.;
+    for (size_t i = 0; i < domains_.size(); i++)
+      score += running_assignment_score(i);
+    for (size_t i = 0; i < relations_.size(); i++)
+      score += score_likelihood(i, rng);
+#ifdef DEBUG_MODE
+    double full = score_assignment();
+    for (const auto &r : relations_) {
+      if (r.desc_.implicit_zeros()) {
+        full += inverse_temperature_ * score_implicit_zeros_likelihood(r);
+        continue;
+      }
+      r.for_each_suffstats(
+        [this, &r, &full, &rng](const tuple_t &, const suffstats_t &ss) {
+          full += this->inverse_temperature_ *
+            group_ops_t::score_data(*ss.ss_, *r.hypers_, rng);
+        });
+    }
+    MICROSCOPES_DCHECK(std::fabs(score - full) <= 1e-3 * std::max(1., std::fabs(full)),
+        "running joint drifted from the full recomputation");
+#endif
+    return score;
+  }
+
   inline void
   assert_correct_shape(const dataset_t &d) const
   {
@@ -445,8 +1200,8 @@ public:
     std::vector<variadic_tuple_t> ret;
     iterate_over_entity_data(
         domain, eid, d,
-        [&ret](size_t, const variadic_tuple_t &eids, const common::value_accessor &) {
-          ret.emplace_back(eids);
+        [this, &ret](size_t rid, const size_t *eids, const common::value_accessor &) {
+          ret.emplace_back(eids, eids + this->relations_[rid].desc_.arity());
         });
     return ret;
   }
@@ -483,119 +1238,1902 @@ public:
       domains.emplace_back(n);
     std::vector<relation_container_t> relations;
     relations.reserve(defn.relations().size());
-    for (const auto &r : defn.relations()) {
-      relations.emplace_back();
-      auto &reln = relations.back();
-      reln.desc_ = r;
-      reln.hypers_ = r.model()->create_hypers();
-    }
+    for (const auto &r : defn.relations())
+      relations.emplace_back(r);
     return std::make_shared<state>(domains, relations);
   }
 
+  // with nthreads > 1, the suffstats of the conjugate relations whose
+  // blocks can be merged (see detail::group_merge) are built over that many
+  // threads, see build_suffstats()
   static std::shared_ptr<state>
   initialize(const model_definition &defn,
              const std::vector<common::hyperparam_bag_t> &cluster_inits,
              const std::vector<common::hyperparam_bag_t> &relation_inits,
              const std::vector<variadic_tuple_t> &domain_assignments,
              const dataset_t &data,
-             common::rng_t &rng);
+             common::rng_t &rng,
+             size_t nthreads = 1);
 
+  // deprecated: the groups of non-conjugate relations come from a default
+  // seeded rng. pass one instead
   static std::shared_ptr<state>
   deserialize(const model_definition &defn,
-              const common::serialized_t &s);
+              const common::serialized_t &s) __attribute__((deprecated));
+
+  // the groups of non-conjugate relations are drawn from rng. the tables
+  // of the relations are sized up front, and the suffstats are decoded
+  // over nthreads threads
+  static std::shared_ptr<state>
+  deserialize(const model_definition &defn,
+              const common::serialized_t &s,
+              common::rng_t &rng,
+              size_t nthreads = 1);
+
+  /**
+   * Writes the state to path as a binary checkpoint (see
+   * detail::checkpoint_encoding), as it goes instead of building the whole
+   * message first like serialize() does. The file only replaces path once
+   * complete
+   */
+  void save_checkpoint(const std::string &path) const;
+
+  /**
+   * Restores a state saved by save_checkpoint(). The file is mapped, and
+   * the state is built straight off the mapping: no suffstat of a
+   * BetaBernoulli or NormalInverseChiSq relation is parsed. The groups of
+   * each domain are renumbered 0 to ngroups - 1, in order; the suffstat
+   * identifiers are kept. Like deserialize(), the overload without an rng
+   * is deprecated
+   */
+  static std::shared_ptr<state>
+  load_checkpoint(const model_definition &defn,
+                  const std::string &path) __attribute__((deprecated));
+
+  // see deserialize()
+  static std::shared_ptr<state>
+  load_checkpoint(const model_definition &defn,
+                  const std::string &path,
+                  common::rng_t &rng,
+                  size_t nthreads = 1);
 
 protected:
-  // the *_value0 methods do no error checking
+  // the *_value0 methods do no error checking. the entity's data is read
+  // from d, which is either the dataset_t itself or the detail::entity_index
+  // of the domain built from it (see build_entity_index())
+
+  // every move of an entity of the state goes through these two, which keep
+  // the running assignment score of the domain (see score_joint()) up to
+  // date. under the CRP, one more entity in a group of m out of n assigned
+  // entities scores
+  //
+  //   log(m ? m : alpha) - log(alpha + n)
+  //
+  // and empty groups do not count, so creating and deleting them is free
+  inline void
+  domain_add_value(size_t did, size_t gid, size_t eid)
+  {
+    auto &a = assignment_scores_[did];
+    if (a.valid_) {
+      const size_t m = domains_[did].groupsize(gid);
+      a.score_ += a.delta(m);
+      a.nassigned_++;
+    }
+    domains_[did].add_value(gid, eid);
+    auto &gm = group_members_[did];
+    if (gm.valid_) {
+      auto &members = gm.members_[gid];
+      gm.pos_[eid] = members.size();
+      members.push_back(eid);
+    }
+  }
+
+  inline size_t
+  domain_remove_value(size_t did, size_t eid)
+  {
+    const size_t gid = domains_[did].remove_value(eid).first;
+    auto &a = assignment_scores_[did];
+    if (a.valid_) {
+      a.nassigned_--;
+      const size_t m = domains_[did].groupsize(gid);
+      a.score_ -= a.delta(m);
+    }
+    auto &gm = group_members_[did];
+    if (gm.valid_) {
+      auto it = gm.members_.find(gid);
+      MICROSCOPES_ASSERT(it != gm.members_.end());
+      auto &members = it->second;
+      const size_t idx = gm.pos_[eid];
+      members[idx] = members.back();
+      gm.pos_[members[idx]] = idx;
+      members.pop_back();
+      if (members.empty())
+        gm.members_.erase(it);
+    }
+    return gid;
+  }
+
+  // the entities of the (non-empty) group gid of did, in no particular
+  // order. the lists of did are built on the first call, and kept up to
+  // date by domain_add_value() and domain_remove_value() from then on
+  inline const std::vector<size_t> &
+  group_members(size_t did, size_t gid)
+  {
+    auto &gm = group_members_[did];
+    if (!gm.valid_) {
+      const auto &assignments = domains_[did].assignments();
+      gm.members_.clear();
+      gm.pos_.assign(assignments.size(), 0);
+      for (size_t eid = 0; eid < assignments.size(); eid++) {
+        if (assignments[eid] == -1)
+          continue;
+        auto &members = gm.members_[assignments[eid]];
+        gm.pos_[eid] = members.size();
+        members.push_back(eid);
+      }
+      gm.valid_ = true;
+    }
+    const auto it = gm.members_.find(gid);
+    MICROSCOPES_ASSERT(it != gm.members_.end());
+    return it->second;
+  }
+
+  // the assignment score of did, from scratch if its hyperparameters
+  // changed since the last call (through set_domain_hp(), or a mutator
+  // handed out by get_domain_hp_mutator())
+  double
+  running_assignment_score(size_t did) const
+  {
+    auto &a = assignment_scores_[did];
+    for (auto &w : a.watches_)
+      if (w.changed())
+        a.valid_ = false;
+    if (a.valid_)
+      return a.score_;
+    const auto &domain = domains_[did];
+    io::CRP m;
+    common::util::protobuf_from_string(m, domain.get_hp());
+    a.alpha_ = m.alpha();
+    a.score_ = domain.score_assignment();
+    a.nassigned_ = 0;
+    for (const auto &g : domain)
+      a.nassigned_ += domain.groupsize(g.first);
+    a.valid_ = true;
+    return a.score_;
+  }
 
+  template <typename Data>
   inline void
   add_value0(
       size_t domain, size_t gid, size_t eid,
-      const dataset_t &d, common::rng_t &rng, float *acc_score)
+      const Data &d, common::rng_t &rng)
   {
-    domains_[domain].add_value(gid, eid);
-    tuple_t gids;
-    iterate_over_entity_data(
-        domain, eid, d,
-        [this, &gids, &rng, acc_score](
-          size_t rid,
-          const variadic_tuple_t &eids,
-          const common::value_accessor &value)
-        {
-          auto &relation = this->relations_[rid];
-          this->eids_to_gids_under_relation(gids, eids, relation.desc_);
-          this->add_value_to_feature_group(gids, value, relation, rng, acc_score);
-        });
+    domain_add_value(domain, gid, eid);
+    for_each_relation_run(domain, rng,
+      [this, domain, eid, &d](size_t first, size_t last, common::rng_t &rng) {
+        tuple_t gids;
+        this->iterate_over_entity_data(
+            domain, eid, d, first, last,
+            [this, &gids, &rng](
+              size_t rid,
+              const size_t *eids,
+              const common::value_accessor &value)
+            {
+              auto &relation = this->relations_[rid];
+              this->eids_to_gids_under_relation(gids, eids, relation.desc_);
+              this->add_value_to_feature_group(gids, value, relation, rng);
+            });
+      });
   }
 
+  template <typename Data>
   inline size_t
   remove_value0(
       size_t domain, size_t eid,
-      const dataset_t &d, common::rng_t &rng)
+      const Data &d, common::rng_t &rng)
   {
-    tuple_t gids;
-    iterate_over_entity_data(
-        domain, eid, d,
-        [this, &gids, &rng](
-           size_t rid,
-           const variadic_tuple_t &eids,
-           const common::value_accessor &value)
-        {
-            auto &relation = this->relations_[rid];
-            this->eids_to_gids_under_relation(gids, eids, relation.desc_);
-            this->remove_value_from_feature_group(gids, value, relation, rng);
-        });
-    return domains_[domain].remove_value(eid).first;
+    for_each_relation_run(domain, rng,
+      [this, domain, eid, &d](size_t first, size_t last, common::rng_t &rng) {
+        tuple_t gids;
+        this->iterate_over_entity_data(
+            domain, eid, d, first, last,
+            [this, &gids, &rng](
+               size_t rid,
+               const size_t *eids,
+               const common::value_accessor &value)
+            {
+                auto &relation = this->relations_[rid];
+                this->eids_to_gids_under_relation(gids, eids, relation.desc_);
+                this->remove_value_from_feature_group(gids, value, relation, rng);
+            });
+      });
+    return domain_remove_value(domain, eid);
   }
 
+  template <typename Data>
   void
   inplace_score_value0(
       std::pair<std::vector<size_t>, std::vector<float>> &scores,
       size_t did,
       size_t eid,
-      const dataset_t &d,
+      const Data &d,
       common::rng_t &rng) const
   {
-    using distributions::fast_log;
-
-    const auto &domain = domains_[did];
-    MICROSCOPES_DCHECK(!domain.empty_groups().empty(), "no empty groups");
+    score_value_by(scores, did, eid, d,
+      [this, did, &rng](
+        std::pair<std::vector<size_t>, std::vector<float>> &scores,
+        std::vector<scoring_block_t> &blocks,
+        const std::vector<implicit_zeros_entity_t> &implicit)
+      {
+        if (this->relation_pool_ && this->relation_runs_[did].size() > 2)
+          this->score_candidates_by_relation(scores, blocks, implicit, did, rng);
+        else if (this->score_pool_ &&
+                 scores.first.size() >= ParallelScoreMinGroups)
+          this->score_candidates_parallel(scores, blocks, implicit, did, rng);
+        else
+          this->score_candidates(scores, blocks, implicit, did, rng);
+      });
+  }
 
-    scores.first.clear();
+  // a gibbs step for eid, returning the gids it (left, joined). the group
+  // the entity leaves empty is the one proposed as new, so that staying a
+  // singleton is not a move. an unchosen new group is deleted, after which
+  // deleted(gid) is called
+  template <typename Data, typename F>
+  std::pair<size_t, size_t>
+  gibbs_step0(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      size_t did,
+      size_t eid,
+      const Data &d,
+      common::rng_t &rng,
+      F deleted)
+  {
+    const size_t gid = remove_value0(did, eid, d, rng);
+    const size_t egid = groupsize(did, gid) ? create_group(did) : gid;
+    inplace_score_value0(scores, did, eid, d, rng);
+    const size_t choice =
+      scores.first[common::util::sample_discrete_log(scores.second, rng)];
+    add_value0(did, choice, eid, d, rng);
+    if (choice != egid) {
+      delete_group(did, egid);
+      deleted(egid);
+    }
+    return std::make_pair(gid, choice);
+  }
+
+  /**
+   * A parallel gibbs sweep over the entities of did, in batches of at most
+   * max_batch entities which share no observed cell (taken from the color
+   * classes of color_entities()).
+   *
+   * All the entities of a batch are removed, then scored concurrently over
+   * pool against the state without any of them, and finally sampled and
+   * added back one after the other. Entities which share no cell do not
+   * see each other's data directly, but in this collapsed model they still
+   * interact through the CRP and through the suffstats of the blocks they
+   * share, so the sampled batch is only a proposal, which is accepted or
+   * undone by a metropolis-hastings test (see assign_batch()). The sweep
+   * thus leaves the posterior invariant for any max_batch; a larger batch
+   * is scored with more parallelism, but is accepted less often.
+   *
+   * Every relation of did must be conjugate. The empty groups of the domain
+   * are discarded
+   */
+  template <typename Data>
+  void
+  chromatic_assign0(
+      size_t did,
+      const std::vector<std::vector<size_t>> &classes,
+      const Data &d,
+      detail::thread_pool &pool,
+      size_t max_batch,
+      common::rng_t &rng)
+  {
+    MICROSCOPES_DCHECK(max_batch >= 1, "empty batches");
+    for (const auto &dr : domain_relations_[did]) {
+      auto &relation = relations_[dr.rel_];
+      MICROSCOPES_CHECK(relation.desc_.conjugate(),
+          "chromatic assign requires conjugate relations");
+      relation.reserve_scratch_groups(rng, pool.size());
+    }
+    for (auto g : std::vector<size_t>(
+          domains_[did].empty_groups().begin(),
+          domains_[did].empty_groups().end()))
+      delete_group(did, g);
+
+    std::vector<size_t> order(classes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), rng);
+    std::vector<size_t> entities;
+    for (auto c : order) {
+      entities = classes[c];
+      std::shuffle(entities.begin(), entities.end(), rng);
+      for (size_t i = 0; i < entities.size(); i += max_batch) {
+        const size_t n = std::min(max_batch, entities.size() - i);
+        assign_batch(did, &entities[i], n, d, pool, rng);
+      }
+    }
+  }
+
+  /**
+   * An asynchronous gibbs sweep over the entities of did, for domains too
+   * large for the exact kernels to keep every thread busy.
+   *
+   * The entities are shuffled and split into one partition per thread of
+   * pool. Each worker sweeps its partition against its own copy of the
+   * state (see snapshot()), and every max_staleness entities reconciles it
+   * with this state: its moves are applied here and appended to a shared
+   * log, and the moves the other workers logged since its last sync are
+   * replayed on its copy. Between syncs a worker does not see the other
+   * workers' moves, which biases the chain; the returned report says by how
+   * much, so that max_staleness can be tuned. A worker's copy costs as much
+   * memory as the state itself.
+   *
+   * Group ids are only meaningful within a copy, and each worker translates
+   * its own to this state's as it syncs. Every relation of did must be
+   * conjugate. The empty groups of the domain are discarded
+   */
+  template <typename Data>
+  hogwild_report
+  hogwild_assign0(
+      size_t did,
+      const Data &d,
+      detail::thread_pool &pool,
+      size_t max_staleness,
+      common::rng_t &rng)
+  {
+    MICROSCOPES_DCHECK(max_staleness >= 1, "max_staleness must be positive");
+    for (const auto &dr : domain_relations_[did])
+      MICROSCOPES_CHECK(relations_[dr.rel_].desc_.conjugate(),
+          "hogwild assign requires conjugate relations");
+    for (auto g : std::vector<size_t>(
+          domains_[did].empty_groups().begin(),
+          domains_[did].empty_groups().end()))
+      delete_group(did, g);
+
+    const size_t n = domains_[did].nentities();
+    std::vector<size_t> perm(n);
+    std::iota(perm.begin(), perm.end(), 0);
+    std::shuffle(perm.begin(), perm.end(), rng);
+
+    // parallel_for() hands out at most this many chunks
+    const size_t nworkers = std::min(n, pool.size());
+    std::vector<hogwild_worker_t> workers(nworkers);
+    std::vector<unsigned long> seeds(nworkers);
+    for (auto &seed : seeds)
+      seed = rng();
+    // the copies are all made before any worker syncs
+    pool.parallel_for(nworkers,
+      [this, did, &workers, &seeds](size_t, size_t begin, size_t end) {
+        for (size_t w = begin; w < end; w++) {
+          auto &worker = workers[w];
+          worker.rng_.seed(seeds[w]);
+          worker.local_ = this->snapshot(worker.rng_);
+          for (const auto &g : worker.local_->domains_[did]) {
+            worker.to_shared_[g.first] = g.first;
+            worker.to_local_[g.first] = g.first;
+          }
+        }
+      });
+
+    hogwild_shared_t shared;
+    pool.parallel_for(n,
+      [this, did, &d, &perm, &workers, &shared, max_staleness](
+        size_t chunk, size_t begin, size_t end)
+      {
+        this->hogwild_sweep(did, d, chunk, &perm[begin], end - begin,
+            workers[chunk], shared, max_staleness);
+      });
+
+    for (auto g : std::vector<size_t>(
+          domains_[did].empty_groups().begin(),
+          domains_[did].empty_groups().end()))
+      delete_group(did, g);
+    return shared.report_;
+  }
+
+  /**
+   * nproposals split-merge proposals on did (Jain and Neal 2004). Each one
+   * picks two distinct entities at random: if they share a group, a split
+   * of it is proposed, otherwise a merge of their two groups, and the
+   * proposal goes through a metropolis-hastings step. The split is drawn
+   * by restricted gibbs (between the two groups only), launched from a
+   * random split refined by nscans restricted scans.
+   *
+   * The scans move entities one at a time, but an accepted merge (and a
+   * rejected split, which has to be merged back) folds the blocks of one
+   * group into the other's in one pass over the blocks, without touching
+   * the data (see fold_group()). Every relation of did must be conjugate,
+   * mergeable (see detail::group_merge) and without implicit zeros. The
+   * empty groups of did are discarded
+   */
+  template <typename Data>
+  split_merge_report
+  split_merge0(
+      size_t did,
+      const Data &d,
+      size_t nproposals,
+      size_t nscans,
+      common::rng_t &rng)
+  {
+    for (const auto &dr : domain_relations_[did]) {
+      const auto &desc = relations_[dr.rel_].desc_;
+      MICROSCOPES_CHECK(desc.conjugate() && !desc.implicit_zeros() &&
+          detail::group_merge::supports(*desc.model()),
+          "split merge requires mergeable, conjugate relations without implicit zeros");
+    }
+    for (auto g : std::vector<size_t>(
+          domains_[did].empty_groups().begin(),
+          domains_[did].empty_groups().end()))
+      delete_group(did, g);
+
+    split_merge_report report;
+    const size_t n = domains_[did].nentities();
+    if (n < 2)
+      return report;
+    std::uniform_int_distribution<size_t> pick(0, n - 1), pick_other(0, n - 2);
+    std::vector<size_t> members;
+    for (size_t p = 0; p < nproposals; p++) {
+      const size_t i = pick(rng);
+      size_t j = pick_other(rng);
+      if (j >= i)
+        j++;
+      const auto &assignments = domains_[did].assignments();
+      const ssize_t ci = assignments[i], cj = assignments[j];
+      members.clear();
+      for (ssize_t c : {ci, cj}) {
+        for (auto eid : group_members(did, c))
+          if (eid != i && eid != j)
+            members.push_back(eid);
+        if (ci == cj)
+          break;
+      }
+      std::shuffle(members.begin(), members.end(), rng);
+      if (ci == cj) {
+        report.nsplits_++;
+        if (propose_split(did, d, i, j, members, nscans, rng))
+          report.nsplits_accepted_++;
+      } else {
+        report.nmerges_++;
+        if (propose_merge(did, d, i, j, members, nscans, rng))
+          report.nmerges_accepted_++;
+      }
+    }
+    return report;
+  }
+
+  // the color classes of a greedy coloring of the entities of did, where
+  // two entities conflict if they appear in the same cell of some relation
+  // (which only happens in relations over did more than once)
+  std::vector<std::vector<size_t>>
+  color_entities(size_t did, const detail::entity_index &index) const
+  {
+    const size_t n = domains_[did].nentities();
+    MICROSCOPES_ASSERT(index.nentities() == n);
+    std::vector<ssize_t> colors(n, -1);
+    std::vector<std::vector<size_t>> classes;
+    std::vector<bool> taken;
+    for (size_t eid = 0; eid < n; eid++) {
+      taken.assign(classes.size(), false);
+      index.for_each(eid,
+        [this, did, eid, &colors, &taken](
+          size_t rid,
+          const size_t *eids,
+          const common::value_accessor &)
+        {
+          const auto &doms = this->relations_[rid].desc_.domains();
+          for (size_t i = 0; i < doms.size(); i++)
+            if (doms[i] == did && eids[i] != eid && colors[eids[i]] != -1)
+              taken[colors[eids[i]]] = true;
+        });
+      size_t c = 0;
+      while (c < taken.size() && taken[c])
+        c++;
+      if (c == classes.size())
+        classes.emplace_back();
+      classes[c].push_back(eid);
+      colors[eid] = c;
+    }
+    return classes;
+  }
+
+private:
+
+  // scores eid like inplace_score_value0(), with the candidate groups
+  // scored by f(scores, blocks, implicit): see score_candidates(). if
+  // candidates is given, only those groups are scored, in that order
+  template <typename Data, typename F>
+  void
+  score_value_by(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      size_t did,
+      size_t eid,
+      const Data &d,
+      F f,
+      const std::vector<size_t> *candidates = nullptr) const
+  {
+    using distributions::fast_log;
+
+    const auto &domain = domains_[did];
+    MICROSCOPES_DCHECK(candidates || !domain.empty_groups().empty(), "no empty groups");
+    MICROSCOPES_DCHECK(domain.assignments()[eid] == -1, "eid is still assigned");
+
+    scores.first.clear();
     scores.second.clear();
     scores.first.reserve(domain.ngroups());
     scores.second.reserve(domain.ngroups());
 
-    float pseudocounts = 0;
-    for (const auto &g : domain) {
-      const float pseudocount = domain.pseudocount(g.first, g.second);
-      float sum = fast_log(pseudocount);
-      const_cast<state *>(this)->add_value0(did, g.first, eid, d, rng, &sum);
-      const size_t gid = const_cast<state *>(this)->remove_value0(did, eid, d, rng);
-      if (unlikely(gid != g.first))
-        MICROSCOPES_ASSERT(false);
-      scores.first.push_back(g.first);
-      scores.second.push_back(sum);
-      pseudocounts += pseudocount;
+    // the entity's data is sliced exactly once, and bucketed by the block
+    // it would land in (modulo the candidate gid)
+    std::vector<scoring_block_t> blocks;
+    entity_data_by_block(blocks, did, eid, d);
+
+    // implicit zero relations are scored in closed form, against every
+    // block the entity would touch and not just the ones with data
+    std::vector<implicit_zeros_entity_t> implicit;
+    for (const auto &dr : domain_relations_[did]) {
+      const auto &relation = relations_[dr.rel_];
+      if (!relation.desc_.implicit_zeros() ||
+          (!implicit.empty() && implicit.back().rel_ == dr.rel_))
+        continue;
+      implicit.emplace_back();
+      implicit.back().rel_ = dr.rel_;
+      implicit.back().hp_ = implicit_zeros_hp(relation);
+    }
+    if (!implicit.empty()) {
+      for (const auto &b : blocks)
+        for (auto &z : implicit)
+          if (z.rel_ == b.rel_)
+            z.ones_[b.gids_] = b.values_.size();
+      blocks.erase(
+          std::remove_if(blocks.begin(), blocks.end(),
+            [this](const scoring_block_t &b) {
+              return this->relations_[b.rel_].desc_.implicit_zeros();
+            }),
+          blocks.end());
+    }
+
+    float pseudocounts = 0;
+    if (candidates) {
+      scores.first = *candidates;
+      scores.second.resize(candidates->size());
+      size_t found = 0;
+      for (const auto &g : domain) {
+        for (size_t k = 0; k < candidates->size(); k++) {
+          if ((*candidates)[k] != g.first)
+            continue;
+          const float pseudocount = domain.pseudocount(g.first, g.second);
+          scores.second[k] = fast_log(pseudocount);
+          pseudocounts += pseudocount;
+          found++;
+        }
+        if (found == candidates->size())
+          break;
+      }
+      MICROSCOPES_ASSERT(found == candidates->size());
+    } else {
+      for (const auto &g : domain) {
+        const float pseudocount = domain.pseudocount(g.first, g.second);
+        scores.first.push_back(g.first);
+        scores.second.push_back(fast_log(pseudocount));
+        pseudocounts += pseudocount;
+      }
+    }
+
+    domain_counters_[did].entities_scored_.add();
+    domain_counters_[did].candidates_scored_.add(scores.first.size());
+
+    if (inverse_temperature_ == 1.) {
+      f(scores, blocks, implicit);
+    } else {
+      // scores.second only holds the prior terms so far. a local copy, since
+      // concurrent kernels score through here (see assign_batch())
+      const std::vector<float> prior(scores.second);
+      f(scores, blocks, implicit);
+      for (size_t i = 0; i < scores.second.size(); i++)
+        scores.second[i] =
+          prior[i] + inverse_temperature_ * (scores.second[i] - prior[i]);
+    }
+
+    const float lgnorm = fast_log(pseudocounts);
+    for (auto &s : scores.second)
+      s -= lgnorm;
+  }
+
+  struct rel_pos_t {
+    rel_pos_t() : rel_(), pos_() {}
+    rel_pos_t(size_t rel, size_t pos) : rel_(rel), pos_(pos) {}
+    size_t rel_;
+    size_t pos_;
+  };
+
+  // all of an (unassigned) entity's data which falls into the same block of
+  // a relation, for any choice of group for the entity
+  struct scoring_block_t {
+    // placeholder in gids_ for the positions occupied by the entity
+    static const size_t Self = size_t(-1);
+    size_t rel_;
+    tuple_t gids_;
+    // true if the entity's domain appears more than once in the relation, in
+    // which case two distinct blocks can resolve to the same gids
+    bool aliased_;
+    std::vector<common::value_accessor> values_;
+  };
+
+  // the true cells of an (unassigned) entity in an implicit zero relation,
+  // counted by scoring_block_t::gids_
+  struct implicit_zeros_entity_t {
+    implicit_zeros_entity_t() : rel_(), hp_(), ones_() {}
+    size_t rel_;
+    beta_bernoulli_hp_t hp_;
+    detail::flat_hash_map<
+      tuple_t,
+      size_t,
+      detail::gid_tuple_hash<tuple_t>,
+      detail::gid_tuple_equal<tuple_t>> ones_;
+  };
+
+  // below this many candidate groups, a parallel score is not worth the
+  // synchronization
+  static const size_t ParallelScoreMinGroups = 16;
+
+  // the gids b lands in if the entity joins group gid
+  static inline void
+  candidate_gids(tuple_t &gids, const scoring_block_t &b, size_t gid)
+  {
+    gids = b.gids_;
+    for (auto &g : gids)
+      if (g == scoring_block_t::Self)
+        g = gid;
+  }
+
+  // adds the score of the entity's data joining each candidate group (see
+  // inplace_score_value0()) to scores.second. the group's suffstats are only
+  // used as scratch space, and are restored before we return
+  void
+  score_candidates(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      const std::vector<scoring_block_t> &blocks,
+      const std::vector<implicit_zeros_entity_t> &implicit,
+      size_t did,
+      common::rng_t &rng) const
+  {
+    state *self = const_cast<state *>(this);
+    tuple_t gids;
+    std::vector<std::pair<models::group *, const scoring_block_t *>> staged;
+    std::vector<std::pair<size_t, tuple_t>> created;
+    for (size_t k = 0; k < scores.first.size(); k++) {
+      const size_t gid = scores.first[k];
+      float sum = 0.;
+      for (const auto &b : blocks) {
+        auto &relation = self->relations_[b.rel_];
+        candidate_gids(gids, b, gid);
+        models::group *group;
+        auto p = relation.find_suffstats(gids);
+        if (p) {
+          group = p->ss_.get();
+        } else if (relation.desc_.conjugate() && !b.aliased_) {
+          group = &relation.scratch_group(rng);
+        } else {
+          // for non-conjugate models the block must outlive this call, see
+          // the note in remove_value_from_feature_group(). conjugate blocks
+          // which can alias are dropped at the end
+          group = self->get_or_create_suffstats(gids, relation, rng).ss_.get();
+          if (relation.desc_.conjugate())
+            created.emplace_back(b.rel_, gids);
+        }
+        if (!b.aliased_) {
+          sum += score_block(*group, *relation.hypers_, b.values_, rng);
+          continue;
+        }
+        // other blocks may resolve to the same gids for this candidate, so
+        // the values have to stay in the group until we are done with it
+        for (const auto &value : b.values_) {
+          sum += group_ops_t::score_value(*group, *relation.hypers_, value, rng);
+          group_ops_t::add_value(*group, *relation.hypers_, value, rng);
+        }
+        staged.emplace_back(group, &b);
+      }
+      for (const auto &z : implicit)
+        sum += score_implicit_zeros_value(z, did, gid);
+      for (auto it = staged.rbegin(); it != staged.rend(); ++it) {
+        const auto &hypers = *relations_[it->second->rel_].hypers_;
+        for (const auto &value : it->second->values_)
+          group_ops_t::remove_value(*it->first, hypers, value, rng);
+      }
+      staged.clear();
+      scores.second[k] += sum;
+    }
+
+    for (const auto &c : created) {
+      auto &relation = self->relations_[c.first];
+      auto p = relation.find_suffstats(c.second);
+      MICROSCOPES_ASSERT(p && !p->count_);
+      relation.ident_table_.erase(p->ident_);
+      relation.erase_suffstats(c.second);
+    }
+  }
+
+  // score_candidates(), with the candidates partitioned over score_pool_.
+  //
+  // a block which does not alias resolves to distinct gids for distinct
+  // candidates, so threads never share one of those groups. everything
+  // which would modify the relations is done up front: the blocks a
+  // non-conjugate model needs are created, and each thread gets its own
+  // scratch groups. aliased blocks can collide across candidates, and are
+  // scored serially
+  void
+  score_candidates_parallel(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      std::vector<scoring_block_t> &blocks,
+      const std::vector<implicit_zeros_entity_t> &implicit,
+      size_t did,
+      common::rng_t &rng) const
+  {
+    state *self = const_cast<state *>(this);
+    auto &pool = *score_pool_;
+
+    std::vector<scoring_block_t> aliased, disjoint;
+    for (auto &b : blocks)
+      (b.aliased_ ? aliased : disjoint).push_back(std::move(b));
+    if (!aliased.empty())
+      score_candidates(scores, aliased, {}, did, rng);
+
+    tuple_t gids;
+    for (const auto &b : disjoint) {
+      auto &relation = self->relations_[b.rel_];
+      if (relation.desc_.conjugate()) {
+        relation.reserve_scratch_groups(rng, pool.size());
+        continue;
+      }
+      for (auto gid : scores.first) {
+        candidate_gids(gids, b, gid);
+        self->get_or_create_suffstats(gids, relation, rng);
+      }
+    }
+
+    std::vector<unsigned long> seeds(pool.size());
+    for (auto &seed : seeds)
+      seed = rng();
+
+    pool.parallel_for(scores.first.size(),
+      [self, &scores, &disjoint, &implicit, &seeds, did](
+        size_t chunk, size_t begin, size_t end)
+      {
+        common::rng_t rng(seeds[chunk]);
+        tuple_t gids;
+        for (size_t k = begin; k < end; k++) {
+          float sum = 0.;
+          for (const auto &b : disjoint) {
+            auto &relation = self->relations_[b.rel_];
+            candidate_gids(gids, b, scores.first[k]);
+            auto p = relation.find_suffstats(gids);
+            models::group &group = p ?
+              *p->ss_ : relation.scratch_group(rng, chunk);
+            sum += score_block(group, *relation.hypers_, b.values_, rng);
+          }
+          for (const auto &z : implicit)
+            sum += self->score_implicit_zeros_value(z, did, scores.first[k]);
+          scores.second[k] += sum;
+        }
+      });
+  }
+
+  // score_candidates(), with the relations partitioned over relation_pool_:
+  // every relation's blocks are scored by a single thread, against its own
+  // copy of the scores, and the copies are summed at the end. blocks is
+  // consumed
+  void
+  score_candidates_by_relation(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      std::vector<scoring_block_t> &blocks,
+      const std::vector<implicit_zeros_entity_t> &implicit,
+      size_t did,
+      common::rng_t &rng) const
+  {
+    const auto &runs = relation_runs_[did];
+    const auto &drs = domain_relations_[did];
+    const size_t nruns = runs.size() - 1;
+
+    // blocks (and implicit zero relations) come in the order of
+    // domain_relations_, so they are bucketed by run with a single pass
+    std::vector<std::vector<scoring_block_t>> run_blocks(nruns);
+    std::vector<std::vector<implicit_zeros_entity_t>> run_implicit(nruns);
+    size_t run = 0;
+    for (auto &b : blocks) {
+      while (drs[runs[run]].rel_ != b.rel_)
+        run++;
+      run_blocks[run].push_back(std::move(b));
+    }
+    run = 0;
+    for (const auto &z : implicit) {
+      while (drs[runs[run]].rel_ != z.rel_)
+        run++;
+      run_implicit[run].push_back(z);
+    }
+
+    auto &pool = *relation_pool_;
+    std::vector<unsigned long> seeds(pool.size());
+    for (auto &seed : seeds)
+      seed = rng();
+    std::vector<std::pair<std::vector<size_t>, std::vector<float>>> partials(
+        pool.size());
+
+    pool.parallel_for(nruns,
+      [this, &scores, &run_blocks, &run_implicit, &seeds, &partials, did](
+        size_t chunk, size_t begin, size_t end)
+      {
+        common::rng_t rng(seeds[chunk]);
+        auto &partial = partials[chunk];
+        partial.first = scores.first;
+        partial.second.assign(scores.first.size(), 0.);
+        for (size_t i = begin; i < end; i++)
+          this->score_candidates(partial, run_blocks[i], run_implicit[i], did, rng);
+      });
+
+    for (const auto &partial : partials)
+      for (size_t k = 0; k < partial.second.size(); k++)
+        scores.second[k] += partial.second[k];
+  }
+
+  // the locks of assign_batch(). score_block() writes to the group it
+  // scores, and entities scored concurrently can land in the same block, so
+  // each group is guarded by a mutex picked by its address. the relations
+  // whose blocks can alias are guarded as a whole (see
+  // score_candidates_concurrent())
+  class group_locks {
+  public:
+    group_locks() : aliased_(), mutexes_(64) {}
+    inline std::mutex &
+    operator[](const models::group *g)
+    {
+      return mutexes_[(reinterpret_cast<uintptr_t>(g) >> 4) % mutexes_.size()];
+    }
+    std::mutex aliased_;
+  private:
+    std::vector<std::mutex> mutexes_;
+  };
+
+  // see chromatic_assign0(). a metropolis-hastings move on the assignments
+  // of eids, whose proposal samples each entity in turn from its conditional
+  // given the state without the batch (scored concurrently), extended with
+  // the new groups opened by the entities before it, each weighted as an
+  // empty group. the reverse move is scored by removing the batch one
+  // entity at a time, which also yields the likelihood terms of the
+  // current assignment; the proposed one is scored as it is added back
+  template <typename Data>
+  void
+  assign_batch(
+      size_t did,
+      const size_t *eids,
+      size_t n,
+      const Data &d,
+      detail::thread_pool &pool,
+      common::rng_t &rng)
+  {
+    auto &domain = domains_[did];
+    const double before = running_assignment_score(did);
+
+    // current[i] is fresh if it has none of the entities left once the batch
+    // from i on is removed, and is then deleted: in the proposal, i opened it
+    std::vector<size_t> current(n);
+    std::vector<bool> fresh(n), kept(n);
+    float loglik = 0.;
+    for (size_t i = n; i-- > 0;) {
+      current[i] = remove_value0(did, eids[i], d, rng);
+      loglik -= score_value_into(did, eids[i], current[i], d, rng);
+      if (!domain.groupsize(current[i])) {
+        fresh[i] = true;
+        delete_group(did, current[i]);
+      }
+    }
+    for (size_t i = 0; i < n; i++)
+      kept[i] = domain.isactivegroup(current[i]);
+    const size_t egid = create_group(did);
+
+    std::vector<std::pair<std::vector<size_t>, std::vector<float>>> scores(n);
+    std::vector<unsigned long> seeds(pool.size());
+    for (auto &seed : seeds)
+      seed = rng();
+    group_locks locks;
+    pool.parallel_for(n,
+      [this, did, eids, &d, &scores, &seeds, &locks](
+        size_t chunk, size_t begin, size_t end)
+      {
+        common::rng_t rng(seeds[chunk]);
+        for (size_t i = begin; i < end; i++)
+          this->score_value_by(scores[i], did, eids[i], d,
+            [this, did, chunk, &locks, &rng](
+              std::pair<std::vector<size_t>, std::vector<float>> &scores,
+              std::vector<scoring_block_t> &blocks,
+              const std::vector<implicit_zeros_entity_t> &implicit)
+            {
+              this->score_candidates_concurrent(
+                  scores, blocks, implicit, did, chunk, locks, rng);
+            });
+      });
+
+    const auto index_of = [&scores](size_t i, size_t gid) {
+      return size_t(
+        std::find(scores[i].first.begin(), scores[i].first.end(), gid) -
+        scores[i].first.begin());
+    };
+    // the log probability of entity i's choice k among the candidates scored
+    // for it, followed by the m groups opened before it
+    const auto logq = [&scores, &index_of, egid](size_t i, size_t m, size_t k) {
+      const auto &s = scores[i].second;
+      const float empty = s[index_of(i, egid)];
+      const float hi = *std::max_element(s.begin(), s.end());
+      float sum = m * std::exp(empty - hi);
+      for (auto w : s)
+        sum += std::exp(w - hi);
+      return (k < s.size() ? s[k] : empty) - hi - std::log(sum);
+    };
+
+    // the reverse move
+    float logp = 0.;
+    size_t opened = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (kept[i]) {
+        logp += logq(i, opened, index_of(i, current[i]));
+        continue;
+      }
+      logp += logq(i, opened, fresh[i] ? index_of(i, egid) : size_t(-1));
+      if (fresh[i])
+        opened++;
+    }
+
+    // the proposal, which is added back as it is sampled
+    std::vector<size_t> opened_gids;
+    std::vector<float> weights;
+    bool taken = false;
+    for (size_t i = 0; i < n; i++) {
+      weights = scores[i].second;
+      const size_t k = index_of(i, egid);
+      for (size_t m = 0; m < opened_gids.size(); m++)
+        weights.push_back(weights[k]);
+      const size_t choice = common::util::sample_discrete_log(weights, rng);
+      logp -= logq(i, opened_gids.size(), choice);
+      size_t gid;
+      if (choice >= scores[i].first.size()) {
+        gid = opened_gids[choice - scores[i].first.size()];
+      } else if (choice == k) {
+        gid = taken ? create_group(did) : egid;
+        taken = true;
+        opened_gids.push_back(gid);
+      } else {
+        gid = scores[i].first[choice];
+      }
+      loglik += score_value_into(did, eids[i], gid, d, rng);
+      add_value0(did, gid, eids[i], d, rng);
+    }
+    if (!taken)
+      delete_group(did, egid);
+
+    const double after = running_assignment_score(did);
+    if (metropolis_accept(after - before + loglik + logp, rng))
+      return;
+
+    // put the batch back where it was, in new groups for the fresh ones
+    for (size_t i = 0; i < n; i++) {
+      const size_t gid = remove_value0(did, eids[i], d, rng);
+      if (!domain.groupsize(gid))
+        delete_group(did, gid);
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (fresh[i]) {
+        const size_t gid = create_group(did);
+        for (size_t j = n; j-- > i;)
+          if (current[j] == current[i])
+            current[j] = gid;
+      }
+      add_value0(did, current[i], eids[i], d, rng);
+    }
+  }
+
+  // the (inverse temperature scaled) log likelihood of the data of eid, which
+  // is not assigned, joining gid
+  template <typename Data>
+  float
+  score_value_into(
+      size_t did, size_t eid, size_t gid, const Data &d, common::rng_t &rng)
+  {
+    // with a single candidate, the prior term normalizes away
+    const std::vector<size_t> candidates({gid});
+    std::pair<std::vector<size_t>, std::vector<float>> scores;
+    score_value_by(scores, did, eid, d,
+      [this, did, &rng](
+        std::pair<std::vector<size_t>, std::vector<float>> &scores,
+        std::vector<scoring_block_t> &blocks,
+        const std::vector<implicit_zeros_entity_t> &implicit)
+      {
+        this->score_candidates(scores, blocks, implicit, did, rng);
+      },
+      &candidates);
+    return scores.second[0];
+  }
+
+  // score_candidates(), for concurrent callers which each pass their own
+  // slot (for the scratch groups reserved by chromatic_assign0()) and rng.
+  // only aliased blocks create and erase blocks (see score_candidates()), and
+  // a relation's blocks are either all aliased or none is, so aliased blocks
+  // are scored while holding locks.aliased_, and the other blocks only need
+  // their own group locked
+  void
+  score_candidates_concurrent(
+      std::pair<std::vector<size_t>, std::vector<float>> &scores,
+      std::vector<scoring_block_t> &blocks,
+      const std::vector<implicit_zeros_entity_t> &implicit,
+      size_t did,
+      size_t slot,
+      group_locks &locks,
+      common::rng_t &rng) const
+  {
+    state *self = const_cast<state *>(this);
+    std::vector<scoring_block_t> aliased, disjoint;
+    for (auto &b : blocks)
+      (b.aliased_ ? aliased : disjoint).push_back(std::move(b));
+    if (!aliased.empty()) {
+      std::lock_guard<std::mutex> lock(locks.aliased_);
+      score_candidates(scores, aliased, {}, did, rng);
+    }
+    tuple_t gids;
+    for (size_t k = 0; k < scores.first.size(); k++) {
+      float sum = 0.;
+      for (const auto &b : disjoint) {
+        auto &relation = self->relations_[b.rel_];
+        MICROSCOPES_ASSERT(relation.desc_.conjugate());
+        candidate_gids(gids, b, scores.first[k]);
+        auto p = relation.find_suffstats(gids);
+        if (!p) {
+          sum += score_block(
+              relation.scratch_group(rng, slot), *relation.hypers_, b.values_, rng);
+          continue;
+        }
+        std::lock_guard<std::mutex> lock(locks[p->ss_.get()]);
+        sum += score_block(*p->ss_, *relation.hypers_, b.values_, rng);
+      }
+      for (const auto &z : implicit)
+        sum += score_implicit_zeros_value(z, did, scores.first[k]);
+      scores.second[k] += sum;
+    }
+  }
+
+  // a deep copy of the state: no group (nor hypers) is shared with this one,
+  // so both can be modified concurrently. the copy scores serially, and
+  // counts from zero
+  std::shared_ptr<state>
+  snapshot(common::rng_t &rng) const
+  {
+    auto ret = std::make_shared<state>(*this);
+    ret->score_pool_.reset();
+    ret->relation_pool_.reset();
+    ret->reset_counters();
+    // the values handed out point into this state
+    for (auto &a : ret->assignment_scores_)
+      a = assignment_score_t();
+    for (auto &r : ret->relations_) {
+      auto hypers = r.desc_.model()->create_hypers();
+      hypers->set_hp(r.hypers_->get_hp());
+      r.hypers_ = hypers;
+      r.bind_zeros_hp();
+      r.groups_ = detail::group_pool(r.desc_.conjugate());
+      r.scratch_.clear();
+      r.watches_.clear();
+      r.invalidate_cache();
+      r.for_each_suffstats([&r, &rng](const tuple_t &, suffstats_t &ss) {
+        if (!ss.ss_)
+          return;
+        const auto src = ss.ss_;
+        ss.ss_ = r.groups_.acquire(*r.hypers_, rng);
+        ss.ss_->set_ss(src->get_ss());
+      });
+    }
+    return ret;
+  }
+
+  // see split_merge0(). i and j share a group, and members are the other
+  // entities of it
+  template <typename Data>
+  bool
+  propose_split(
+      size_t did,
+      const Data &d,
+      size_t i,
+      size_t j,
+      const std::vector<size_t> &members,
+      size_t nscans,
+      common::rng_t &rng)
+  {
+    const size_t c = domains_[did].assignments()[i];
+    const float before =
+      running_assignment_score(did) + groups_likelihood(did, c, c, rng);
+
+    const size_t cn = create_group(did);
+    move_value0(did, j, cn, d, rng);
+    std::bernoulli_distribution coin(0.5);
+    for (auto eid : members)
+      if (coin(rng))
+        move_value0(did, eid, cn, d, rng);
+    for (size_t t = 0; t < nscans; t++)
+      restricted_scan(did, d, members, c, cn, nullptr, nullptr, rng);
+    float logq = 0.;
+    restricted_scan(did, d, members, c, cn, nullptr, &logq, rng);
+
+    const float after =
+      running_assignment_score(did) + groups_likelihood(did, c, cn, rng);
+    if (metropolis_accept(after - before - logq, rng))
+      return true;
+    fold_group(did, c, cn, j, members, rng);
+    return false;
+  }
+
+  // see split_merge0(). i and j are in distinct groups, and members are
+  // the other entities of both
+  template <typename Data>
+  bool
+  propose_merge(
+      size_t did,
+      const Data &d,
+      size_t i,
+      size_t j,
+      const std::vector<size_t> &members,
+      size_t nscans,
+      common::rng_t &rng)
+  {
+    auto &domain = domains_[did];
+    const size_t ci = domain.assignments()[i];
+    const size_t cj = domain.assignments()[j];
+    std::vector<size_t> split(members.size());
+    for (size_t k = 0; k < members.size(); k++)
+      split[k] = domain.assignments()[members[k]];
+
+    // the probability of the restricted gibbs scan which would take the
+    // launch of a split back to the current one
+    std::bernoulli_distribution coin(0.5);
+    for (auto eid : members)
+      move_value0(did, eid, coin(rng) ? ci : cj, d, rng);
+    for (size_t t = 0; t < nscans; t++)
+      restricted_scan(did, d, members, ci, cj, nullptr, nullptr, rng);
+    float logq = 0.;
+    restricted_scan(did, d, members, ci, cj, &split, &logq, rng);
+
+    const double assignment = running_assignment_score(did);
+    const float before = assignment + groups_likelihood(did, ci, cj, rng);
+    // the assignment score of the merge, in closed form: under the CRP, a
+    // partition into groups of n_k entities scores
+    //
+    //   K log(alpha) + sum_k lgamma(n_k) + (terms of alpha and n only)
+    //
+    // so merging groups of a and b entities adds
+    // lgamma(a + b) - lgamma(a) - lgamma(b) - log(alpha)
+    const double a = domain.groupsize(ci), b = domain.groupsize(cj);
+    const double merged = assignment +
+      std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) -
+      std::log(double(assignment_scores_[did].alpha_));
+    const float after = merged + merged_likelihood(did, ci, cj, rng);
+    if (!metropolis_accept(after - before + logq, rng))
+      return false;
+    fold_group(did, ci, cj, j, members, rng);
+    return true;
+  }
+
+  static inline bool
+  metropolis_accept(float logp, common::rng_t &rng)
+  {
+    return logp >= 0. ||
+      std::log(std::uniform_real_distribution<float>(0., 1.)(rng)) < logp;
+  }
+
+  template <typename Data>
+  inline void
+  move_value0(size_t did, size_t eid, size_t gid, const Data &d, common::rng_t &rng)
+  {
+    if (size_t(domains_[did].assignments()[eid]) == gid)
+      return;
+    remove_value0(did, eid, d, rng);
+    add_value0(did, gid, eid, d, rng);
+  }
+
+  // one restricted gibbs scan of eids between groups a and b, which both
+  // stay non empty. with forced, eids[k] goes to forced[k] instead of a
+  // sampled group. logq, if given, is incremented by the log probability
+  // of the choices made
+  template <typename Data>
+  void
+  restricted_scan(
+      size_t did,
+      const Data &d,
+      const std::vector<size_t> &eids,
+      size_t a,
+      size_t b,
+      const std::vector<size_t> *forced,
+      float *logq,
+      common::rng_t &rng)
+  {
+    const std::vector<size_t> candidates({a, b});
+    std::pair<std::vector<size_t>, std::vector<float>> scores;
+    for (size_t k = 0; k < eids.size(); k++) {
+      remove_value0(did, eids[k], d, rng);
+      score_value_by(scores, did, eids[k], d,
+        [this, did, &rng](
+          std::pair<std::vector<size_t>, std::vector<float>> &scores,
+          std::vector<scoring_block_t> &blocks,
+          const std::vector<implicit_zeros_entity_t> &implicit)
+        {
+          this->score_candidates(scores, blocks, implicit, did, rng);
+        },
+        &candidates);
+      const float hi = std::max(scores.second[0], scores.second[1]);
+      const float lo = std::min(scores.second[0], scores.second[1]);
+      const float norm = hi + std::log1p(std::exp(lo - hi));
+      const size_t choice = forced ?
+        ((*forced)[k] == a ? 0 : 1) :
+        common::util::sample_discrete_log(scores.second, rng);
+      if (logq)
+        *logq += scores.second[choice] - norm;
+      add_value0(did, candidates[choice], eids[k], d, rng);
+    }
+  }
+
+  // whether gids has gid at some position of domain did
+  static inline bool
+  block_has_group(const relation_definition &desc,
+                  size_t did,
+                  const tuple_t &gids,
+                  size_t gid)
+  {
+    for (size_t i = 0; i < gids.size(); i++)
+      if (desc.domains()[i] == did && gids[i] == gid)
+        return true;
+    return false;
+  }
+
+  // f(relation_container_t &) once for each relation over did
+  template <typename F>
+  inline void
+  for_each_domain_relation(size_t did, F f)
+  {
+    for (const auto &dr : domain_relations_[did]) {
+      auto &relation = relations_[dr.rel_];
+      const auto &doms = relation.desc_.domains();
+      if (std::find(doms.begin(), doms.begin() + dr.pos_, did) !=
+          doms.begin() + dr.pos_)
+        continue;
+      f(relation);
+    }
+  }
+
+  // the (tempered) likelihood of the blocks of did's relations which
+  // involve group a or b
+  float
+  groups_likelihood(size_t did, size_t a, size_t b, common::rng_t &rng)
+  {
+    float score = 0.;
+    for_each_domain_relation(did,
+      [did, a, b, &score, &rng](relation_container_t &relation) {
+        const auto &m = *relation.hypers_;
+        relation.for_each_group_suffstats(did, a,
+          [&m, &score, &rng](const tuple_t &, const suffstats_t &ss) {
+            score += group_ops_t::score_data(*ss.ss_, m, rng);
+          });
+        if (b == a)
+          return;
+        relation.for_each_group_suffstats(did, b,
+          [did, a, &relation, &m, &score, &rng](
+            const tuple_t &gids, const suffstats_t &ss)
+          {
+            if (!block_has_group(relation.desc_, did, gids, a))
+              score += group_ops_t::score_data(*ss.ss_, m, rng);
+          });
+      });
+    return inverse_temperature_ * score;
+  }
+
+  // groups_likelihood(), as if group src had been folded into dst. the
+  // blocks which fold into the same one are merged in the relation's
+  // scratch group, and the state is otherwise left untouched
+  float
+  merged_likelihood(size_t did, size_t dst, size_t src, common::rng_t &rng)
+  {
+    // (the block a source folds into, its group), sorted by target
+    std::vector<std::pair<tuple_t, models::group *>> sources;
+    float score = 0.;
+    for_each_domain_relation(did,
+      [did, dst, src, &sources, &score, &rng](relation_container_t &relation) {
+        const auto &doms = relation.desc_.domains();
+        sources.clear();
+        const auto add_source = [did, dst, src, &doms, &sources](
+            const tuple_t &gids, const suffstats_t &ss)
+        {
+          sources.emplace_back(gids, ss.ss_.get());
+          auto &target = sources.back().first;
+          for (size_t i = 0; i < target.size(); i++)
+            if (doms[i] == did && target[i] == src)
+              target[i] = dst;
+        };
+        relation.for_each_group_suffstats(did, dst, add_source);
+        relation.for_each_group_suffstats(did, src,
+          [did, dst, &relation, &add_source](
+            const tuple_t &gids, const suffstats_t &ss)
+          {
+            if (!block_has_group(relation.desc_, did, gids, dst))
+              add_source(gids, ss);
+          });
+        std::sort(sources.begin(), sources.end(),
+          [](const std::pair<tuple_t, models::group *> &x,
+             const std::pair<tuple_t, models::group *> &y) {
+            return std::lexicographical_compare(
+                x.first.begin(), x.first.end(), y.first.begin(), y.first.end());
+          });
+        const auto &m = *relation.hypers_;
+        for (size_t k = 0; k < sources.size(); ) {
+          size_t k1 = k + 1;
+          while (k1 < sources.size() &&
+                 detail::gid_tuple_equal<tuple_t>()(sources[k1].first, sources[k].first))
+            k1++;
+          if (k1 == k + 1) {
+            score += group_ops_t::score_data(*sources[k].second, m, rng);
+          } else {
+            auto &g = relation.scratch_group(rng);
+            for (; k < k1; k++)
+              detail::group_merge::merge(g, *sources[k].second);
+            score += group_ops_t::score_data(g, m, rng);
+            detail::group_merge::clear(g);
+          }
+          k = k1;
+        }
+      });
+    return inverse_temperature_ * score;
+  }
+
+  // folds the blocks involving group src into the corresponding blocks of
+  // dst, visiting only the blocks of src. src's blocks are erased, and the
+  // domain is not touched
+  void
+  fold_blocks(size_t did, size_t dst, size_t src, common::rng_t &rng)
+  {
+    std::vector<std::pair<tuple_t, tuple_t>> folds;
+    for_each_domain_relation(did,
+      [this, did, dst, src, &folds, &rng](relation_container_t &relation) {
+        const auto &doms = relation.desc_.domains();
+        folds.clear();
+        relation.for_each_group_suffstats(did, src,
+          [did, dst, src, &doms, &folds](const tuple_t &gids, const suffstats_t &)
+          {
+            folds.emplace_back(gids, gids);
+            for (size_t i = 0; i < gids.size(); i++)
+              if (doms[i] == did && gids[i] == src)
+                folds.back().second[i] = dst;
+          });
+        for (const auto &f : folds) {
+          // inserting the target can move the source block around
+          auto &to = this->get_or_create_suffstats(f.second, relation, rng);
+          auto &from = *relation.find_suffstats(f.first);
+          to.count_ += from.count_;
+          detail::group_merge::merge(*to.ss_, *from.ss_);
+          relation.touch(f.second, to);
+          // released groups are handed out again as empty ones
+          detail::group_merge::clear(*from.ss_);
+          relation.ident_table_.erase(from.ident_);
+          relation.erase_suffstats(f.first);
+        }
+      });
+  }
+
+  // moves j and the members of src to dst (see fold_blocks()), and deletes
+  // src. members are the entities split_merge0() collected for the move,
+  // which src's entities are among
+  void
+  fold_group(size_t did,
+             size_t dst,
+             size_t src,
+             size_t j,
+             const std::vector<size_t> &members,
+             common::rng_t &rng)
+  {
+    fold_blocks(did, dst, src, rng);
+    auto &domain = domains_[did];
+    const auto move = [this, did, dst, src, &domain](size_t eid) {
+      if (size_t(domain.assignments()[eid]) != src)
+        return;
+      this->domain_remove_value(did, eid);
+      this->domain_add_value(did, dst, eid);
+    };
+    move(j);
+    for (auto eid : members)
+      move(eid);
+    MICROSCOPES_ASSERT(!domain.groupsize(src));
+    delete_group(did, src);
+  }
+
+  typedef detail::flat_hash_map<
+    size_t,
+    size_t,
+    detail::integer_hash<size_t>> gid_map_t;
+
+  // see hogwild_assign0()
+  struct hogwild_worker_t {
+    hogwild_worker_t() : rng_(), local_(), to_shared_(), to_local_() {}
+    common::rng_t rng_;
+    std::shared_ptr<state> local_;
+    // translates the gids of local_ to the shared state's, and back. a local
+    // group is unmapped until the worker moves one of its entities into it
+    // (or replays a move into the shared group)
+    gid_map_t to_shared_;
+    gid_map_t to_local_;
+  };
+
+  struct hogwild_move_t {
+    size_t eid_;
+    // a gid of the shared state
+    size_t gid_;
+    size_t worker_;
+  };
+
+  struct hogwild_shared_t {
+    hogwild_shared_t() : mutex_(), log_(), report_() {}
+    // guards the state being swept as well as the fields below
+    std::mutex mutex_;
+    std::vector<hogwild_move_t> log_;
+    hogwild_report report_;
+  };
+
+  static inline void
+  hogwild_unmap(hogwild_worker_t &worker, size_t local)
+  {
+    auto it = worker.to_shared_.find(local);
+    if (it == worker.to_shared_.end())
+      return;
+    worker.to_local_.erase(it->second);
+    worker.to_shared_.erase(it);
+  }
+
+  // a worker of hogwild_assign0(), sweeping eids[0, n)
+  template <typename Data>
+  void
+  hogwild_sweep(
+      size_t did,
+      const Data &d,
+      size_t id,
+      const size_t *eids,
+      size_t n,
+      hogwild_worker_t &worker,
+      hogwild_shared_t &shared,
+      size_t max_staleness)
+  {
+    common::rng_t &rng = worker.rng_;
+    state &local = *worker.local_;
+    std::pair<std::vector<size_t>, std::vector<float>> scores;
+    // (eid, local gid) moves since the last sync
+    std::vector<std::pair<size_t, size_t>> outbox;
+    std::vector<hogwild_move_t> pulled;
+    size_t cursor = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      const size_t eid = eids[i];
+      const auto move = local.gibbs_step0(scores, did, eid, d, rng,
+          [&worker](size_t gid) { hogwild_unmap(worker, gid); });
+      if (move.second != move.first)
+        outbox.emplace_back(eid, move.second);
+      if ((i + 1) % max_staleness && i + 1 != n)
+        continue;
+
+      // push our moves, and pick up everyone else's
+      size_t pending = 0;
+      {
+        std::lock_guard<std::mutex> lock(shared.mutex_);
+        for (const auto &m : outbox) {
+          auto it = worker.to_shared_.find(m.second);
+          size_t sgid;
+          if (it == worker.to_shared_.end()) {
+            sgid = create_group(did);
+            worker.to_shared_[m.second] = sgid;
+            worker.to_local_[sgid] = m.second;
+          } else {
+            sgid = it->second;
+          }
+          remove_value0(did, m.first, d, rng);
+          add_value0(did, sgid, m.first, d, rng);
+          shared.log_.push_back(hogwild_move_t{m.first, sgid, id});
+        }
+        pulled.assign(shared.log_.begin() + cursor, shared.log_.end());
+        cursor = shared.log_.size();
+        for (const auto &m : pulled)
+          pending += m.worker_ != id;
+        auto &report = shared.report_;
+        report.nsyncs_++;
+        report.nmoves_ += outbox.size();
+        report.pending_ += pending;
+        report.max_pending_ = std::max(report.max_pending_, pending);
+      }
+      outbox.clear();
+
+      for (const auto &m : pulled) {
+        if (m.worker_ == id)
+          continue;
+        const size_t old = local.remove_value0(did, m.eid_, d, rng);
+        if (!local.groupsize(did, old)) {
+          local.delete_group(did, old);
+          hogwild_unmap(worker, old);
+        }
+        auto it = worker.to_local_.find(m.gid_);
+        size_t lgid;
+        if (it == worker.to_local_.end()) {
+          lgid = local.create_group(did);
+          worker.to_local_[m.gid_] = lgid;
+          worker.to_shared_[lgid] = m.gid_;
+        } else {
+          lgid = it->second;
+        }
+        local.add_value0(did, lgid, m.eid_, d, rng);
+      }
+    }
+  }
+
+  // blocks of a relation whose suffstats can be summed
+  inline bool
+  mergeable(const relation_container_t &relation) const
+  {
+    return relation.desc_.conjugate() &&
+      (relation.desc_.implicit_zeros() ||
+       detail::group_merge::supports(*relation.desc_.model()));
+  }
+
+  // adds every value of data to the (empty) blocks of the relations.
+  //
+  // with nthreads > 1, the outer dimension of every mergeable() relation is
+  // cut into shards, which are spread over a thread pool. each thread fills
+  // its own table of blocks, and the tables are then folded into the
+  // relations (one thread per relation). each thread draws from its own
+  // rng, seeded from rng. the other relations are built serially
+  void
+  build_suffstats(const dataset_t &data, size_t nthreads, common::rng_t &rng)
+  {
+    tuple_t gids;
+    std::vector<size_t> sharded;
+    for (size_t i = 0; i < relations_.size(); i++) {
+      auto &relation = relations_[i];
+      if (nthreads > 1 && mergeable(relation)) {
+        sharded.push_back(i);
+        continue;
+      }
+      for (size_t outer = 0; outer < data[i]->shape().front(); outer++)
+        for (const auto &pp : data[i]->slice(0, outer)) {
+          eids_to_gids_under_relation(gids, pp.first.data(), relation.desc_);
+          add_value_to_feature_group(gids, pp.second, relation, rng);
+        }
+    }
+    if (sharded.empty())
+      return;
+
+    struct partial_block_t {
+      partial_block_t() : count_(), ss_() {}
+      unsigned count_;
+      std::shared_ptr<models::group> ss_;
+    };
+    typedef detail::flat_hash_map<
+        tuple_t,
+        partial_block_t,
+        detail::gid_tuple_hash<tuple_t>,
+        detail::gid_tuple_equal<tuple_t>> partial_table_t;
+
+    struct shard_t {
+      size_t rel_;
+      size_t begin_;
+      size_t end_;
+    };
+
+    detail::thread_pool pool(nthreads);
+    std::vector<shard_t> shards;
+    for (auto i : sharded) {
+      const size_t n = data[i]->shape().front();
+      const size_t nshards = std::min(n, pool.size());
+      for (size_t j = 0; j < nshards; j++)
+        shards.push_back(shard_t{i, n * j / nshards, n * (j + 1) / nshards});
+    }
+
+    // partials[chunk][relation]
+    std::vector<std::vector<partial_table_t>> partials(
+        pool.size(), std::vector<partial_table_t>(relations_.size()));
+    std::vector<unsigned long> seeds(pool.size());
+    for (auto &seed : seeds)
+      seed = rng();
+    pool.parallel_for(shards.size(),
+      [this, &data, &shards, &partials, &seeds](
+        size_t chunk, size_t begin, size_t end)
+      {
+        common::rng_t rng(seeds[chunk]);
+        tuple_t gids;
+        for (size_t i = begin; i < end; i++) {
+          const auto &shard = shards[i];
+          const auto &relation = this->relations_[shard.rel_];
+          auto &table = partials[chunk][shard.rel_];
+          for (size_t outer = shard.begin_; outer < shard.end_; outer++)
+            for (const auto &pp : data[shard.rel_]->slice(0, outer)) {
+              MICROSCOPES_ASSERT(!pp.second.anymasked());
+              this->eids_to_gids_under_relation(gids, pp.first.data(), relation.desc_);
+              auto &b = table[gids];
+              b.count_++;
+              if (relation.desc_.implicit_zeros()) {
+                MICROSCOPES_DCHECK(pp.second.template get<bool>(), "implicit zeros: observed false");
+                continue;
+              }
+              if (!b.ss_)
+                b.ss_ = relation.hypers_->create_group(rng);
+              group_ops_t::add_value(*b.ss_, *relation.hypers_, pp.second, rng);
+            }
+        }
+      });
+
+    for (auto &seed : seeds)
+      seed = rng();
+    pool.parallel_for(sharded.size(),
+      [this, &sharded, &partials, &seeds](
+        size_t chunk, size_t begin, size_t end)
+      {
+        common::rng_t rng(seeds[chunk]);
+        for (size_t i = begin; i < end; i++) {
+          auto &relation = this->relations_[sharded[i]];
+          for (auto &tables : partials) {
+            auto &table = tables[sharded[i]];
+            for (const auto &p : table) {
+              auto &ss = this->get_or_create_suffstats(p.first, relation, rng);
+              ss.count_ += p.second.count_;
+              if (p.second.ss_) {
+                detail::group_merge::merge(*ss.ss_, *p.second.ss_);
+                relation.touch(p.first, ss);
+              }
+            }
+            table = partial_table_t();
+          }
+        }
+      });
+  }
+
+  // calls f(size_t first, size_t last, common::rng_t &rng) over runs of
+  // domain_relations_[domain] which, together, cover it. with a
+  // relation_pool_, the runs are spread over its threads and each call gets
+  // its own rng, seeded from rng. a relation never straddles two runs
+  template <typename F>
+  inline void
+  for_each_relation_run(size_t domain, common::rng_t &rng, F f) const
+  {
+    const auto &runs = relation_runs_[domain];
+    if (!relation_pool_ || runs.size() <= 2) {
+      f(0, domain_relations_[domain].size(), rng);
+      return;
+    }
+    auto &pool = *relation_pool_;
+    std::vector<unsigned long> seeds(pool.size());
+    for (auto &seed : seeds)
+      seed = rng();
+    pool.parallel_for(runs.size() - 1,
+      [&runs, &seeds, &f](size_t chunk, size_t begin, size_t end) {
+        common::rng_t rng(seeds[chunk]);
+        f(runs[begin], runs[end], rng);
+      });
+  }
+
+  static inline beta_bernoulli_hp_t
+  implicit_zeros_hp(const relation_container_t &relation)
+  {
+    MICROSCOPES_ASSERT(relation.desc_.implicit_zeros());
+    beta_bernoulli_hp_t hp;
+    hp.alpha_ = relation.zeros_alpha_.template get<float>();
+    hp.beta_ = relation.zeros_beta_.template get<float>();
+    return hp;
+  }
+
+  static inline float
+  lbeta(float a, float b)
+  {
+    using distributions::fast_lgamma;
+    return fast_lgamma(a) + fast_lgamma(b) - fast_lgamma(a + b);
+  }
+
+  // the marginal likelihood of a block with heads true cells out of ncells
+  static inline float
+  score_implicit_zeros_block(const beta_bernoulli_hp_t &hp, size_t heads, size_t ncells)
+  {
+    MICROSCOPES_ASSERT(heads <= ncells);
+    return lbeta(hp.alpha_ + heads, hp.beta_ + (ncells - heads)) -
+           lbeta(hp.alpha_, hp.beta_);
+  }
+
+  inline size_t
+  implicit_zeros_ncells(const relation_container_t &relation, const tuple_t &gids) const
+  {
+    size_t ncells = 1;
+    for (size_t i = 0; i < gids.size(); i++)
+      ncells *= domains_[relation.desc_.domains()[i]].groupsize(gids[i]);
+    return ncells;
+  }
+
+  // the joint predictive of ones true and ncells - ones false cells joining
+  // the block gids
+  inline float
+  score_implicit_zeros_cells(
+      const relation_container_t &relation,
+      const beta_bernoulli_hp_t &hp,
+      const tuple_t &gids,
+      size_t ncells,
+      size_t ones) const
+  {
+    MICROSCOPES_ASSERT(ones <= ncells);
+    const auto p = relation.find_suffstats(gids);
+    const float heads = p ? p->count_ : 0;
+    const float tails = implicit_zeros_ncells(relation, gids) - heads;
+    return lbeta(hp.alpha_ + heads + ones, hp.beta_ + tails + (ncells - ones)) -
+           lbeta(hp.alpha_ + heads, hp.beta_ + tails);
+  }
+
+  inline float
+  score_implicit_zeros_likelihood(const relation_container_t &relation) const
+  {
+    const auto hp = implicit_zeros_hp(relation);
+    const auto &doms = relation.desc_.domains();
+    float score = 0.;
+    tuple_t gids;
+    for (const auto &g0 : domains_[doms[0]]) {
+      for (const auto &g1 : domains_[doms[1]]) {
+        gids.clear();
+        gids.push_back(g0.first);
+        gids.push_back(g1.first);
+        const auto p = relation.find_suffstats(gids);
+        score += score_implicit_zeros_block(
+            hp, p ? p->count_ : 0, implicit_zeros_ncells(relation, gids));
+      }
     }
+    return score;
+  }
 
-    const float lgnorm = fast_log(pseudocounts);
-    for (auto &s : scores.second)
-      s -= lgnorm;
+  static inline size_t
+  implicit_zeros_ones(const implicit_zeros_entity_t &z, size_t gid0, size_t gid1)
+  {
+    tuple_t key;
+    key.push_back(gid0);
+    key.push_back(gid1);
+    const auto it = z.ones_.find(key);
+    return it == z.ones_.end() ? 0 : it->second;
   }
 
-private:
+  // the entity's cells in the relation, if it were placed in group g of did:
+  // one cell against each entity of the other position(s)
+  float
+  score_implicit_zeros_value(
+      const implicit_zeros_entity_t &z,
+      size_t did,
+      size_t g) const
+  {
+    const size_t Self = scoring_block_t::Self;
+    const auto &relation = relations_[z.rel_];
+    const auto &doms = relation.desc_.domains();
+    MICROSCOPES_ASSERT(doms.size() == 2);
+    float sum = 0.;
+    tuple_t gids;
+    if (doms[0] == doms[1]) {
+      // the entity's row, its column, and the diagonal cell (which lands in
+      // (g, g) along with the row and column cells against g itself)
+      for (const auto &h : domains_[did]) {
+        const size_t n = domains_[did].groupsize(h.first);
+        if (h.first == g) {
+          gids.clear();
+          gids.push_back(g);
+          gids.push_back(g);
+          sum += score_implicit_zeros_cells(relation, z.hp_, gids, 2 * n + 1,
+              implicit_zeros_ones(z, Self, g) +
+              implicit_zeros_ones(z, g, Self) +
+              implicit_zeros_ones(z, Self, Self));
+          continue;
+        }
+        gids.clear();
+        gids.push_back(g);
+        gids.push_back(h.first);
+        sum += score_implicit_zeros_cells(relation, z.hp_, gids, n,
+            implicit_zeros_ones(z, Self, h.first));
+        gids[0] = h.first;
+        gids[1] = g;
+        sum += score_implicit_zeros_cells(relation, z.hp_, gids, n,
+            implicit_zeros_ones(z, h.first, Self));
+      }
+      return sum;
+    }
+    const size_t pos = doms[0] == did ? 0 : 1;
+    const size_t other = doms[1 - pos];
+    for (const auto &h : domains_[other]) {
+      gids.clear();
+      gids.push_back(pos ? h.first : g);
+      gids.push_back(pos ? g : h.first);
+      const size_t ones = pos ?
+        implicit_zeros_ones(z, h.first, Self) :
+        implicit_zeros_ones(z, Self, h.first);
+      sum += score_implicit_zeros_cells(
+          relation, z.hp_, gids, domains_[other].groupsize(h.first), ones);
+    }
+    return sum;
+  }
 
-  struct rel_pos_t {
-    rel_pos_t() : rel_(), pos_() {}
-    rel_pos_t(size_t rel, size_t pos) : rel_(rel), pos_(pos) {}
-    size_t rel_;
-    size_t pos_;
-  };
+  // implicit zero relations do not hold groups
+  inline void
+  check_explicit_suffstats(size_t relation) const
+  {
+    MICROSCOPES_DCHECK(relation < relations_.size(), "invalid relation id");
+    MICROSCOPES_CHECK(!relations_[relation].desc_.implicit_zeros(),
+        "suffstats of implicit zero relations are only available as counts");
+  }
+
+  template <typename Data>
+  void
+  entity_data_by_block(
+      std::vector<scoring_block_t> &blocks,
+      size_t did,
+      size_t eid,
+      const Data &d) const
+  {
+    std::map<std::pair<size_t, tuple_t>, size_t> index;
+    tuple_t gids;
+    iterate_over_entity_data(
+        did, eid, d,
+        [this, &blocks, &index, &gids, did, eid](
+          size_t rid,
+          const size_t *eids,
+          const common::value_accessor &value)
+        {
+          const auto &doms = this->relations_[rid].desc_.domains();
+          gids.clear();
+          gids.reserve(doms.size());
+          for (size_t i = 0; i < doms.size(); i++) {
+            if (doms[i] == did && eids[i] == eid) {
+              gids.push_back(scoring_block_t::Self);
+              continue;
+            }
+            MICROSCOPES_DCHECK(
+                this->domains_[doms[i]].assignments()[eids[i]] != -1,
+                "eid is not assigned to a valid group");
+            gids.push_back(this->domains_[doms[i]].assignments()[eids[i]]);
+          }
+          const auto ret =
+            index.insert(std::make_pair(std::make_pair(rid, gids), blocks.size()));
+          if (ret.second) {
+            blocks.emplace_back();
+            blocks.back().rel_ = rid;
+            blocks.back().gids_ = gids;
+            blocks.back().aliased_ =
+              std::count(doms.begin(), doms.end(), did) > 1;
+          }
+          blocks[ret.first->second].values_.push_back(value);
+        });
+  }
+
+  // the joint predictive of values under group, which must equal the sum of
+  // the sequential predictives. the last value is scored without being added,
+  // so a block holding a single value is scored without touching the group
+  static inline float
+  score_block(
+      models::group &group,
+      const models::hypers &hypers,
+      const std::vector<common::value_accessor> &values,
+      common::rng_t &rng)
+  {
+    MICROSCOPES_ASSERT(!values.empty());
+    float sum = 0.;
+    const size_t n = values.size();
+    for (size_t i = 0; i < n - 1; i++) {
+      sum += group_ops_t::score_value(group, hypers, values[i], rng);
+      group_ops_t::add_value(group, hypers, values[i], rng);
+    }
+    sum += group_ops_t::score_value(group, hypers, values[n - 1], rng);
+    for (size_t i = n - 1; i-- > 0; )
+      group_ops_t::remove_value(group, hypers, values[i], rng);
+    return sum;
+  }
 
   inline void
   eids_to_gids_under_relation(
       tuple_t &gids,
-      const variadic_tuple_t &eids,
+      const size_t *eids,
       const relation_definition &desc) const
   {
     gids.clear();
@@ -608,34 +3146,45 @@ private:
     }
   }
 
+  // returns the suffstat for gids, creating it (with a zero count) if it
+  // does not exist yet
+  suffstats_t &
+  get_or_create_suffstats(
+      const tuple_t &gids,
+      relation_container_t &relation,
+      common::rng_t &rng)
+  {
+    auto p = relation.find_suffstats(gids);
+    if (p)
+      return *p;
+    auto &ss = relation.insert_suffstats(gids);
+    ss.ident_ = relation.ident_gen_++;
+    MICROSCOPES_ASSERT(!ss.count_);
+    MICROSCOPES_ASSERT(!ss.ss_);
+    if (!relation.desc_.implicit_zeros())
+      ss.ss_ = relation.groups_.acquire(*relation.hypers_, rng);
+    MICROSCOPES_ASSERT(relation.ident_table_.find(ss.ident_) == relation.ident_table_.end());
+    relation.ident_table_[ss.ident_] = gids;
+    return ss;
+  }
+
   void
   add_value_to_feature_group(
       const tuple_t &gids,
       const common::value_accessor &value,
       relation_container_t &relation,
-      common::rng_t &rng,
-      float *acc_score)
+      common::rng_t &rng)
   {
     MICROSCOPES_ASSERT(!value.anymasked());
-    std::shared_ptr<models::group> group;
-    auto it = relation.suffstats_table_.find(gids);
-    if (it == relation.suffstats_table_.end()) {
-      group = relation.hypers_->create_group(rng);
-      auto &ss = relation.suffstats_table_[gids];
-      ss.ident_ = relation.ident_gen_++;
-      ss.count_ = 1;
-      MICROSCOPES_ASSERT(!ss.ss_);
-      ss.ss_ = group;
-      MICROSCOPES_ASSERT(relation.ident_table_.find(ss.ident_) == relation.ident_table_.end());
-      relation.ident_table_[ss.ident_] = gids;
-    } else {
-      it->second.count_++;
-      group = it->second.ss_;
+    auto &ss = get_or_create_suffstats(gids, relation, rng);
+    ss.count_++;
+    if (relation.desc_.implicit_zeros()) {
+      MICROSCOPES_DCHECK(value.get<bool>(), "implicit zeros: observed false");
+      return;
     }
-    MICROSCOPES_ASSERT(group);
-    if (acc_score)
-      *acc_score += group->score_value(*relation.hypers_, value, rng);
-    group->add_value(*relation.hypers_, value, rng);
+    MICROSCOPES_ASSERT(ss.ss_);
+    group_ops_t::add_value(*ss.ss_, *relation.hypers_, value, rng);
+    relation.touch(gids, ss);
   }
 
   void
@@ -645,46 +3194,68 @@ private:
       relation_container_t &relation,
       common::rng_t &rng)
   {
-    auto it = relation.suffstats_table_.find(gids);
+    auto p = relation.find_suffstats(gids);
     MICROSCOPES_ASSERT(!value.anymasked());
-    MICROSCOPES_ASSERT(it != relation.suffstats_table_.end());
-    MICROSCOPES_ASSERT(it->second.count_);
-    MICROSCOPES_ASSERT(it->second.ss_);
+    MICROSCOPES_ASSERT(p);
+    MICROSCOPES_ASSERT(p->count_);
+    MICROSCOPES_ASSERT(p->ss_ || relation.desc_.implicit_zeros());
     MICROSCOPES_ASSERT(
-        relation.ident_table_.find(it->second.ident_) != relation.ident_table_.end() &&
-        relation.ident_table_[it->second.ident_] == gids);
-    it->second.ss_->remove_value(*relation.hypers_, value, rng);
-    it->second.count_--;
-    // XXX: unfortunately, we cannot clean this up now!! this is because for
-    // non-conjugate models, score_value() depends on the randomness we sampled
-    // in add_value_to_feature_group() for correctness. yes, this is quite hacky
-    // (for conjugate models, it is safe to delete here)
+        relation.ident_table_.find(p->ident_) != relation.ident_table_.end() &&
+        relation.ident_table_[p->ident_] == gids);
+    if (!relation.desc_.implicit_zeros()) {
+      group_ops_t::remove_value(*p->ss_, *relation.hypers_, value, rng);
+      relation.touch(gids, *p);
+    }
+    if (--p->count_ || !relation.desc_.conjugate())
+      return;
+    // for conjugate models, an empty block is indistinguishable from a
+    // missing one, so it is discarded right away.
     //
-    // note that, the point at which the suffstat can be GC-ed for non-conj
-    // models is when >= of the gids associated with it is no longer a valid gid
-    // (which should imply the count is zero also)
-    //if (!--it->second.count_) {
-    //  relation.ident_table_.erase(it->second.ident_);
-    //  relation.suffstats_table_.erase(it);
-    //}
+    // for non-conjugate models, we cannot clean this up now!! this is because
+    // score_value() depends on the randomness we sampled in
+    // add_value_to_feature_group() for correctness. the point at which the
+    // suffstat can be GC-ed is when >= 1 of the gids associated with it is no
+    // longer a valid gid (which should imply the count is zero also), which
+    // delete_group() takes care of
+    relation.ident_table_.erase(p->ident_);
+    relation.erase_suffstats(gids);
+  }
+
+  template <typename Data, typename T>
+  inline void
+  iterate_over_entity_data(
+      size_t domain,
+      size_t eid,
+      const Data &d,
+      T callback) const
+  {
+    iterate_over_entity_data(
+        domain, eid, d, 0, domain_relations_[domain].size(), callback);
   }
 
+  // only the data of domain_relations_[domain][first, last), which must
+  // not split a relation
   template <typename T>
   void
   iterate_over_entity_data(
       size_t domain,
       size_t eid,
       const dataset_t &d,
+      size_t first,
+      size_t last,
       T callback) const
   {
     tuple_t ignore_idxs;
-    for (const auto &dr : domain_relations_[domain]) {
+    detail::lap_timer timer;
+    for (size_t i = first; i < last; i++) {
+      const auto &dr = domain_relations_[domain][i];
       auto &relation = relations_[dr.rel_];
       auto &data = d[dr.rel_];
       ignore_idxs.clear();
       for (size_t i = 0; i < dr.pos_; i++)
         if (relation.desc_.domains()[i] == domain)
           ignore_idxs.push_back(i);
+      size_t n = 0;
       for (const auto &p : data->slice(dr.pos_, eid)) {
         // don't double count
         bool skip = false;
@@ -696,9 +3267,100 @@ private:
         }
         if (skip)
           continue;
-        callback(dr.rel_, p.first, p.second);
+        n++;
+        callback(dr.rel_, p.first.data(), p.second);
+      }
+      relation.counters_.observations_.add(n);
+      timer.lap(relation.counters_.iterate_ns_);
+    }
+  }
+
+  template <typename T>
+  inline void
+  iterate_over_entity_data(
+      size_t domain,
+      size_t eid,
+      const detail::entity_index &index,
+      size_t first,
+      size_t last,
+      T callback) const
+  {
+    MICROSCOPES_ASSERT(index.nentities() == domains_[domain].nentities());
+    const auto &drs = domain_relations_[domain];
+    if (first == last)
+      return;
+    // relations appear in increasing order
+    const size_t lo = drs[first].rel_, hi = drs[last - 1].rel_;
+    if (detail::counters_enabled) {
+      // the cells of a relation are contiguous, so its time is charged when
+      // the next relation (or the end) comes up
+      detail::lap_timer timer;
+      size_t current = lo, n = 0;
+      index.for_each(eid, lo, hi,
+        [this, &callback, &timer, &current, &n](
+          size_t rid,
+          const size_t *eids,
+          const common::value_accessor &value)
+        {
+          if (rid != current) {
+            this->relations_[current].counters_.observations_.add(n);
+            timer.lap(this->relations_[current].counters_.iterate_ns_);
+            current = rid;
+            n = 0;
+          }
+          n++;
+          callback(rid, eids, value);
+        });
+      relations_[current].counters_.observations_.add(n);
+      timer.lap(relations_[current].counters_.iterate_ns_);
+      return;
+    }
+    index.for_each(eid, lo, hi, callback);
+  }
+
+  // the data of each entity of domain, in the order iterate_over_entity_data()
+  // visits it
+  detail::entity_index
+  build_entity_index(size_t domain, const dataset_t &d) const
+  {
+    std::vector<size_t> owned(domains_[domain].nentities());
+    std::iota(owned.begin(), owned.end(), 0);
+    return build_entity_index(domain, d, owned);
+  }
+
+  // only the data of owned (which must be sorted) is indexed, every other
+  // entity of domain appears to have none
+  detail::entity_index
+  build_entity_index(
+      size_t domain,
+      const dataset_t &d,
+      const std::vector<size_t> &owned) const
+  {
+    MICROSCOPES_ASSERT(std::is_sorted(owned.begin(), owned.end()));
+    std::vector<size_t> rels;
+    for (const auto &dr : domain_relations_[domain])
+      if (rels.empty() || rels.back() != dr.rel_)
+        rels.push_back(dr.rel_);
+    detail::entity_index index(rels);
+    auto it = owned.begin();
+    for (size_t eid = 0; eid < domains_[domain].nentities(); eid++) {
+      if (it == owned.end() || *it != eid) {
+        index.next_entity();
+        continue;
       }
+      ++it;
+      iterate_over_entity_data(
+          domain, eid, d,
+          [this, &index](
+            size_t rid,
+            const size_t *eids,
+            const common::value_accessor &value)
+          {
+            index.push_back(rid, eids, this->relations_[rid].desc_.arity(), value);
+          });
+      index.next_entity();
     }
+    return index;
   }
 
   inline suffstats_t &
@@ -709,9 +3371,9 @@ private:
     auto &tab = rel.ident_table_;
     auto it = tab.find(id);
     MICROSCOPES_DCHECK(it != tab.end(), "invalid ident");
-    auto it1 = rel.suffstats_table_.find(it->second);
-    MICROSCOPES_ASSERT(it1 != rel.suffstats_table_.end());
-    return it1->second;
+    auto p = rel.find_suffstats(it->second);
+    MICROSCOPES_ASSERT(p);
+    return *p;
   }
 
   inline const suffstats_t &
@@ -735,21 +3397,130 @@ private:
     return ret;
   }
 
+  // groups[i]->set_ss(bag(i)) for each i, over nthreads threads. decoding
+  // the bags is the bulk of a restore, and touches nothing but the groups
+  template <typename F>
+  static void
+  set_suffstats_bulk(
+      const std::vector<models::group *> &groups,
+      F bag,
+      size_t nthreads)
+  {
+    if (nthreads <= 1 || groups.size() < 2) {
+      for (size_t i = 0; i < groups.size(); i++)
+        groups[i]->set_ss(bag(i));
+      return;
+    }
+    detail::thread_pool pool(nthreads);
+    pool.parallel_for(groups.size(),
+      [&groups, &bag](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+          groups[i]->set_ss(bag(i));
+      });
+  }
+
+  // how the suffstats of relation are laid out in a checkpoint
+  static inline detail::checkpoint_encoding
+  checkpoint_encoding_of(const relation_container_t &relation)
+  {
+    const auto &m = *relation.desc_.model();
+    if (relation.desc_.implicit_zeros())
+      return detail::CHECKPOINT_SS_NONE;
+    if (detail::group_ops<distributions::BetaBernoulli>::accepts(m))
+      return detail::CHECKPOINT_SS_BB;
+    if (detail::group_ops<distributions::NormalInverseChiSq>::accepts(m))
+      return detail::CHECKPOINT_SS_NICH;
+    return detail::CHECKPOINT_SS_BYTES;
+  }
+
+  // one suffstat field of every block, in the order of for_each_suffstats()
+  template <typename T>
+  static void
+  write_checkpoint_column(
+      detail::checkpoint_writer &out,
+      const relation_container_t &relation,
+      const std::string &key)
+  {
+    relation.for_each_suffstats(
+      [&out, &key](const tuple_t &, const suffstats_t &ss) {
+        out.append(detail::get_ss_field<T>(*ss.ss_, key));
+      });
+    out.align();
+  }
+
   std::vector<domain> domains_;
   std::vector<std::vector<rel_pos_t>> domain_relations_;
+  // the offsets into domain_relations_[d] where a new relation starts,
+  // followed by domain_relations_[d].size()
+  std::vector<std::vector<size_t>> relation_runs_;
   std::vector<relation_container_t> relations_;
+  // see set_score_threads() and set_relation_threads()
+  std::shared_ptr<detail::thread_pool> score_pool_;
+  std::shared_ptr<detail::thread_pool> relation_pool_;
+  // see set_inverse_temperature()
+  float inverse_temperature_;
+
+  // the running assignment score of a domain, see score_joint()
+  struct assignment_score_t {
+    assignment_score_t()
+      : valid_(), alpha_(), score_(), nassigned_(), watches_() {}
+    bool valid_;
+    // the concentration score_ is under
+    float alpha_;
+    double score_;
+    size_t nassigned_;
+    std::vector<value_watch_t> watches_;
+
+    // the score of one more entity in a group of m, in double so that the
+    // running sum does not drift over long chains
+    double
+    delta(size_t m) const
+    {
+      return std::log(m ? double(m) : double(alpha_)) -
+             std::log(double(alpha_) + double(nassigned_));
+    }
+  };
+  mutable std::vector<assignment_score_t> assignment_scores_;
+
+  // the entities of each group of a domain, see group_members(). pos_[eid]
+  // is where eid sits in the list of its group
+  struct group_members_t {
+    group_members_t() : valid_(), members_(), pos_() {}
+    bool valid_;
+    detail::flat_hash_map<
+        size_t,
+        std::vector<size_t>,
+        detail::integer_hash<size_t>> members_;
+    std::vector<size_t> pos_;
+  };
+  std::vector<group_members_t> group_members_;
+
+  // see counters()
+  mutable std::vector<detail::domain_counters_t> domain_counters_;
 };
 
-template <ssize_t MaxRelationArity>
-std::shared_ptr<state<MaxRelationArity>>
-state<MaxRelationArity>::initialize(
+template <ssize_t MaxRelationArity, typename Distribution>
+const size_t state<MaxRelationArity, Distribution>::scoring_block_t::Self;
+
+template <ssize_t MaxRelationArity, typename Distribution>
+const size_t state<MaxRelationArity, Distribution>::ParallelScoreMinGroups;
+
+template <ssize_t MaxRelationArity, typename Distribution>
+const common::ident_t
+state<MaxRelationArity, Distribution>::value_watch_t::NoIdent;
+
+template <ssize_t MaxRelationArity, typename Distribution>
+std::shared_ptr<state<MaxRelationArity, Distribution>>
+state<MaxRelationArity, Distribution>::initialize(
     const model_definition &defn,
     const std::vector<common::hyperparam_bag_t> &cluster_inits,
     const std::vector<common::hyperparam_bag_t> &relation_inits,
     const std::vector<variadic_tuple_t> &domain_assignments,
     const dataset_t &data,
-    common::rng_t &rng)
+    common::rng_t &rng,
+    size_t nthreads)
 {
+  MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
   MICROSCOPES_DCHECK(cluster_inits.size() == defn.domains().size(),
       "# domains mismatch");
   MICROSCOPES_DCHECK(relation_inits.size() == defn.relations().size(),
@@ -782,25 +3553,29 @@ state<MaxRelationArity>::initialize(
       MICROSCOPES_DCHECK(s != -1, "assignments should all be filled");
 #endif
 
-  tuple_t gids;
-  for (size_t i = 0; i < p->relations_.size(); i++) {
-    auto &relation = p->relations_[i];
-    for (size_t outer = 0; outer < data[i]->shape().front(); outer++)
-      for (const auto &pp : data[i]->slice(0, outer)) {
-        p->eids_to_gids_under_relation(gids, pp.first, relation.desc_);
-        p->add_value_to_feature_group(gids, pp.second, relation, rng, nullptr);
-      }
-  }
+  p->build_suffstats(data, nthreads, rng);
   return p;
 }
 
-template <ssize_t MaxRelationArity>
-std::shared_ptr<state<MaxRelationArity>>
-state<MaxRelationArity>::deserialize(
+template <ssize_t MaxRelationArity, typename Distribution>
+std::shared_ptr<state<MaxRelationArity, Distribution>>
+state<MaxRelationArity, Distribution>::deserialize(
     const model_definition &defn,
     const common::serialized_t &s)
 {
-  common::rng_t rng; // XXX: hack
+  common::rng_t rng; // see the note on the declaration
+  return deserialize(defn, s, rng);
+}
+
+template <ssize_t MaxRelationArity, typename Distribution>
+std::shared_ptr<state<MaxRelationArity, Distribution>>
+state<MaxRelationArity, Distribution>::deserialize(
+    const model_definition &defn,
+    const common::serialized_t &s,
+    common::rng_t &rng,
+    size_t nthreads)
+{
+  MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
 
   // some attempt made to validate inputs, but not foolproof
   io::IrmState m;
@@ -808,68 +3583,326 @@ state<MaxRelationArity>::deserialize(
 
   MICROSCOPES_DCHECK((size_t)m.domains_size() == defn.domains().size(),
       "# domains mismatch");
-  std::vector<domain> domains;
-  domains.reserve(defn.domains().size());
+  MICROSCOPES_DCHECK((size_t)m.relations_size() == defn.relations().size(),
+      "# relations mismatch");
+
+  // built in place, as copying the relations would double the peak memory
+  auto p = unsafe_initialize(defn);
   for (size_t i = 0; i < defn.domains().size(); i++)
-    domains.emplace_back(
+    p->domains_[i] = domain(
         m.domains(i), [](const std::string &) { return detail::_empty(); });
 
-  MICROSCOPES_DCHECK((size_t)m.relations_size() == defn.relations().size(),
-      "# relations mismatch");
-  std::vector<relation_container_t> relations;
-  relations.reserve(defn.relations().size());
+  std::vector<models::group *> groups;
   for (size_t i = 0; i < defn.relations().size(); i++) {
     const auto &rdef = defn.relations()[i];
-    relation_container_t reln;
-    reln.desc_ = rdef;
+    auto &reln = p->relations_[i];
     const auto &r = m.relations(i);
-    reln.hypers_ = rdef.model()->create_hypers();
     reln.hypers_->set_hp(r.hypers());
 
-    for (size_t j = 0; j < size_t(r.suffstats_size()); j++) {
-      suffstats_t suffstat;
+    const size_t n = r.suffstats_size();
+    reln.suffstats_table_.reserve(n);
+    reln.ident_table_.reserve(n);
+    groups.clear();
+    if (!rdef.implicit_zeros())
+      groups.reserve(n);
+    tuple_t gids;
+    for (size_t j = 0; j < n; j++) {
       const auto &ss = r.suffstats(j);
       MICROSCOPES_DCHECK((size_t)ss.gids_size() == rdef.domains().size(),
           "arity mismatch");
-      tuple_t gids;
-      gids.reserve(ss.gids_size());
+      gids.clear();
       for (size_t k = 0; k < rdef.domains().size(); k++)
         gids.push_back(ss.gids(k));
       // see note in schema.proto: not validated
+      auto &suffstat = reln.insert_suffstats(gids);
       suffstat.ident_ = ss.id();
       suffstat.count_ = ss.count();
-      suffstat.ss_ = reln.hypers_->create_group(rng);
-      suffstat.ss_->set_ss(ss.suffstat());
+      if (!rdef.implicit_zeros()) {
+        suffstat.ss_ = reln.groups_.acquire(*reln.hypers_, rng);
+        groups.push_back(suffstat.ss_.get());
+      }
 
-      reln.suffstats_table_[gids] = suffstat;
       reln.ident_table_[ss.id()] = gids;
       reln.ident_gen_ = std::max<size_t>(reln.ident_gen_, ss.id() + 1);
     }
 
-    relations.emplace_back(reln);
+    set_suffstats_bulk(groups,
+        [&r](size_t j) -> const std::string & { return r.suffstats(j).suffstat(); },
+        nthreads);
+  }
+
+  return p;
+}
+
+template <ssize_t MaxRelationArity, typename Distribution>
+void
+state<MaxRelationArity, Distribution>::save_checkpoint(
+    const std::string &path) const
+{
+  detail::checkpoint_writer out(path);
+  out.header(domains_.size(), relations_.size());
+  out.put(score_threads());
+  out.put(relation_threads());
+
+  // the gids of each domain are written as their rank among its groups, so
+  // that the restored domain is built without gaps (see load_checkpoint())
+  std::vector<gid_map_t> ranks(domains_.size());
+  for (size_t i = 0; i < domains_.size(); i++) {
+    const auto &d = domains_[i];
+    auto &rank = ranks[i];
+    rank.reserve(d.ngroups());
+    size_t k = 0;
+    for (const auto &g : d)
+      rank[g.first] = k++;
+    out.put_bytes(d.get_hp());
+    out.put(d.nentities());
+    for (auto gid : d.assignments())
+      out.append(int64_t(gid == -1 ? -1 : rank.find(gid)->second));
+    out.align();
+    out.put(d.ngroups());
+  }
+
+  const std::string heads("heads"), tails("tails"), count("count"),
+        mean("mean"), count_times_variance("count_times_variance");
+  for (const auto &r : relations_) {
+    const size_t n = r.nsuffstats();
+    const auto encoding = checkpoint_encoding_of(r);
+    out.put_bytes(r.hypers_->get_hp());
+    out.put(r.desc_.arity());
+    out.put(n);
+    out.put(r.ident_gen_);
+    out.put(encoding);
+    out.put(r.dense_);
+
+    // every array is one pass over the blocks, which are visited in the
+    // same order each time
+    const auto &doms = r.desc_.domains();
+    r.for_each_suffstats(
+      [&out, &doms, &ranks](const tuple_t &gids, const suffstats_t &) {
+        for (size_t k = 0; k < gids.size(); k++)
+          out.append(uint64_t(ranks[doms[k]].find(gids[k])->second));
+      });
+    out.align();
+    r.for_each_suffstats([&out](const tuple_t &, const suffstats_t &ss) {
+      out.append(uint64_t(ss.ident_));
+    });
+    out.align();
+    r.for_each_suffstats([&out](const tuple_t &, const suffstats_t &ss) {
+      out.append(uint64_t(ss.count_));
+    });
+    out.align();
+
+    switch (encoding) {
+    case detail::CHECKPOINT_SS_NONE:
+      break;
+    case detail::CHECKPOINT_SS_BB:
+      write_checkpoint_column<int32_t>(out, r, heads);
+      write_checkpoint_column<int32_t>(out, r, tails);
+      break;
+    case detail::CHECKPOINT_SS_NICH:
+      write_checkpoint_column<int32_t>(out, r, count);
+      write_checkpoint_column<float>(out, r, mean);
+      write_checkpoint_column<float>(out, r, count_times_variance);
+      break;
+    case detail::CHECKPOINT_SS_BYTES: {
+      // the offsets are only known once the bags are written
+      std::vector<uint64_t> offsets(n + 1);
+      const uint64_t at = out.tell();
+      for (size_t i = 0; i <= n; i++)
+        out.append(uint64_t(0));
+      out.align();
+      size_t i = 0;
+      r.for_each_suffstats(
+        [&out, &offsets, &i](const tuple_t &, const suffstats_t &ss) {
+          const auto bag = ss.ss_->get_ss();
+          out.put_raw(bag.data(), bag.size());
+          offsets[i + 1] = offsets[i] + bag.size();
+          i++;
+        });
+      out.align();
+      out.patch(at, offsets.data(), offsets.size() * sizeof(uint64_t));
+      break;
+    }
+    }
+  }
+  out.commit();
+}
+
+template <ssize_t MaxRelationArity, typename Distribution>
+std::shared_ptr<state<MaxRelationArity, Distribution>>
+state<MaxRelationArity, Distribution>::load_checkpoint(
+    const model_definition &defn,
+    const std::string &path)
+{
+  common::rng_t rng; // see deserialize()
+  return load_checkpoint(defn, path, rng);
+}
+
+template <ssize_t MaxRelationArity, typename Distribution>
+std::shared_ptr<state<MaxRelationArity, Distribution>>
+state<MaxRelationArity, Distribution>::load_checkpoint(
+    const model_definition &defn,
+    const std::string &path,
+    common::rng_t &rng,
+    size_t nthreads)
+{
+  MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+
+  detail::mapped_file f(path);
+  detail::checkpoint_reader in(f.data(), f.size());
+  in.header(defn.domains().size(), defn.relations().size());
+  auto p = unsafe_initialize(defn);
+  const size_t score_threads = in.get(), relation_threads = in.get();
+  MICROSCOPES_CHECK(score_threads >= 1 && relation_threads >= 1,
+      "corrupt checkpoint");
+  p->set_score_threads(score_threads);
+  p->set_relation_threads(relation_threads);
+
+  for (auto &d : p->domains_) {
+    d.set_hp(in.get_bytes());
+    const size_t n = in.get();
+    MICROSCOPES_CHECK(n == d.nentities(), "# entities mismatch");
+    const int64_t *assignments = in.array<int64_t>(n);
+    // gids were written as ranks, which a fresh domain hands out in sequence
+    const size_t ngroups = in.get();
+    for (size_t gid = 0; gid < ngroups; gid++)
+      d.create_group();
+    for (size_t eid = 0; eid < n; eid++) {
+      if (assignments[eid] == -1)
+        continue;
+      MICROSCOPES_CHECK(assignments[eid] >= 0 &&
+          size_t(assignments[eid]) < ngroups,
+          "assignment to an invalid group");
+      d.add_value(assignments[eid], eid);
+    }
+  }
+
+  const std::string heads("heads"), tails("tails"), count("count"),
+        mean("mean"), count_times_variance("count_times_variance");
+  for (auto &reln : p->relations_) {
+    reln.hypers_->set_hp(in.get_bytes());
+    const size_t arity = in.get();
+    MICROSCOPES_CHECK(arity == reln.desc_.arity(), "arity mismatch");
+    const size_t n = in.get();
+    reln.ident_gen_ = in.get();
+    const auto encoding = in.get();
+    MICROSCOPES_CHECK(encoding == size_t(checkpoint_encoding_of(reln)),
+        "relation model mismatch");
+    // the domains are complete, so the blocks can go straight into a dense
+    // table
+    if (in.get())
+      reln.set_dense(true);
+
+    const uint64_t *gids = in.array<uint64_t>(n * arity);
+    const uint64_t *idents = in.array<uint64_t>(n);
+    const uint64_t *counts = in.array<uint64_t>(n);
+    const int32_t *i32s[3] = {};
+    const float *f32s[3] = {};
+    const uint64_t *offsets = nullptr;
+    const char *bags = nullptr;
+    switch (encoding) {
+    case detail::CHECKPOINT_SS_BB:
+      i32s[0] = in.array<int32_t>(n);
+      i32s[1] = in.array<int32_t>(n);
+      break;
+    case detail::CHECKPOINT_SS_NICH:
+      i32s[0] = in.array<int32_t>(n);
+      f32s[1] = in.array<float>(n);
+      f32s[2] = in.array<float>(n);
+      break;
+    case detail::CHECKPOINT_SS_BYTES:
+      offsets = in.array<uint64_t>(n + 1);
+      bags = in.raw(offsets[n]);
+      break;
+    }
+
+    reln.suffstats_table_.reserve(n);
+    reln.ident_table_.reserve(n);
+    std::vector<models::group *> bagged;
+    tuple_t t;
+    for (size_t i = 0; i < n; i++) {
+      t.clear();
+      for (size_t k = 0; k < arity; k++)
+        t.push_back(gids[i * arity + k]);
+      // see note in schema.proto: not validated
+      auto &ss = reln.insert_suffstats(t);
+      ss.ident_ = idents[i];
+      MICROSCOPES_CHECK(counts[i] <= std::numeric_limits<unsigned>::max(),
+          "block count out of range");
+      ss.count_ = counts[i];
+      reln.ident_table_[ss.ident_] = t;
+      if (encoding == detail::CHECKPOINT_SS_NONE)
+        continue;
+      ss.ss_ = reln.groups_.acquire(*reln.hypers_, rng);
+      models::group &g = *ss.ss_;
+      switch (encoding) {
+      case detail::CHECKPOINT_SS_BB:
+        g.get_ss_mutator(heads).set<int32_t>(i32s[0][i]);
+        g.get_ss_mutator(tails).set<int32_t>(i32s[1][i]);
+        break;
+      case detail::CHECKPOINT_SS_NICH:
+        g.get_ss_mutator(count).set<int32_t>(i32s[0][i]);
+        g.get_ss_mutator(mean).set<float>(f32s[1][i]);
+        g.get_ss_mutator(count_times_variance).set<float>(f32s[2][i]);
+        break;
+      default:
+        MICROSCOPES_CHECK(offsets[i] <= offsets[i + 1] &&
+            offsets[i + 1] <= offsets[n], "corrupt checkpoint");
+        bagged.push_back(&g);
+        break;
+      }
+    }
+    set_suffstats_bulk(bagged,
+        [offsets, bags](size_t i) {
+          return std::string(bags + offsets[i], offsets[i + 1] - offsets[i]);
+        },
+        nthreads);
   }
 
-  return std::make_shared<state<MaxRelationArity>>(domains, relations);
+  return p;
 }
 
 /**
  * The binds happen on a per-domain basis
  */
-template <ssize_t MaxRelationArity = -1>
-class model : public common::entity_based_state_object {
+template <ssize_t MaxRelationArity = -1, typename Distribution = void>
+class model : public common::entity_based_state_object,
+              public chromatic_assignable,
+              public hogwild_assignable,
+              public split_mergeable,
+              public temperable {
 public:
-  model(const std::shared_ptr<state<MaxRelationArity>> &impl,
+  model(const std::shared_ptr<state<MaxRelationArity, Distribution>> &impl,
         size_t domain,
         const std::vector<std::shared_ptr<common::relation::dataview>> &data)
-    : impl_(impl), domain_(domain), data_(data), data_raw_()
+    : impl_(impl), domain_(domain), data_(data), data_raw_(), index_(),
+      colors_()
   {
-    MICROSCOPES_DCHECK(impl.get(), "nullptr impl");
-    data_raw_.reserve(data_.size());
-    for (auto &p : data_) {
-      MICROSCOPES_DCHECK(p.get(), "nullptr dataview");
-      data_raw_.push_back(p.get());
-    }
-    impl_->assert_correct_shape(data_raw_);
+    init_data();
+    index_ = std::make_shared<detail::entity_index>(
+        impl_->build_entity_index(domain_, data_raw_));
+  }
+
+  // binds to the index of another model of the same domain over the same
+  // data (see shared_index()), instead of building one. the index is read
+  // only, so the models can be run from different threads
+  model(const std::shared_ptr<state<MaxRelationArity, Distribution>> &impl,
+        size_t domain,
+        const std::vector<std::shared_ptr<common::relation::dataview>> &data,
+        const std::shared_ptr<const detail::entity_index> &index)
+    : impl_(impl), domain_(domain), data_(data), data_raw_(), index_(index),
+      colors_()
+  {
+    MICROSCOPES_DCHECK(index.get(), "nullptr index");
+    init_data();
+    MICROSCOPES_CHECK(index_->nentities() == impl_->nentities(domain_),
+        "index was built for a different domain");
+  }
+
+  inline const std::shared_ptr<const detail::entity_index> &
+  shared_index() const
+  {
+    return index_;
   }
 
   size_t nentities() const override { return impl_->nentities(domain_); }
@@ -920,19 +3953,21 @@ public:
   void
   add_value(size_t gid, size_t eid, common::rng_t &rng) override
   {
-    impl_->add_value0(domain_, gid, eid, data_raw_, rng, nullptr);
+    impl_->add_value0(domain_, gid, eid, *index_, rng);
   }
 
   size_t
   remove_value(size_t eid, common::rng_t &rng) override
   {
-    return impl_->remove_value0(domain_, eid, data_raw_, rng);
+    return impl_->remove_value0(domain_, eid, *index_, rng);
   }
 
   std::pair<std::vector<size_t>, std::vector<float>>
   score_value(size_t eid, common::rng_t &rng) const override
   {
-    return impl_->score_value(domain_, eid, data_raw_, rng);
+    std::pair<std::vector<size_t>, std::vector<float>> ret;
+    impl_->inplace_score_value0(ret, domain_, eid, *index_, rng);
+    return ret;
   }
 
   void
@@ -940,7 +3975,7 @@ public:
       std::pair<std::vector<size_t>, std::vector<float>> &scores,
       size_t eid, common::rng_t &rng) const override
   {
-    impl_->inplace_score_value0(scores, domain_, eid, data_raw_, rng);
+    impl_->inplace_score_value0(scores, domain_, eid, *index_, rng);
   }
 
   float score_assignment() const override { return impl_->score_assignment(domain_); }
@@ -961,13 +3996,159 @@ public:
 
   void delete_group(size_t gid) override { impl_->delete_group(domain_, gid); }
 
+  void
+  chromatic_assign(
+      detail::thread_pool &pool, size_t max_batch, common::rng_t &rng) override
+  {
+    if (colors_.empty())
+      colors_ = impl_->color_entities(domain_, *index_);
+    impl_->chromatic_assign0(domain_, colors_, *index_, pool, max_batch, rng);
+  }
+
+  hogwild_report
+  hogwild_assign(
+      detail::thread_pool &pool, size_t max_staleness, common::rng_t &rng) override
+  {
+    return impl_->hogwild_assign0(domain_, *index_, pool, max_staleness, rng);
+  }
+
+  split_merge_report
+  split_merge(size_t nproposals, size_t nscans, common::rng_t &rng) override
+  {
+    return impl_->split_merge0(domain_, *index_, nproposals, nscans, rng);
+  }
+
+  void set_inverse_temperature(float beta) override { impl_->set_inverse_temperature(beta); }
+  float inverse_temperature() const override { return impl_->inverse_temperature(); }
+
 private:
-  std::shared_ptr<state<MaxRelationArity>> impl_;
+  void
+  init_data()
+  {
+    MICROSCOPES_DCHECK(impl_.get(), "nullptr impl");
+    data_raw_.reserve(data_.size());
+    for (auto &p : data_) {
+      MICROSCOPES_DCHECK(p.get(), "nullptr dataview");
+      data_raw_.push_back(p.get());
+    }
+    impl_->assert_correct_shape(data_raw_);
+  }
+
+  std::shared_ptr<state<MaxRelationArity, Distribution>> impl_;
   size_t domain_;
   std::vector<std::shared_ptr<common::relation::dataview>> data_;
   std::vector<const common::relation::dataview *> data_raw_;
+  // domain_'s data, sliced out of data_ once, and possibly shared with the
+  // models of other chains
+  std::shared_ptr<const detail::entity_index> index_;
+  // the color classes of domain_'s entities, on first use
+  std::vector<std::vector<size_t>> colors_;
 };
 
+namespace detail {
+
+template <typename Distribution>
+static inline bool
+all_relations_accept(const model_definition &defn)
+{
+  for (const auto &r : defn.relations())
+    if (!group_ops<Distribution>::accepts(*r.model()))
+      return false;
+  return true;
+}
+
+template <ssize_t MaxRelationArity, typename Distribution>
+std::vector<std::shared_ptr<common::entity_based_state_object>>
+initialize_and_bind_as(
+    const model_definition &defn,
+    const std::vector<common::hyperparam_bag_t> &cluster_inits,
+    const std::vector<common::hyperparam_bag_t> &relation_inits,
+    const std::vector<std::vector<size_t>> &domain_assignments,
+    const std::vector<std::shared_ptr<common::relation::dataview>> &data,
+    common::rng_t &rng)
+{
+  typedef state<MaxRelationArity, Distribution> state_t;
+  dataset_t data_raw;
+  data_raw.reserve(data.size());
+  for (const auto &p : data)
+    data_raw.push_back(p.get());
+  const auto s = state_t::initialize(
+      defn, cluster_inits, relation_inits, domain_assignments, data_raw, rng);
+  std::vector<std::shared_ptr<common::entity_based_state_object>> ret;
+  ret.reserve(defn.domains().size());
+  for (size_t i = 0; i < defn.domains().size(); i++)
+    ret.emplace_back(
+        std::make_shared<model<MaxRelationArity, Distribution>>(s, i, data));
+  return ret;
+}
+
+} // namespace detail
+
+/**
+ * Initializes a state (see state::initialize()) and binds each of its
+ * domains, in order.
+ *
+ * If every relation uses the same distribution, and the state is
+ * specialized for it (currently BetaBernoulli and NormalInverseChiSq),
+ * the specialized state is used. Otherwise this falls back to the dynamic
+ * state<MaxRelationArity>
+ */
+template <ssize_t MaxRelationArity = -1>
+std::vector<std::shared_ptr<common::entity_based_state_object>>
+initialize_and_bind(
+    const model_definition &defn,
+    const std::vector<common::hyperparam_bag_t> &cluster_inits,
+    const std::vector<common::hyperparam_bag_t> &relation_inits,
+    const std::vector<std::vector<size_t>> &domain_assignments,
+    const std::vector<std::shared_ptr<common::relation::dataview>> &data,
+    common::rng_t &rng)
+{
+  using distributions::BetaBernoulli;
+  using distributions::NormalInverseChiSq;
+  if (detail::all_relations_accept<BetaBernoulli>(defn))
+    return detail::initialize_and_bind_as<MaxRelationArity, BetaBernoulli>(
+        defn, cluster_inits, relation_inits, domain_assignments, data, rng);
+  if (detail::all_relations_accept<NormalInverseChiSq>(defn))
+    return detail::initialize_and_bind_as<MaxRelationArity, NormalInverseChiSq>(
+        defn, cluster_inits, relation_inits, domain_assignments, data, rng);
+  return detail::initialize_and_bind_as<MaxRelationArity, void>(
+      defn, cluster_inits, relation_inits, domain_assignments, data, rng);
+}
+
+/**
+ * Binds every domain of each of states to the same data, for running them
+ * as independent chains (see multi_chain_runner). The states must share a
+ * definition. Each domain's entity index is built once and shared by the
+ * models of every chain, so N chains cost N copies of the suffstats but
+ * only one of the index (and none of the data).
+ *
+ * ret[i] are the models of states[i], in domain order
+ */
+template <ssize_t MaxRelationArity, typename Distribution>
+std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>>
+bind_chains(
+    const std::vector<std::shared_ptr<state<MaxRelationArity, Distribution>>> &states,
+    const std::vector<std::shared_ptr<common::relation::dataview>> &data)
+{
+  typedef model<MaxRelationArity, Distribution> model_t;
+  MICROSCOPES_DCHECK(states.size(), "no states given");
+  for (const auto &s : states)
+    MICROSCOPES_DCHECK(s.get(), "nullptr state");
+  const size_t ndomains = states.front()->ndomains();
+  for (const auto &s : states)
+    MICROSCOPES_CHECK(s->ndomains() == ndomains, "states differ in domains");
+  std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>>
+    ret(states.size());
+  for (size_t d = 0; d < ndomains; d++) {
+    const auto first = std::make_shared<model_t>(states.front(), d, data);
+    ret.front().push_back(first);
+    for (size_t i = 1; i < states.size(); i++)
+      ret[i].emplace_back(std::make_shared<model_t>(
+          states[i], d, data, first->shared_index()));
+  }
+  return ret;
+}
+
 // template instantiations
 extern template class state<-1>;
 extern template class state<2>;
@@ -979,6 +4160,27 @@ extern template class model<2>;
 extern template class model<3>;
 extern template class model<4>;
 
+// in model_bb.cpp and model_nich.cpp, which build alongside model.cpp
+extern template class state<-1, distributions::BetaBernoulli>;
+extern template class state<2, distributions::BetaBernoulli>;
+extern template class state<3, distributions::BetaBernoulli>;
+extern template class state<4, distributions::BetaBernoulli>;
+
+extern template class model<-1, distributions::BetaBernoulli>;
+extern template class model<2, distributions::BetaBernoulli>;
+extern template class model<3, distributions::BetaBernoulli>;
+extern template class model<4, distributions::BetaBernoulli>;
+
+extern template class state<-1, distributions::NormalInverseChiSq>;
+extern template class state<2, distributions::NormalInverseChiSq>;
+extern template class state<3, distributions::NormalInverseChiSq>;
+extern template class state<4, distributions::NormalInverseChiSq>;
+
+extern template class model<-1, distributions::NormalInverseChiSq>;
+extern template class model<2, distributions::NormalInverseChiSq>;
+extern template class model<3, distributions::NormalInverseChiSq>;
+extern template class model<4, distributions::NormalInverseChiSq>;
+
 // cythonic helpers, since cython's template system cannot handle template
 // <ssize_t>
 typedef state<-1> state_variadic;
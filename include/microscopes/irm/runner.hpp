@@ -0,0 +1,301 @@
+#pragma once
+
+#include <microscopes/common/entity_state.hpp>
+#include <microscopes/common/random_fwd.hpp>
+#include <microscopes/irm/thread_pool.hpp>
+#include <microscopes/irm/hogwild.hpp>
+#include <microscopes/irm/split_merge.hpp>
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * Runs a schedule of kernels over a state natively, one full sweep of the
+ * schedule per iteration. The schedule is built up by the add_*() calls, and
+ * its kernels run in the order they were added:
+ *
+ *   assign:            gibbs sampling of the assignments of a domain
+ *                      (conjugate relations only)
+ *   assign_resample:   gibbs sampling of the assignments of a domain
+ *                      against m fresh groups (Neal 2000, algorithm 8),
+ *                      for non-conjugate relations
+ *   chromatic_assign:  gibbs sampling of the assignments of a domain, in
+ *                      batches scored in parallel and corrected by a
+ *                      metropolis-hastings test (see
+ *                      state::chromatic_assign0())
+ *   hogwild_assign:    asynchronous, approximate gibbs sampling of the
+ *                      assignments of a domain (see state::hogwild_assign0())
+ *   split_merge:       split-merge proposals on the groups of a domain (see
+ *                      state::split_merge0())
+ *   slice_cluster_hp:  slice sampling of a domain's CRP hyperparameter
+ *   slice_relation_hp: slice sampling of a relation's hyperparameter
+ *
+ * Scratch space (score vectors, permutations) is owned by the runner and
+ * reused across entities and iterations. run() does not call back into
+ * any language binding, except through the log priors it was handed, so
+ * bindings can release their interpreter lock around it.
+ *
+ * An exception thrown by a log prior aborts run(): the hyperparameter being
+ * sampled is put back to its value before the update, and the exception is
+ * rethrown.
+ */
+class runner {
+public:
+  // see callback_log_prior()
+  class log_prior_error : public std::runtime_error {
+  public:
+    log_prior_error() : std::runtime_error("log prior failed") {}
+  };
+
+  // the (unnormalized) log prior density of a hyperparameter
+  typedef std::function<float(float)> log_prior_t;
+
+  // models[d] is the state bound to domain d (see model)
+  explicit runner(
+      const std::vector<std::shared_ptr<common::entity_based_state_object>> &models);
+
+  inline size_t nkernels() const { return kernels_.size(); }
+
+  void add_assign(size_t domain);
+
+  // m is the number of fresh groups each entity is scored against
+  void add_assign_resample(size_t domain, size_t m);
+
+  // the model of domain must be a chromatic_assignable. the kernel gets its
+  // own pool of nthreads threads
+  void add_chromatic_assign(size_t domain, size_t nthreads, size_t max_batch);
+
+  // the model of domain must be a hogwild_assignable. the kernel gets its
+  // own pool of nthreads threads
+  void add_hogwild_assign(size_t domain, size_t nthreads, size_t max_staleness);
+
+  // (domain, report) of each hogwild_assign kernel, in schedule order. the
+  // reports add up every sweep run so far
+  std::vector<std::pair<size_t, hogwild_report>> hogwild_reports() const;
+
+  // the model of domain must be split_mergeable
+  void add_split_merge(size_t domain, size_t nproposals, size_t nscans);
+
+  // (domain, report) of each split_merge kernel, in schedule order, over
+  // every run so far
+  std::vector<std::pair<size_t, split_merge_report>> split_merge_reports() const;
+
+  void add_slice_cluster_hp(size_t domain,
+                            const std::string &key,
+                            const log_prior_t &prior,
+                            float w);
+
+  void add_slice_relation_hp(size_t relation,
+                             const std::string &key,
+                             const log_prior_t &prior,
+                             float w);
+
+  void run(common::rng_t &rng, size_t niters);
+
+  // a log_prior_t which calls fn(ctx, x, &ret), for bindings which cannot
+  // construct a std::function themselves; ctx must outlive the runner. fn
+  // returns false if the prior failed (the binding keeps the reason), which
+  // aborts run() with a log_prior_error
+  static log_prior_t
+  callback_log_prior(bool (*fn)(void *, float, float *), void *ctx)
+  {
+    return [fn, ctx](float x) {
+      float ret;
+      if (!fn(ctx, x, &ret))
+        throw log_prior_error();
+      return ret;
+    };
+  }
+
+private:
+  enum kernel_type {
+    KERNEL_ASSIGN,
+    KERNEL_ASSIGN_RESAMPLE,
+    KERNEL_CHROMATIC_ASSIGN,
+    KERNEL_HOGWILD_ASSIGN,
+    KERNEL_SPLIT_MERGE,
+    KERNEL_SLICE_CLUSTER_HP,
+    KERNEL_SLICE_RELATION_HP,
+  };
+
+  struct kernel_t {
+    kernel_t(kernel_type type, size_t id)
+      : type_(type), id_(id), key_(), prior_(), w_(), m_(),
+        pool_(), max_batch_(), max_staleness_(), report_(),
+        nproposals_(), nscans_(), split_merge_report_() {}
+    kernel_type type_;
+    // a domain or a relation, depending on type_
+    size_t id_;
+    // slice kernels only
+    std::string key_;
+    log_prior_t prior_;
+    float w_;
+    // assign resample only
+    size_t m_;
+    // chromatic and hogwild assign only
+    std::shared_ptr<detail::thread_pool> pool_;
+    size_t max_batch_;
+    // hogwild assign only
+    size_t max_staleness_;
+    hogwild_report report_;
+    // split merge only
+    size_t nproposals_;
+    size_t nscans_;
+    split_merge_report split_merge_report_;
+  };
+
+  void assign(common::entity_based_state_object &m, common::rng_t &rng);
+  void assign_resample(common::entity_based_state_object &m,
+                       size_t nfresh,
+                       common::rng_t &rng);
+  void slice_cluster_hp(const kernel_t &k, common::rng_t &rng);
+  void slice_relation_hp(const kernel_t &k, common::rng_t &rng);
+
+  std::vector<std::shared_ptr<common::entity_based_state_object>> models_;
+  std::vector<kernel_t> kernels_;
+
+  // scratch
+  std::vector<size_t> perm_;
+  std::vector<size_t> fresh_;
+  std::pair<std::vector<size_t>, std::vector<float>> scores_;
+};
+
+/**
+ * Runs independent chains of one model over the same data, with one runner
+ * per chain and the chains spread over a pool of threads. The models of
+ * the chains should come from bind_chains(), so that they share the data
+ * and its entity indices: only the states are per chain.
+ *
+ * Every kernel is added to the schedule of every chain. Each chain draws
+ * from its own rng, seeded from the rng handed to run(), so a run is
+ * reproducible for a fixed number of threads or not. The log priors are
+ * called concurrently from the chains' threads.
+ */
+class multi_chain_runner {
+public:
+  // where a chain stands, for monitoring convergence without copying its
+  // state out
+  struct chain_summary {
+    chain_summary() : ngroups_(), score_assignment_(), score_likelihood_() {}
+    // per domain
+    std::vector<size_t> ngroups_;
+    // summed over the domains
+    float score_assignment_;
+    // summed over the relations
+    float score_likelihood_;
+  };
+
+  // chains[i][d] is the model of domain d of chain i
+  multi_chain_runner(
+      const std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>> &chains,
+      size_t nthreads);
+
+  inline size_t nchains() const { return runners_.size(); }
+
+  void add_assign(size_t domain);
+
+  void add_split_merge(size_t domain, size_t nproposals, size_t nscans);
+
+  void add_slice_cluster_hp(size_t domain,
+                            const std::string &key,
+                            const runner::log_prior_t &prior,
+                            float w);
+
+  void add_slice_relation_hp(size_t relation,
+                             const std::string &key,
+                             const runner::log_prior_t &prior,
+                             float w);
+
+  // niters iterations of every chain
+  void run(common::rng_t &rng, size_t niters);
+
+  std::vector<chain_summary> summaries(common::rng_t &rng);
+
+private:
+  // seeds_[i] for chain i, drawn from rng
+  void reseed(common::rng_t &rng);
+
+  std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>> chains_;
+  std::vector<runner> runners_;
+  detail::thread_pool pool_;
+  std::vector<unsigned long> seeds_;
+};
+
+/**
+ * Replica exchange (parallel tempering): one replica of the model per
+ * temperature of a ladder, each sampled by its own runner (see
+ * multi_chain_runner), with swaps of temperatures proposed between
+ * neighboring rungs every so many iterations. A replica at inverse
+ * temperature beta targets prior * likelihood^beta (see
+ * state::set_inverse_temperature()); the one at beta = 1 is the posterior.
+ *
+ * Swaps alternate between the even and the odd pairs of rungs, and the
+ * pair (k, k + 1) swaps with probability
+ *
+ *   min(1, exp((beta_k - beta_k+1) * (L_k+1 - L_k)))
+ *
+ * where L is the untempered log likelihood of the replica on each rung.
+ * Only the temperatures move: the replicas keep their states.
+ */
+class tempering_runner {
+public:
+  // chains[i][d] is the model of domain d of replica i, and must be
+  // temperable. betas is the ladder, decreasing from betas[0] = 1, with one
+  // rung per replica
+  tempering_runner(
+      const std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>> &chains,
+      const std::vector<float> &betas,
+      size_t nthreads);
+
+  inline size_t nreplicas() const { return chains_.size(); }
+  inline const std::vector<float> & betas() const { return betas_; }
+
+  // the replica currently on rung k; replica(0) samples the posterior
+  inline size_t replica(size_t k) const { return replicas_[k]; }
+
+  void add_assign(size_t domain);
+
+  void add_split_merge(size_t domain, size_t nproposals, size_t nscans);
+
+  void add_slice_cluster_hp(size_t domain,
+                            const std::string &key,
+                            const runner::log_prior_t &prior,
+                            float w);
+
+  void add_slice_relation_hp(size_t relation,
+                             const std::string &key,
+                             const runner::log_prior_t &prior,
+                             float w);
+
+  // niters iterations of every replica, proposing swaps after every
+  // swap_every of them
+  void run(common::rng_t &rng, size_t niters, size_t swap_every);
+
+  // per pair of rungs (k, k + 1), over every run so far
+  inline const std::vector<size_t> & swap_attempts() const { return attempts_; }
+  inline const std::vector<size_t> & swap_accepts() const { return accepts_; }
+  std::vector<float> swap_rates() const;
+
+private:
+  void propose_swaps(common::rng_t &rng);
+  void set_rung(size_t replica, size_t k);
+
+  std::vector<std::vector<std::shared_ptr<common::entity_based_state_object>>> chains_;
+  std::vector<float> betas_;
+  multi_chain_runner runner_;
+  std::vector<size_t> replicas_;
+  std::vector<size_t> attempts_;
+  std::vector<size_t> accepts_;
+  // the parity of the next pairs to propose
+  size_t parity_;
+};
+
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <microscopes/irm/model.hpp>
+#include <microscopes/irm/transport.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+
+namespace detail {
+
+template <typename T>
+static inline void
+delta_put(std::string &buf, T v)
+{
+  buf.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename T>
+static inline T
+delta_take(const char *&p)
+{
+  T v;
+  std::memcpy(&v, p, sizeof(v));
+  p += sizeof(v);
+  return v;
+}
+
+} // namespace detail
+
+/**
+ * One rank of a run whose domain's entities are sharded across processes,
+ * for data which does not fit on a single host.
+ *
+ * Every rank holds a full replica of the state (the assignments of every
+ * domain, and the suffstats of every block), but only indexes the data of
+ * its own shard of the domain: the dataviews it is built from only need
+ * the cells touching those entities. A sweep is plain gibbs over the shard
+ * against the replica, and every sync_every entities the ranks exchange
+ * the moves they made, each move carrying the cells of the entity, so that
+ * the other replicas can apply it to their blocks without the entity's
+ * data. Between syncs a rank does not see the other ranks' moves, which is
+ * an approximation (see state::hogwild_assign0() for the threaded
+ * equivalent).
+ *
+ * Group ids are local to a replica. A group is named across ranks by the
+ * id it had when the replicas were created (see replicate()), or by its
+ * creator's rank and local id.
+ *
+ * The domain must appear at most once in every relation (so that a cell is
+ * owned by exactly one shard), and every relation it appears in must be
+ * conjugate. The other domains are left untouched.
+ *
+ * Message format (all integers in host order, so every rank must share the
+ * same architecture):
+ *
+ *   u64 nmoves, then for each move
+ *     u64 eid, u64 name of the new group, u64 ncells, then for each cell
+ *       u32 relation, u64 eids[arity], the raw value
+ */
+template <ssize_t MaxRelationArity = -1, typename Distribution = void>
+class sharded_worker {
+public:
+  typedef state<MaxRelationArity, Distribution> state_t;
+
+  // collective: every rank gets a copy of rank 0's impl (which is ignored on
+  // the other ranks), through state::serialize(). the copies draw the
+  // groups of non-conjugate relations from rng
+  static std::shared_ptr<state_t>
+  replicate(const model_definition &defn,
+            const std::shared_ptr<state_t> &impl,
+            transport &t,
+            common::rng_t &rng)
+  {
+    if (!t.rank())
+      MICROSCOPES_DCHECK(impl.get(), "nullptr impl");
+    const auto msgs = t.allgather(t.rank() ? std::string() : impl->serialize());
+    return t.rank() ? state_t::deserialize(defn, msgs[0], rng) : impl;
+  }
+
+  // collective. eids is this rank's shard of domain, and data only has to
+  // hold the cells which touch it
+  sharded_worker(const std::shared_ptr<state_t> &impl,
+                 size_t domain,
+                 const std::vector<size_t> &eids,
+                 const dataset_t &data,
+                 transport &t)
+    : impl_(impl), domain_(domain), eids_(eids), data_(data), transport_(t),
+      index_(), to_local_(), to_name_(), max_shard_(), scores_()
+  {
+    MICROSCOPES_DCHECK(impl.get(), "nullptr impl");
+    MICROSCOPES_DCHECK(domain < impl->ndomains(), "invalid domain");
+    MICROSCOPES_DCHECK(data.size() == impl->nrelations(), "one dataview per relation");
+    for (const auto &r : impl_->relations_) {
+      const auto &doms = r.desc_.domains();
+      const auto n = std::count(doms.begin(), doms.end(), domain);
+      MICROSCOPES_CHECK(n <= 1,
+          "a sharded domain must appear at most once in every relation");
+      MICROSCOPES_CHECK(!n || r.desc_.conjugate(),
+          "a sharded domain requires conjugate relations");
+    }
+    std::sort(eids_.begin(), eids_.end());
+    for (auto eid : eids_)
+      MICROSCOPES_DCHECK(eid < impl->nentities(domain), "invalid eid");
+    index_ = impl_->build_entity_index(domain_, data_, eids_);
+
+    for (const auto &g : impl_->domains_[domain_]) {
+      MICROSCOPES_CHECK(g.first < (uint64_t(1) << NameBits), "gid too large");
+      to_local_[g.first] = g.first;
+      to_name_[g.first] = g.first;
+    }
+
+    // every rank syncs as many times as the largest shard needs
+    std::string msg;
+    detail::delta_put<uint64_t>(msg, eids_.size());
+    for (const auto &m : transport_.allgather(msg)) {
+      const char *p = m.data();
+      max_shard_ = std::max<size_t>(max_shard_, detail::delta_take<uint64_t>(p));
+    }
+  }
+
+  inline const std::shared_ptr<state_t> & get_state() const { return impl_; }
+  inline const std::vector<size_t> & shard() const { return eids_; }
+
+  // collective: one sweep over the shard, syncing every sync_every entities
+  void
+  sweep(size_t sync_every, common::rng_t &rng)
+  {
+    MICROSCOPES_DCHECK(sync_every >= 1, "sync_every must be positive");
+    state_t &s = *impl_;
+    for (auto g : std::vector<size_t>(
+          s.empty_groups(domain_).begin(), s.empty_groups(domain_).end())) {
+      s.delete_group(domain_, g);
+      unmap(g);
+    }
+
+    std::vector<size_t> order(eids_);
+    std::shuffle(order.begin(), order.end(), rng);
+    const size_t nsyncs = (max_shard_ + sync_every - 1) / sync_every;
+    std::string out;
+    for (size_t i = 0; i < nsyncs; i++) {
+      const size_t begin = std::min(i * sync_every, order.size());
+      const size_t end = std::min(begin + sync_every, order.size());
+      out.clear();
+      detail::delta_put<uint64_t>(out, 0);
+      uint64_t nmoves = 0;
+      for (size_t j = begin; j < end; j++)
+        nmoves += step(order[j], out, rng);
+      std::memcpy(&out[0], &nmoves, sizeof(nmoves));
+
+      const auto msgs = transport_.allgather(out);
+      for (size_t r = 0; r < msgs.size(); r++)
+        if (r != transport_.rank())
+          apply(msgs[r], rng);
+    }
+  }
+
+private:
+  // names of the groups created after replicate() have their creator's rank
+  // (plus one) above this many bits
+  static const size_t NameBits = 40;
+
+  void
+  unmap(size_t gid)
+  {
+    auto it = to_name_.find(gid);
+    if (it == to_name_.end())
+      return;
+    to_local_.erase(it->second);
+    to_name_.erase(it);
+  }
+
+  uint64_t
+  name_of(size_t gid)
+  {
+    auto it = to_name_.find(gid);
+    if (it != to_name_.end())
+      return it->second;
+    MICROSCOPES_CHECK(gid < (uint64_t(1) << NameBits), "gid too large");
+    const uint64_t name = (uint64_t(transport_.rank() + 1) << NameBits) | gid;
+    to_name_[gid] = name;
+    to_local_[name] = gid;
+    return name;
+  }
+
+  // a gibbs step for eid, appending the move (if any) to out
+  bool
+  step(size_t eid, std::string &out, common::rng_t &rng)
+  {
+    const auto move = impl_->gibbs_step0(scores_, domain_, eid, index_, rng,
+        [this](size_t gid) { this->unmap(gid); });
+    if (move.second == move.first)
+      return false;
+
+    detail::delta_put<uint64_t>(out, eid);
+    detail::delta_put<uint64_t>(out, name_of(move.second));
+    const size_t ncells = out.size();
+    detail::delta_put<uint64_t>(out, 0);
+    uint64_t n = 0;
+    index_.for_each(eid,
+      [this, &out, &n](
+        size_t rid,
+        const size_t *eids,
+        const common::value_accessor &value)
+      {
+        detail::delta_put<uint32_t>(out, rid);
+        for (size_t i = 0; i < this->impl_->relations_[rid].desc_.arity(); i++)
+          detail::delta_put<uint64_t>(out, eids[i]);
+        out.append(reinterpret_cast<const char *>(value.data()),
+                   this->data_[rid]->type().size());
+        n++;
+      });
+    std::memcpy(&out[ncells], &n, sizeof(n));
+    return true;
+  }
+
+  // the cells of a move, starting at p. f(rid, eids, value) for each
+  template <typename F>
+  const char *
+  for_each_cell(const char *p, size_t ncells, F f) const
+  {
+    std::vector<size_t> eids;
+    for (size_t i = 0; i < ncells; i++) {
+      const size_t rid = detail::delta_take<uint32_t>(p);
+      MICROSCOPES_DCHECK(rid < impl_->relations_.size(), "invalid relation");
+      eids.resize(impl_->relations_[rid].desc_.arity());
+      for (auto &eid : eids)
+        eid = detail::delta_take<uint64_t>(p);
+      const auto &type = data_[rid]->type();
+      f(rid, eids.data(),
+        common::value_accessor(reinterpret_cast<const uint8_t *>(p), nullptr, type));
+      p += type.size();
+    }
+    return p;
+  }
+
+  // replays another rank's moves on the replica
+  void
+  apply(const std::string &msg, common::rng_t &rng)
+  {
+    state_t &s = *impl_;
+    auto &domain = s.domains_[domain_];
+    typename state_t::tuple_t gids;
+    const char *p = msg.data();
+    const uint64_t nmoves = detail::delta_take<uint64_t>(p);
+    for (uint64_t i = 0; i < nmoves; i++) {
+      const size_t eid = detail::delta_take<uint64_t>(p);
+      const uint64_t name = detail::delta_take<uint64_t>(p);
+      const size_t ncells = detail::delta_take<uint64_t>(p);
+      MICROSCOPES_DCHECK(eid < domain.nentities(), "invalid eid");
+
+      for_each_cell(p, ncells,
+        [&s, &gids, &rng](size_t rid, const size_t *eids,
+                          const common::value_accessor &value)
+        {
+          auto &relation = s.relations_[rid];
+          s.eids_to_gids_under_relation(gids, eids, relation.desc_);
+          s.remove_value_from_feature_group(gids, value, relation, rng);
+        });
+      const size_t old = s.domain_remove_value(domain_, eid);
+      if (!domain.groupsize(old)) {
+        s.delete_group(domain_, old);
+        unmap(old);
+      }
+
+      auto it = to_local_.find(name);
+      size_t gid;
+      if (it == to_local_.end()) {
+        gid = s.create_group(domain_);
+        to_local_[name] = gid;
+        to_name_[gid] = name;
+      } else {
+        gid = it->second;
+      }
+      s.domain_add_value(domain_, gid, eid);
+      p = for_each_cell(p, ncells,
+        [&s, &gids, &rng](size_t rid, const size_t *eids,
+                          const common::value_accessor &value)
+        {
+          auto &relation = s.relations_[rid];
+          s.eids_to_gids_under_relation(gids, eids, relation.desc_);
+          s.add_value_to_feature_group(gids, value, relation, rng);
+        });
+    }
+    MICROSCOPES_DCHECK(p == msg.data() + msg.size(), "malformed message");
+  }
+
+  typedef detail::flat_hash_map<
+    uint64_t,
+    size_t,
+    detail::integer_hash<uint64_t>> name_map_t;
+  typedef detail::flat_hash_map<
+    size_t,
+    uint64_t,
+    detail::integer_hash<size_t>> gid_map_t;
+
+  std::shared_ptr<state_t> impl_;
+  size_t domain_;
+  // this rank's shard, sorted
+  std::vector<size_t> eids_;
+  dataset_t data_;
+  transport &transport_;
+  // the data of eids_ only
+  detail::entity_index index_;
+  // group names to the replica's gids, and back
+  name_map_t to_local_;
+  gid_map_t to_name_;
+  size_t max_shard_;
+
+  // scratch
+  std::pair<std::vector<size_t>, std::vector<float>> scores_;
+};
+
+template <ssize_t MaxRelationArity, typename Distribution>
+const size_t sharded_worker<MaxRelationArity, Distribution>::NameBits;
+
+} // namespace irm
+} // namespace microscopes
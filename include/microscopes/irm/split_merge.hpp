@@ -0,0 +1,46 @@
+#pragma once
+
+#include <microscopes/common/random_fwd.hpp>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * The proposals made by state::split_merge0(), and how many of them were
+ * accepted
+ */
+struct split_merge_report {
+  split_merge_report()
+    : nsplits_(), nsplits_accepted_(), nmerges_(), nmerges_accepted_() {}
+
+  inline void
+  merge(const split_merge_report &that)
+  {
+    nsplits_ += that.nsplits_;
+    nsplits_accepted_ += that.nsplits_accepted_;
+    nmerges_ += that.nmerges_;
+    nmerges_accepted_ += that.nmerges_accepted_;
+  }
+
+  size_t nsplits_;
+  size_t nsplits_accepted_;
+  size_t nmerges_;
+  size_t nmerges_accepted_;
+};
+
+/**
+ * A bound domain which supports the split-merge moves of
+ * state::split_merge0()
+ */
+class split_mergeable {
+public:
+  virtual ~split_mergeable() {}
+
+  // nproposals split-merge proposals over the domain, each launched with
+  // nscans restricted gibbs scans
+  virtual split_merge_report split_merge(
+      size_t nproposals, size_t nscans, common::rng_t &rng) = 0;
+};
+
+} // namespace irm
+} // namespace microscopes
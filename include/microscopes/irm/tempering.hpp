@@ -0,0 +1,20 @@
+#pragma once
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * A bound domain whose state can be tempered (see
+ * state::set_inverse_temperature()). The models of one state share its
+ * temperature
+ */
+class temperable {
+public:
+  virtual ~temperable() {}
+
+  virtual void set_inverse_temperature(float beta) = 0;
+  virtual float inverse_temperature() const = 0;
+};
+
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <microscopes/common/assert.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+namespace detail {
+
+/**
+ * A fixed set of threads to fan a loop out over. The calling thread takes
+ * part in the work, so a pool of size() n starts n - 1 threads.
+ *
+ * parallel_for() must not be called concurrently, nor from within a job.
+ */
+class thread_pool {
+public:
+  explicit thread_pool(size_t nthreads)
+    : threads_(), mutex_(), work_(), done_(),
+      stop_(false), generation_(0), job_(nullptr), njobs_(0), next_(0),
+      pending_(0), error_()
+  {
+    MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+    for (size_t i = 1; i < nthreads; i++)
+      threads_.emplace_back([this]() { this->work(); });
+  }
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    work_.notify_all();
+    for (auto &t : threads_)
+      t.join();
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  inline size_t size() const { return threads_.size() + 1; }
+
+  // splits [0, n) into at most size() contiguous chunks, and calls
+  // f(size_t chunk, size_t begin, size_t end) for each of them concurrently.
+  // chunk is in [0, size()), and is distinct among the calls of one
+  // parallel_for(), so it can index per-thread scratch space. the first
+  // exception thrown by f is rethrown once every chunk is done
+  template <typename F>
+  void
+  parallel_for(size_t n, F f)
+  {
+    if (!n)
+      return;
+    const size_t nchunks = std::min(n, size());
+    if (nchunks == 1) {
+      f(0, 0, n);
+      return;
+    }
+    const std::function<void(size_t)> job = [n, nchunks, &f](size_t chunk) {
+      f(chunk, n * chunk / nchunks, n * (chunk + 1) / nchunks);
+    };
+    run(job, nchunks);
+  }
+
+private:
+  void
+  run(const std::function<void(size_t)> &job, size_t njobs)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      njobs_ = njobs;
+      next_ = 1;
+      pending_ = njobs;
+      error_ = std::exception_ptr();
+      generation_++;
+    }
+    work_.notify_all();
+    // the caller always takes chunk 0
+    execute(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return !this->pending_; });
+    job_ = nullptr;
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+
+  // runs one chunk of the current job, without holding mutex_
+  void
+  execute(size_t chunk)
+  {
+    std::exception_ptr error;
+    try {
+      (*job_)(chunk);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error && !error_)
+      error_ = error;
+    if (!--pending_)
+      done_.notify_one();
+  }
+
+  void
+  work()
+  {
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      work_.wait(lock, [this, &seen]() {
+        return this->stop_ || this->generation_ != seen;
+      });
+      if (stop_)
+        return;
+      seen = generation_;
+      while (next_ < njobs_) {
+        const size_t chunk = next_++;
+        lock.unlock();
+        execute(chunk);
+        lock.lock();
+      }
+    }
+  }
+
+  std::vector<std::thread> threads_;
+
+  // guards everything below
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable done_;
+  bool stop_;
+  size_t generation_;
+  const std::function<void(size_t)> *job_;
+  size_t njobs_;
+  // the next chunk to hand out
+  size_t next_;
+  // chunks not done yet
+  size_t pending_;
+  std::exception_ptr error_;
+};
+
+} // namespace detail
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace microscopes {
+namespace irm {
+
+/**
+ * How the workers of a sharded run (see sharded_worker) talk to each
+ * other. Messages are opaque byte strings.
+ */
+class transport {
+public:
+  virtual ~transport() {}
+
+  virtual size_t rank() const = 0;
+  virtual size_t size() const = 0;
+
+  // collective: every rank passes its message, and gets back the messages
+  // of every rank (its own included), indexed by rank
+  virtual std::vector<std::string> allgather(const std::string &msg) = 0;
+};
+
+/**
+ * A transport over unix domain sockets, for workers on a single host. Rank
+ * 0 listens on path, and relays every message to the other ranks, which
+ * connect to it.
+ *
+ * The constructor blocks until every rank is connected. path must not be in
+ * use, and is removed by rank 0 when it goes away.
+ */
+class unix_socket_transport : public transport {
+public:
+  unix_socket_transport(const std::string &path, size_t rank, size_t size);
+  ~unix_socket_transport();
+
+  unix_socket_transport(const unix_socket_transport &) = delete;
+  unix_socket_transport &operator=(const unix_socket_transport &) = delete;
+
+  size_t rank() const override { return rank_; }
+  size_t size() const override { return size_; }
+
+  std::vector<std::string> allgather(const std::string &msg) override;
+
+private:
+  // the connections of rank 0, and of every other rank
+  void accept_peers();
+  void connect_root();
+  // closes every socket, and removes the path if rank 0 bound it
+  void close_all();
+
+  std::string path_;
+  size_t rank_;
+  size_t size_;
+  int listen_fd_;
+  // rank 0: the socket of every other rank (-1 for itself). others: the
+  // socket of rank 0
+  std::vector<int> peers_;
+};
+
+} // namespace irm
+} // namespace microscopes
@@ -1,5 +1,6 @@
 # cython imports
 from libcpp.vector cimport vector
+from libcpp.utility cimport pair
 from libcpp.set cimport set
 from libc.stddef cimport size_t
 from libcpp cimport bool as cbool
@@ -17,13 +18,42 @@ from microscopes.common._entity_state_h cimport \
 from microscopes.common._entity_state cimport \
     entity_based_state_object
 from microscopes.common._rng cimport rng
+from microscopes.common._random_fwd_h cimport rng_t
 from microscopes.irm._model_h cimport \
     state_max4 as c_state, \
     model_max4 as c_model, \
     initialize as c_initialize, \
-    deserialize as c_deserialize
+    deserialize as c_deserialize, \
+    load_checkpoint as c_load_checkpoint, \
+    bind_chains as c_bind_chains, \
+    runner as c_runner, \
+    multi_chain_runner as c_multi_chain_runner, \
+    chain_summary as c_chain_summary, \
+    tempering_runner as c_tempering_runner, \
+    hogwild_report as c_hogwild_report, \
+    split_merge_report as c_split_merge_report, \
+    state_counters as c_state_counters, \
+    callback_log_prior as c_callback_log_prior
 from microscopes.irm.definition cimport model_definition
 
 cdef class state:
     cdef shared_ptr[c_state] _thisptr
     cdef public model_definition _defn
+
+cdef class native_runner:
+    cdef shared_ptr[c_runner] _thisptr
+    cdef size_t _ndomains
+    # the models and priors the C++ runner points to
+    cdef list _refs
+
+cdef class native_multi_chain_runner:
+    cdef shared_ptr[c_multi_chain_runner] _thisptr
+    cdef size_t _ndomains
+    # the states, views and priors the C++ runner points to
+    cdef list _refs
+
+cdef class native_tempering_runner:
+    cdef shared_ptr[c_tempering_runner] _thisptr
+    cdef size_t _ndomains
+    # the states, views and priors the C++ runner points to
+    cdef list _refs
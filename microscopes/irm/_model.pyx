@@ -3,6 +3,8 @@
 
 # python imports
 import copy
+import sys
+import warnings
 
 from microscopes.common._rng import rng
 from microscopes.common.relation._dataview import abstract_dataview
@@ -41,13 +43,15 @@ cdef class state:
         self._defn = defn
 
         # note: python cannot overload __cinit__(), so we
-        # use kwargs to handle both the random initialization case and
-        # the deserialize from string case
-        if not (('data' in kwargs) ^ ('bytes' in kwargs)):
-            raise ValueError("need exaclty one of `data' or `bytes'")
-
-        valid_kwargs = ('data', 'bytes', 'r',
-                        'cluster_hps', 'relation_hps', 'domain_assignments',)
+        # use kwargs to handle the random initialization case, the
+        # deserialize from string case and the load from checkpoint case
+        if sum(k in kwargs for k in ('data', 'bytes', 'checkpoint')) != 1:
+            raise ValueError(
+                "need exaclty one of `data', `bytes' or `checkpoint'")
+
+        valid_kwargs = ('data', 'bytes', 'checkpoint', 'r',
+                        'cluster_hps', 'relation_hps', 'domain_assignments',
+                        'nthreads',)
         validator.validate_kwargs(kwargs, valid_kwargs)
 
         cdef vector[hyperparam_bag_t] c_cluster_hps
@@ -120,19 +124,44 @@ cdef class state:
             else:
                 c_domain_assignments.resize(len(defn.domains()))
 
+            nthreads = kwargs.get('nthreads', 1)
+            validator.validate_positive(nthreads, "nthreads")
+
             self._thisptr = c_initialize(
                 defn._thisptr.get()[0],
                 c_cluster_hps,
                 c_relation_hps,
                 c_domain_assignments,
                 get_crelations_raw(data),
-                (<rng>r)._thisptr[0])
+                (<rng>r)._thisptr[0],
+                nthreads)
 
         else:
-            # handle the deserialize case
-            self._thisptr = c_deserialize(
-                defn._thisptr.get()[0],
-                kwargs['bytes'])
+            # handle the deserialize (or load from checkpoint) case
+            validator.validate_kwargs(
+                kwargs, ('bytes', 'checkpoint', 'r', 'nthreads'))
+            if 'r' in kwargs:
+                r = kwargs['r']
+                validator.validate_type(r, rng, "r")
+            else:
+                warnings.warn(
+                    "restoring a state without an rng is deprecated, pass r",
+                    DeprecationWarning, stacklevel=3)
+                r = rng()
+            nthreads = kwargs.get('nthreads', 1)
+            validator.validate_positive(nthreads, "nthreads")
+            if 'bytes' in kwargs:
+                self._thisptr = c_deserialize(
+                    defn._thisptr.get()[0],
+                    kwargs['bytes'],
+                    (<rng>r)._thisptr[0],
+                    nthreads)
+            else:
+                self._thisptr = c_load_checkpoint(
+                    defn._thisptr.get()[0],
+                    kwargs['checkpoint'],
+                    (<rng>r)._thisptr[0],
+                    nthreads)
 
         if self._thisptr.get() == NULL:
             raise RuntimeError("could not properly construct state")
@@ -231,6 +260,55 @@ cdef class state:
         else:
             return desc.group_bytes_to_dict(raw)
 
+    def set_dense_suffstats(self, int relation, cbool dense):
+        """Switch the suffstat storage of a relation between the default
+        sparse hash table and a dense block tensor indexed by group ids.
+
+        Dense storage makes every suffstat lookup O(1) index arithmetic, but
+        needs memory proportional to the product of the number of groups of
+        the relation's domains, so it is only sensible for low arity
+        relations whose domains have a modest number of groups.
+
+        """
+        self._validate_rid(relation, "relation")
+        self._thisptr.get().set_dense_suffstats(relation, dense)
+
+    def dense_suffstats(self, int relation):
+        self._validate_rid(relation, "relation")
+        return self._thisptr.get().dense_suffstats(relation)
+
+    def set_score_threads(self, int nthreads):
+        """Score the candidate groups of an entity over `nthreads` threads
+        (the calling thread included). 1, the default, scores them serially.
+
+        This only pays off for domains with many groups, whose entities carry
+        a lot of data. Like the storage of the relations, the setting is kept
+        by copies, pickles and checkpoints, but not by :meth:`serialize`.
+
+        """
+        validator.validate_positive(nthreads, "nthreads")
+        self._thisptr.get().set_score_threads(nthreads)
+
+    def score_threads(self):
+        return self._thisptr.get().score_threads()
+
+    def set_relation_threads(self, int nthreads):
+        """Spread the relations a domain takes part in over `nthreads`
+        threads (the calling thread included) when adding, removing and
+        scoring its entities. 1, the default, walks them serially.
+
+        This pays off for domains which take part in many relations. It
+        takes precedence over :meth:`set_score_threads`. Like the storage of
+        the relations, the setting is kept by copies, pickles and
+        checkpoints, but not by :meth:`serialize`.
+
+        """
+        validator.validate_positive(nthreads, "nthreads")
+        self._thisptr.get().set_relation_threads(nthreads)
+
+    def relation_threads(self):
+        return self._thisptr.get().relation_threads()
+
     def score_assignment(self, int domain):
         self._validate_did(domain, "domain")
         return self._thisptr.get().score_assignment(domain)
@@ -239,6 +317,51 @@ cdef class state:
         validator.validate_not_none(r)
         return self._thisptr.get().score_likelihood(r._thisptr[0])
 
+    def score_joint(self, rng r):
+        """``score_assignment()`` summed over the domains plus
+        ``score_likelihood()``, kept up to date as the state changes instead
+        of recomputed, so it is cheap enough to log every iteration.
+        """
+        validator.validate_not_none(r)
+        return self._thisptr.get().score_joint(r._thisptr[0])
+
+    def counters(self):
+        """Where the sampling time of the state went so far, as a dict: the
+        number of entities and candidate groups scored per domain, and per
+        relation the suffstat lookups (and hits), blocks created and erased,
+        cells visited and the nanoseconds spent visiting them.
+
+        Only counted when the extension was built with
+        ``MICROSCOPES_IRM_COUNTERS`` defined; otherwise ``enabled`` is False
+        and every count is zero.
+
+        """
+        cdef c_state_counters c = self._thisptr.get().counters()
+        domains = []
+        for i in xrange(c.domains_.size()):
+            domains.append({
+                'entities_scored': c.domains_[i].entities_scored_,
+                'candidates_scored': c.domains_[i].candidates_scored_,
+            })
+        relations = []
+        for i in xrange(c.relations_.size()):
+            relations.append({
+                'suffstats_lookups': c.relations_[i].suffstats_lookups_,
+                'suffstats_hits': c.relations_[i].suffstats_hits_,
+                'blocks_created': c.relations_[i].blocks_created_,
+                'blocks_erased': c.relations_[i].blocks_erased_,
+                'observations': c.relations_[i].observations_,
+                'iterate_ns': c.relations_[i].iterate_ns_,
+            })
+        return {
+            'enabled': c.enabled_,
+            'domains': domains,
+            'relations': relations,
+        }
+
+    def reset_counters(self):
+        self._thisptr.get().reset_counters()
+
     # XXX(stephentu): this is used for debugging and should be removed
     def entity_data_positions(self, int domain, int eid, relations):
         self._validate_eid(domain, eid)
@@ -251,15 +374,48 @@ cdef class state:
     def serialize(self):
         return self._thisptr.get().serialize()
 
+    def save_checkpoint(self, path):
+        """Write the state to `path` in a flat binary format, which
+        :func:`load_checkpoint` maps back in. Unlike :meth:`serialize`, the
+        state is written as it goes, without a copy of it in memory, so this
+        is the way to save large states. `path` is only replaced once the
+        write is complete.
+
+        The groups of each domain are renumbered from 0, in order, in the
+        restored state, which keeps the storage of the relations and the
+        thread settings. The format is not portable across byte orders.
+
+        """
+        self._thisptr.get().save_checkpoint(path)
+
+    def _settings(self):
+        # what serialize() leaves out: the relations with dense storage, and
+        # the thread counts
+        dense = [rid for rid in xrange(self.nrelations())
+                 if self.dense_suffstats(rid)]
+        return (dense, self.score_threads(), self.relation_threads())
+
+    def _apply_settings(self, settings):
+        dense, score_threads, relation_threads = settings
+        for rid in dense:
+            self.set_dense_suffstats(rid, True)
+        self.set_score_threads(score_threads)
+        self.set_relation_threads(relation_threads)
+
     def __reduce__(self):
-        return (_reconstruct_state, (self._defn, self.serialize()))
+        return (_reconstruct_state,
+                (self._defn, self.serialize(), self._settings()))
 
     def __copy__(self):
-        return state(self._defn, bytes=self.serialize())
+        ret = state(self._defn, bytes=self.serialize(), r=rng())
+        ret._apply_settings(self._settings())
+        return ret
 
     def __deepcopy__(self, memo):
         defn = copy.deepcopy(self._defn, memo)
-        return state(defn, bytes=self.serialize())
+        ret = state(defn, bytes=self.serialize(), r=rng())
+        ret._apply_settings(self._settings())
+        return ret
 
     # XXX(stephentu): expose more methods
 
@@ -276,6 +432,359 @@ def bind(state s, int domain, relations):
     return ret
 
 
+class _log_prior(object):
+    """A hyperprior handed to a native runner. The first exception it raises
+    is kept, and the run it aborts reraises it (see _reraise_log_prior())"""
+
+    def __init__(self, fn):
+        self.fn = fn
+        self.exc_info = None
+
+
+cdef cbool _call_log_prior(void *ctx, float x, float *ret) with gil:
+    prior = <object>ctx
+    try:
+        ret[0] = prior.fn(x)
+        return True
+    except:
+        # chains can fail concurrently, so the first failure is kept
+        if prior.exc_info is None:
+            prior.exc_info = sys.exc_info()
+        return False
+
+
+def _reraise_log_prior(refs):
+    """Reraises the exception of the log prior among refs which aborted a
+    run, if any, and forgets about every failure"""
+    exc_info = None
+    for ref in refs:
+        if isinstance(ref, _log_prior) and ref.exc_info is not None:
+            exc_info = exc_info or ref.exc_info
+            ref.exc_info = None
+    if exc_info is not None:
+        raise exc_info[0], exc_info[1], exc_info[2]
+
+
+cdef class native_runner:
+    """Runs a schedule of kernels over a state natively (see the C++
+    ``microscopes::irm::runner``), in the order they were added.
+
+    :meth:`run` releases the GIL. Hyperpriors are python callables, so the
+    slice kernels briefly reacquire it to evaluate them. An exception raised
+    by a hyperprior aborts the run, and :meth:`run` raises it.
+
+    Parameters
+    ----------
+    models : list
+        The state bound to each of its domains, in order (see :func:`bind`).
+
+    """
+
+    def __cinit__(self, models):
+        models = list(models)
+        validator.validate_nonempty(models, "models")
+        cdef vector[shared_ptr[c_entity_based_state_object]] cmodels
+        for m in models:
+            validator.validate_type(m, entity_based_state_object)
+            cmodels.push_back((<entity_based_state_object>m)._thisptr)
+        self._thisptr.reset(new c_runner(cmodels))
+        self._ndomains = len(models)
+        self._refs = models
+
+    def nkernels(self):
+        return self._thisptr.get().nkernels()
+
+    def add_assign(self, int domain):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        self._thisptr.get().add_assign(domain)
+
+    def add_assign_resample(self, int domain, int m):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(m, "m")
+        self._thisptr.get().add_assign_resample(domain, m)
+
+    def add_chromatic_assign(self, int domain, int nthreads, int max_batch):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(nthreads, "nthreads")
+        validator.validate_positive(max_batch, "max_batch")
+        self._thisptr.get().add_chromatic_assign(domain, nthreads, max_batch)
+
+    def add_hogwild_assign(self, int domain, int nthreads, int max_staleness):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(nthreads, "nthreads")
+        validator.validate_positive(max_staleness, "max_staleness")
+        self._thisptr.get().add_hogwild_assign(domain, nthreads, max_staleness)
+
+    def hogwild_reports(self):
+        """The drift of each hogwild_assign kernel so far, in the order they
+        were added, as ``(domain, report)`` tuples. A report has the number
+        of syncs and moves, and the mean and max number of moves of other
+        workers a worker had not seen when it synced.
+        """
+        cdef vector[pair[size_t, c_hogwild_report]] reports = \
+            self._thisptr.get().hogwild_reports()
+        ret = []
+        for i in xrange(reports.size()):
+            ret.append((reports[i].first, {
+                'nsyncs': reports[i].second.nsyncs_,
+                'nmoves': reports[i].second.nmoves_,
+                'mean_pending': reports[i].second.mean_pending(),
+                'max_pending': reports[i].second.max_pending_,
+            }))
+        return ret
+
+    def add_split_merge(self, int domain, int nproposals, int nscans):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(nproposals, "nproposals")
+        validator.validate_nonnegative(nscans, "nscans")
+        self._thisptr.get().add_split_merge(domain, nproposals, nscans)
+
+    def split_merge_reports(self):
+        """The proposals of each split_merge kernel so far, in the order they
+        were added, as ``(domain, report)`` tuples. A report has the number
+        of splits and merges proposed, and how many of each were accepted.
+        """
+        cdef vector[pair[size_t, c_split_merge_report]] reports = \
+            self._thisptr.get().split_merge_reports()
+        ret = []
+        for i in xrange(reports.size()):
+            ret.append((reports[i].first, {
+                'nsplits': reports[i].second.nsplits_,
+                'nsplits_accepted': reports[i].second.nsplits_accepted_,
+                'nmerges': reports[i].second.nmerges_,
+                'nmerges_accepted': reports[i].second.nmerges_accepted_,
+            }))
+        return ret
+
+    def add_slice_cluster_hp(self, int domain, key, prior, float w):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_cluster_hp(
+            domain, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def add_slice_relation_hp(self, int relation, key, prior, float w):
+        validator.validate_nonnegative(relation, "relation")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_relation_hp(
+            relation, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def run(self, rng r, int niters):
+        validator.validate_not_none(r)
+        validator.validate_nonnegative(niters, "niters")
+        cdef c_runner *px = self._thisptr.get()
+        cdef rng_t *pr = r._thisptr
+        cdef size_t n = niters
+        try:
+            with nogil:
+                px.run(pr[0], n)
+        except RuntimeError:
+            _reraise_log_prior(self._refs)
+            raise
+
+
+cdef class native_multi_chain_runner:
+    """Runs independent chains natively over a pool of threads (see the C++
+    ``microscopes::irm::multi_chain_runner``). Every kernel added is run by
+    every chain, in the order they were added.
+
+    The chains share the dataviews and their entity indices, so only their
+    states are per chain. :meth:`run` releases the GIL.
+
+    Parameters
+    ----------
+    latents : list
+        The state of each chain. They must share a definition, and are
+        updated in place.
+    views : list of relation dataviews
+    nthreads : int
+
+    """
+
+    def __cinit__(self, latents, views, int nthreads):
+        latents = list(latents)
+        validator.validate_nonempty(latents, "latents")
+        validator.validate_positive(nthreads, "nthreads")
+        cdef vector[shared_ptr[c_state]] cstates
+        for s in latents:
+            validator.validate_type(s, state)
+            validator.validate_len(views, (<state>s).nrelations(), "views")
+            cstates.push_back((<state>s)._thisptr)
+        self._thisptr.reset(new c_multi_chain_runner(
+            c_bind_chains(cstates, get_crelations(views)), nthreads))
+        self._ndomains = (<state>latents[0]).ndomains()
+        self._refs = latents + list(views)
+
+    def nchains(self):
+        return self._thisptr.get().nchains()
+
+    def add_assign(self, int domain):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        self._thisptr.get().add_assign(domain)
+
+    def add_split_merge(self, int domain, int nproposals, int nscans):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(nproposals, "nproposals")
+        validator.validate_nonnegative(nscans, "nscans")
+        self._thisptr.get().add_split_merge(domain, nproposals, nscans)
+
+    def add_slice_cluster_hp(self, int domain, key, prior, float w):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_cluster_hp(
+            domain, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def add_slice_relation_hp(self, int relation, key, prior, float w):
+        validator.validate_nonnegative(relation, "relation")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_relation_hp(
+            relation, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def run(self, rng r, int niters):
+        validator.validate_not_none(r)
+        validator.validate_nonnegative(niters, "niters")
+        cdef c_multi_chain_runner *px = self._thisptr.get()
+        cdef rng_t *pr = r._thisptr
+        cdef size_t n = niters
+        try:
+            with nogil:
+                px.run(pr[0], n)
+        except RuntimeError:
+            _reraise_log_prior(self._refs)
+            raise
+
+    def summaries(self, rng r):
+        """Where each chain stands, as a dict with the number of groups of
+        each domain, and the assignment and likelihood scores (summed over
+        the domains and the relations, respectively).
+        """
+        validator.validate_not_none(r)
+        cdef c_multi_chain_runner *px = self._thisptr.get()
+        cdef rng_t *pr = r._thisptr
+        cdef vector[c_chain_summary] summaries
+        with nogil:
+            summaries = px.summaries(pr[0])
+        ret = []
+        for i in xrange(summaries.size()):
+            ret.append({
+                'ngroups': list(summaries[i].ngroups_),
+                'score_assignment': summaries[i].score_assignment_,
+                'score_likelihood': summaries[i].score_likelihood_,
+            })
+        return ret
+
+
+cdef class native_tempering_runner:
+    """Runs replicas of a state at the temperatures of a ladder, proposing
+    swaps of temperatures between neighboring rungs (see the C++
+    ``microscopes::irm::tempering_runner``). A replica at inverse temperature
+    beta targets prior * likelihood^beta; the one at beta = 1 samples the
+    posterior.
+
+    The replicas share the dataviews, and run over a pool of threads.
+    :meth:`run` releases the GIL.
+
+    Parameters
+    ----------
+    latents : list
+        The state of each replica. They must share a definition, and are
+        updated (and tempered) in place.
+    views : list of relation dataviews
+    betas : list of float
+        The ladder of inverse temperatures, decreasing from 1, one per
+        replica.
+    nthreads : int
+
+    """
+
+    def __cinit__(self, latents, views, betas, int nthreads):
+        latents = list(latents)
+        validator.validate_nonempty(latents, "latents")
+        validator.validate_len(betas, len(latents), "betas")
+        validator.validate_positive(nthreads, "nthreads")
+        cdef vector[shared_ptr[c_state]] cstates
+        for s in latents:
+            validator.validate_type(s, state)
+            validator.validate_len(views, (<state>s).nrelations(), "views")
+            cstates.push_back((<state>s)._thisptr)
+        cdef vector[float] cbetas = betas
+        self._thisptr.reset(new c_tempering_runner(
+            c_bind_chains(cstates, get_crelations(views)), cbetas, nthreads))
+        self._ndomains = (<state>latents[0]).ndomains()
+        self._refs = latents + list(views)
+
+    def nreplicas(self):
+        return self._thisptr.get().nreplicas()
+
+    def replica(self, int rung):
+        """The index of the replica currently at the given rung"""
+        validator.validate_in_range(rung, self.nreplicas(), "rung")
+        return self._thisptr.get().replica(rung)
+
+    def add_assign(self, int domain):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        self._thisptr.get().add_assign(domain)
+
+    def add_split_merge(self, int domain, int nproposals, int nscans):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(nproposals, "nproposals")
+        validator.validate_nonnegative(nscans, "nscans")
+        self._thisptr.get().add_split_merge(domain, nproposals, nscans)
+
+    def add_slice_cluster_hp(self, int domain, key, prior, float w):
+        validator.validate_in_range(domain, self._ndomains, "domain")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_cluster_hp(
+            domain, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def add_slice_relation_hp(self, int relation, key, prior, float w):
+        validator.validate_nonnegative(relation, "relation")
+        validator.validate_positive(w, "w")
+        prior = _log_prior(prior)
+        self._refs.append(prior)
+        self._thisptr.get().add_slice_relation_hp(
+            relation, key, c_callback_log_prior(_call_log_prior, <void *>prior), w)
+
+    def run(self, rng r, int niters, int swap_every):
+        validator.validate_not_none(r)
+        validator.validate_nonnegative(niters, "niters")
+        validator.validate_positive(swap_every, "swap_every")
+        cdef c_tempering_runner *px = self._thisptr.get()
+        cdef rng_t *pr = r._thisptr
+        cdef size_t n = niters
+        cdef size_t every = swap_every
+        try:
+            with nogil:
+                px.run(pr[0], n, every)
+        except RuntimeError:
+            _reraise_log_prior(self._refs)
+            raise
+
+    def swap_stats(self):
+        """Per pair of neighboring rungs, the number of swaps proposed and
+        accepted so far, and the acceptance rate, as dicts
+        """
+        cdef c_tempering_runner *px = self._thisptr.get()
+        cdef vector[float] rates = px.swap_rates()
+        ret = []
+        for k in xrange(rates.size()):
+            ret.append({
+                'attempts': px.swap_attempts()[k],
+                'accepts': px.swap_accepts()[k],
+                'rate': rates[k],
+            })
+        return ret
+
+
 def initialize(model_definition defn, data, rng r, **kwargs):
     """Initialize state to a random, valid point in the state space
 
@@ -284,12 +793,15 @@ def initialize(model_definition defn, data, rng r, **kwargs):
     defn : model definition
     data : list of relation dataviews
     rng : random state
+    nthreads : int, optional
+        Build the suffstats of the conjugate (BetaBernoulli and
+        NormalInverseChiSq) relations over this many threads. Defaults to 1.
 
     """
     return state(defn=defn, data=data, r=r, **kwargs)
 
 
-def deserialize(model_definition defn, bytes):
+def deserialize(model_definition defn, bytes, **kwargs):
     """Restore a state object from a bytestring representation.
 
     Note that a serialized representation of a state object does
@@ -299,10 +811,38 @@ def deserialize(model_definition defn, bytes):
     ----------
     defn : model definition
     bytes : bytestring representation
+    r : random state
+        The groups of non-conjugate relations are drawn from it. Omitting
+        it is deprecated, and draws them from a fixed seed.
+    nthreads : int, optional
+        Decode the suffstats over this many threads. Defaults to 1.
+
+    """
+    return state(defn=defn, bytes=bytes, **kwargs)
+
+
+def load_checkpoint(model_definition defn, path, **kwargs):
+    """Restore a state object from a file written by
+    :meth:`state.save_checkpoint`.
+
+    Like a serialized representation, a checkpoint does not contain the
+    structural definition of the state.
+
+    Parameters
+    ----------
+    defn : model definition
+    path : the checkpoint file
+    r, nthreads : optional
+        See :func:`deserialize`.
 
     """
-    return state(defn=defn, bytes=bytes)
+    return state(defn=defn, checkpoint=path, **kwargs)
 
 
-def _reconstruct_state(defn, bytes):
-    return deserialize(defn, bytes)
+def _reconstruct_state(defn, bytes, settings=None):
+    # a pickle carries no rng, so the copy gets a fresh one. pickles from
+    # before the settings were kept have none
+    ret = deserialize(defn, bytes, r=rng())
+    if settings is not None:
+        ret._apply_settings(settings)
+    return ret
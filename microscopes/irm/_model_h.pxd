@@ -1,7 +1,9 @@
 from libcpp.vector cimport vector
 from libcpp.set cimport set
 from libcpp.string cimport string
+from libcpp.utility cimport pair
 from libc.stddef cimport size_t
+from libc.stdint cimport uint64_t
 from libcpp cimport bool
 
 from microscopes._shared_ptr_h cimport shared_ptr
@@ -11,6 +13,24 @@ from microscopes.common._typedefs_h cimport hyperparam_bag_t, suffstats_bag_t
 from microscopes.common.relation._dataview_h cimport dataview
 from microscopes._models_h cimport model as c_model
 
+cdef extern from "microscopes/irm/counters.hpp" namespace "microscopes::irm":
+    cdef cppclass relation_counters:
+        uint64_t suffstats_lookups_
+        uint64_t suffstats_hits_
+        uint64_t blocks_created_
+        uint64_t blocks_erased_
+        uint64_t observations_
+        uint64_t iterate_ns_
+
+    cdef cppclass domain_counters:
+        uint64_t entities_scored_
+        uint64_t candidates_scored_
+
+    cdef cppclass state_counters:
+        bool enabled_
+        vector[domain_counters] domains_
+        vector[relation_counters] relations_
+
 cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm":
     ctypedef vector[const dataview *] dataset_t
 
@@ -18,6 +38,12 @@ cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm":
         relation_definition()
         relation_definition(const vector[size_t] &,
                             const shared_ptr[c_model] &) except +
+        relation_definition(const vector[size_t] &,
+                            const shared_ptr[c_model] &,
+                            bool) except +
+        relation_definition(const vector[size_t] &,
+                            const shared_ptr[c_model] &,
+                            bool, bool) except +
 
     cdef cppclass model_definition:
         model_definition(const vector[size_t] &,
@@ -49,6 +75,14 @@ cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm":
         bool get_suffstats(size_t, const vector[size_t] &, suffstats_bag_t &) except +
         # XXX(stephentu): no set_suffstats()
 
+        void set_dense_suffstats(size_t, bool) except +
+        bool dense_suffstats(size_t) except +
+
+        void set_score_threads(size_t) except +
+        size_t score_threads()
+        void set_relation_threads(size_t) except +
+        size_t relation_threads()
+
         # XXX(stephentu):
         #size_t create_group(size_t) except +
         #void delete_group(size_t, size_t) except +
@@ -60,17 +94,26 @@ cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm":
 
         float score_assignment(size_t) except +
         float score_likelihood(rng_t &) except +
+        float score_joint(rng_t &) except +
+
+        state_counters counters()
+        void reset_counters()
 
         # stupid testing functions
         vector[vector[size_t]] entity_data_positions(size_t, size_t, const dataset_t &) except +
 
         string serialize() except +
+        void save_checkpoint(const string &) except +
 
     cdef cppclass model_max4(entity_based_state_object):
         model_max4(const shared_ptr[state_max4] &,
                    size_t,
                    const vector[shared_ptr[dataview]] &) except +
 
+    vector[vector[shared_ptr[entity_based_state_object]]] \
+    bind_chains(const vector[shared_ptr[state_max4]] &,
+                const vector[shared_ptr[dataview]] &) except +
+
 cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm::state_max4":
     shared_ptr[state_max4] \
     initialize(const model_definition &,
@@ -78,7 +121,84 @@ cdef extern from "microscopes/irm/model.hpp" namespace "microscopes::irm::state_
                const vector[hyperparam_bag_t] &,
                const vector[vector[size_t]] &,
                const dataset_t &,
-               rng_t &) except +
+               rng_t &,
+               size_t) except +
+
+    shared_ptr[state_max4] \
+    deserialize(const model_definition &,
+                const string &,
+                rng_t &,
+                size_t) except +
 
     shared_ptr[state_max4] \
-    deserialize(const model_definition &, const string &) except +
+    load_checkpoint(const model_definition &,
+                    const string &,
+                    rng_t &,
+                    size_t) except +
+
+cdef extern from "microscopes/irm/hogwild.hpp" namespace "microscopes::irm":
+    cdef cppclass hogwild_report:
+        size_t nsyncs_
+        size_t nmoves_
+        size_t pending_
+        size_t max_pending_
+        double mean_pending()
+
+cdef extern from "microscopes/irm/split_merge.hpp" namespace "microscopes::irm":
+    cdef cppclass split_merge_report:
+        size_t nsplits_
+        size_t nsplits_accepted_
+        size_t nmerges_
+        size_t nmerges_accepted_
+
+cdef extern from "microscopes/irm/runner.hpp" namespace "microscopes::irm":
+    cdef cppclass log_prior_t "microscopes::irm::runner::log_prior_t":
+        pass
+
+    cdef cppclass runner:
+        runner(const vector[shared_ptr[entity_based_state_object]] &) except +
+        size_t nkernels()
+        void add_assign(size_t) except +
+        void add_assign_resample(size_t, size_t) except +
+        void add_chromatic_assign(size_t, size_t, size_t) except +
+        void add_hogwild_assign(size_t, size_t, size_t) except +
+        vector[pair[size_t, hogwild_report]] hogwild_reports()
+        void add_split_merge(size_t, size_t, size_t) except +
+        vector[pair[size_t, split_merge_report]] split_merge_reports()
+        void add_slice_cluster_hp(size_t, const string &, const log_prior_t &, float) except +
+        void add_slice_relation_hp(size_t, const string &, const log_prior_t &, float) except +
+        void run(rng_t &, size_t) nogil except +
+
+    cdef cppclass chain_summary "microscopes::irm::multi_chain_runner::chain_summary":
+        vector[size_t] ngroups_
+        float score_assignment_
+        float score_likelihood_
+
+    cdef cppclass multi_chain_runner:
+        multi_chain_runner(const vector[vector[shared_ptr[entity_based_state_object]]] &,
+                           size_t) except +
+        size_t nchains()
+        void add_assign(size_t) except +
+        void add_split_merge(size_t, size_t, size_t) except +
+        void add_slice_cluster_hp(size_t, const string &, const log_prior_t &, float) except +
+        void add_slice_relation_hp(size_t, const string &, const log_prior_t &, float) except +
+        void run(rng_t &, size_t) nogil except +
+        vector[chain_summary] summaries(rng_t &) nogil except +
+
+    cdef cppclass tempering_runner:
+        tempering_runner(const vector[vector[shared_ptr[entity_based_state_object]]] &,
+                         const vector[float] &,
+                         size_t) except +
+        size_t nreplicas()
+        size_t replica(size_t)
+        void add_assign(size_t) except +
+        void add_split_merge(size_t, size_t, size_t) except +
+        void add_slice_cluster_hp(size_t, const string &, const log_prior_t &, float) except +
+        void add_slice_relation_hp(size_t, const string &, const log_prior_t &, float) except +
+        void run(rng_t &, size_t, size_t) nogil except +
+        const vector[size_t] & swap_attempts()
+        const vector[size_t] & swap_accepts()
+        vector[float] swap_rates()
+
+cdef extern from "microscopes/irm/runner.hpp" namespace "microscopes::irm::runner":
+    log_prior_t callback_log_prior(bool (*)(void *, float, float *), void *)
@@ -14,3 +14,4 @@ cdef class model_definition:
     cdef shared_ptr[c_model_definition] _thisptr
     cdef readonly list _domains
     cdef readonly list _relations
+    cdef readonly list _implicit_zeros
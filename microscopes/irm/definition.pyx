@@ -13,10 +13,50 @@ def _compose(f, g):
     return lambda x: g(f(x))
 
 
+# the models whose groups carry nothing but their sufficient statistics.
+# model descriptors cannot say so themselves, so any model missing here
+# (bbnc, or one this list does not know of) is taken to be non-conjugate,
+# which is always safe
+_CONJUGATE_MODELS = frozenset(['bb', 'bnb', 'gp', 'nich', 'dd', 'niw'])
+
+
+def is_conjugate(model):
+    """Returns True if the groups of `model` carry no state besides their
+    sufficient statistics (see `relation_definition` on the C++ side), and
+    False for non-conjugate or unknown models.
+
+    Parameters
+    ----------
+    model : model descriptor
+
+    """
+    return model.name() in _CONJUGATE_MODELS
+
+
 cdef class model_definition:
-    def __cinit__(self, domains, relations):
+    """The structure of an IRM: the domains, and the relations over them.
+
+    Parameters
+    ----------
+    domains : list
+        The size of each domain, or ``(size, hyperpriors)`` tuples.
+    relations : list
+        ``(domains, model)`` tuples, where model is a model descriptor or a
+        ``(model, hyperpriors)`` tuple.
+    implicit_zeros : iterable of int, optional
+        The binary ``bb`` relations whose unobserved (masked) cells are taken
+        to be observed falses; their observed cells must all be true. The
+        state then only keeps the number of true cells of each block, and
+        a step costs time in the number of true cells of the entity instead
+        of the size of the other domain.
+
+    """
+    def __cinit__(self, domains, relations, implicit_zeros=()):
         validator.validate_nonempty(domains, "domains")
         validator.validate_nonempty(relations, "relations")
+        implicit_zeros = sorted(set(implicit_zeros))
+        for rid in implicit_zeros:
+            validator.validate_in_range(rid, len(relations))
 
         cdef vector[size_t] c_domains
         self._domains = []
@@ -32,7 +72,7 @@ cdef class model_definition:
         cdef vector[c_relation_definition] c_relations
         cdef vector[size_t] c_rdomains
         self._relations = []
-        for rdomains, rmodel in relations:
+        for rid, (rdomains, rmodel) in enumerate(relations):
             if len(rdomains) < 2:
                 raise ValueError("cannot have relation with arity < 2")
             if len(rdomains) > 4:
@@ -54,10 +94,17 @@ cdef class model_definition:
                 rmodel, hp = rmodel, rmodel.default_hyperpriors()
             self._relations.append((rdomains, (rmodel, hp)))
 
+            zeros = rid in implicit_zeros
+            if zeros and (len(rdomains) != 2 or rmodel.name() != 'bb'):
+                raise ValueError(
+                    "implicit zeros need a binary bb relation: {}".format(rid))
             c_relations.push_back(
                 c_relation_definition(
                     c_rdomains,
-                    (<_base>rmodel._c_descriptor).get()))
+                    (<_base>rmodel._c_descriptor).get(),
+                    is_conjugate(rmodel),
+                    zeros))
+        self._implicit_zeros = implicit_zeros
 
         self._thisptr.reset(new c_model_definition(c_domains, c_relations))
 
@@ -78,15 +125,18 @@ cdef class model_definition:
         fn = _compose(op.itemgetter(1), op.itemgetter(1))
         return map(fn, self._relations)
 
+    def implicit_zeros(self):
+        return list(self._implicit_zeros)
+
     def shape(self, relation):
         dids = self.relations()[relation]
         domains = self.domains()
         return tuple(domains[did] for did in dids)
 
     def __reduce__(self):
-        args = (self._domains, self._relations)
+        args = (self._domains, self._relations, self._implicit_zeros)
         return (_reconstruct_model_definition, args)
 
 
-def _reconstruct_model_definition(domains, relations):
-    return model_definition(domains, relations)
+def _reconstruct_model_definition(domains, relations, implicit_zeros=()):
+    return model_definition(domains, relations, implicit_zeros)
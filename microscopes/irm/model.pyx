@@ -6,4 +6,8 @@ from microscopes.irm._model import (
     bind,
     initialize,
     deserialize,
+    load_checkpoint,
+    native_runner,
+    native_multi_chain_runner,
+    native_tempering_runner,
 )
@@ -4,8 +4,10 @@
 from microscopes.common import validator
 from microscopes.common.rng import rng
 from microscopes.common.relation._dataview import abstract_dataview
-from microscopes.irm.definition import model_definition
-from microscopes.irm.model import state, bind
+from microscopes.irm.definition import model_definition, is_conjugate
+from microscopes.irm.model import \
+    state, bind, native_runner, native_multi_chain_runner, \
+    native_tempering_runner
 from microscopes.kernels import gibbs, slice
 
 import itertools as it
@@ -24,15 +26,9 @@ def default_assign_kernel_config(defn):
     """
     validator.validate_type(defn, model_definition, 'defn')
 
-    # XXX(stephentu): model_descriptors should implement
-    # is_conjugate()
-
-    def is_nonconj(x):
-        return x.name() == 'bbnc'
-
     conj_inds, nonconj_inds = [], []
     for idx, m in enumerate(defn.relation_models()):
-        lst = nonconj_inds if is_nonconj(m) else conj_inds
+        lst = conj_inds if is_conjugate(m) else nonconj_inds
         lst.append(idx)
 
     nonconj_domains = set()
@@ -180,6 +176,164 @@ def default_kernel_config(defn):
         default_relation_hp_kernel_config(defn)))
 
 
+def _validate_kernel_config(defn, latent, kernel_config):
+    """The kernel config, validated and normalized (a list of domains
+    becomes a dict of empty configs)"""
+    ret = []
+    for kernel in kernel_config:
+        name, config = kernel
+
+        if not hasattr(config, 'iteritems'):
+            config = {c: {} for c in config}
+        validator.validate_dict_like(config)
+
+        def require_relation_keys(config):
+            valid_keys = set(xrange(len(defn.relations())))
+            if not set(config.keys()).issubset(valid_keys):
+                raise ValueError("bad config found: {}".format(config))
+
+        def require_domain_keys(config):
+            valid_keys = set(xrange(len(defn.domains())))
+            if not set(config.keys()).issubset(valid_keys):
+                raise ValueError("bad config found: {}".format(config))
+
+        if name == 'assign':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if v:
+                    msg = "assign has no config params: {}".format(v)
+                    raise ValueError(msg)
+
+        elif name == 'chromatic_assign':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if set(v.keys()) != set(('nthreads', 'max_batch',)):
+                    raise ValueError("bad config found: {}".format(v))
+                validator.validate_positive(v['nthreads'], 'nthreads')
+                validator.validate_positive(v['max_batch'], 'max_batch')
+
+        elif name == 'hogwild_assign':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if set(v.keys()) != set(('nthreads', 'max_staleness',)):
+                    raise ValueError("bad config found: {}".format(v))
+                validator.validate_positive(v['nthreads'], 'nthreads')
+                validator.validate_positive(
+                    v['max_staleness'], 'max_staleness')
+
+        elif name == 'split_merge':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if set(v.keys()) != set(('nproposals', 'nscans',)):
+                    raise ValueError("bad config found: {}".format(v))
+                validator.validate_positive(v['nproposals'], 'nproposals')
+                validator.validate_nonnegative(v['nscans'], 'nscans')
+
+        elif name == 'assign_resample':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if v.keys() != ['m']:
+                    raise ValueError("bad config found: {}".format(v))
+                validator.validate_positive(v['m'], 'm')
+
+        elif name == 'slice_cluster_hp':
+            require_domain_keys(config)
+            for v in config.values():
+                validator.validate_dict_like(v)
+                if v.keys() != ['cparam']:
+                    raise ValueError("bad config found: {}".format(v))
+
+        elif name == 'grid_relation_hp':
+            require_relation_keys(config)
+            for ri, ps in config.iteritems():
+                if set(ps.keys()) != set(('hpdf', 'hgrid',)):
+                    raise ValueError("bad config found: {}".format(ps))
+                full = []
+                for partial in ps['hgrid']:
+                    hp = latent.get_relation_hp(ri)
+                    hp.update(partial)
+                    full.append(hp)
+                ps['hgrid'] = full
+
+        elif name == 'slice_relation_hp':
+            if config.keys() != ['hparams']:
+                raise ValueError("bad config found: {}".format(config))
+            validator.validate_dict_like(config['hparams'])
+            require_relation_keys(config['hparams'])
+
+        elif name == 'theta':
+            if config.keys() != ['tparams']:
+                raise ValueError("bad config found: {}".format(config))
+            validator.validate_dict_like(config['tparams'])
+            require_relation_keys(config['tparams'])
+
+        else:
+            raise ValueError("bad kernel found: {}".format(name))
+
+        ret.append((name, config))
+    return ret
+
+
+def _is_native(name, config):
+    """Whether the (validated) kernel can be run by a native_runner"""
+    def scalar_keys(hparams):
+        return all(isinstance(k, str) for k in hparams.keys())
+    if name in ('assign', 'assign_resample', 'chromatic_assign',
+                'hogwild_assign', 'split_merge'):
+        return True
+    if name == 'slice_cluster_hp':
+        return all(scalar_keys(v['cparam']) for v in config.values())
+    if name == 'slice_relation_hp':
+        return all(scalar_keys(v) for v in config['hparams'].values())
+    return False
+
+
+def _add_native(nr, name, config):
+    if name == 'assign':
+        for idx in config.keys():
+            nr.add_assign(idx)
+    elif name == 'assign_resample':
+        for idx, v in config.iteritems():
+            nr.add_assign_resample(idx, v['m'])
+    elif name == 'chromatic_assign':
+        for idx, v in config.iteritems():
+            nr.add_chromatic_assign(idx, v['nthreads'], v['max_batch'])
+    elif name == 'hogwild_assign':
+        for idx, v in config.iteritems():
+            nr.add_hogwild_assign(idx, v['nthreads'], v['max_staleness'])
+    elif name == 'split_merge':
+        for idx, v in config.iteritems():
+            nr.add_split_merge(idx, v['nproposals'], v['nscans'])
+    elif name == 'slice_cluster_hp':
+        for idx, v in config.iteritems():
+            for key, (prior, w) in v['cparam'].iteritems():
+                nr.add_slice_cluster_hp(idx, key, prior, w)
+    elif name == 'slice_relation_hp':
+        for idx, hparams in config['hparams'].iteritems():
+            for key, (prior, w) in hparams.iteritems():
+                nr.add_slice_relation_hp(idx, key, prior, w)
+    else:
+        assert False, "should not be reached"
+
+
+def _validate_chain_kernel_config(defn, latent, kernel_config):
+    """Like _validate_kernel_config(), for the runners of several chains,
+    which only support the native kernels that do not spawn threads"""
+    ret = _validate_kernel_config(defn, latent, kernel_config)
+    for name, config in ret:
+        if name not in ('assign', 'split_merge',
+                        'slice_cluster_hp', 'slice_relation_hp') or \
+           not _is_native(name, config):
+            raise ValueError(
+                "kernel cannot be run across chains: {}".format(name))
+    return ret
+
+
 class runner(object):
     # XXX(stephentu): do a better job of documentating the kernel configuration
     # dicts
@@ -213,74 +367,10 @@ class runner(object):
         self._views = views
         self._latent = copy.deepcopy(latent)
 
-        self._kernel_config = []
-        for kernel in kernel_config:
-            name, config = kernel
-
-            if not hasattr(config, 'iteritems'):
-                config = {c: {} for c in config}
-            validator.validate_dict_like(config)
-
-            def require_relation_keys(config):
-                valid_keys = set(xrange(len(defn.relations())))
-                if not set(config.keys()).issubset(valid_keys):
-                    raise ValueError("bad config found: {}".format(config))
-
-            def require_domain_keys(config):
-                valid_keys = set(xrange(len(defn.domains())))
-                if not set(config.keys()).issubset(valid_keys):
-                    raise ValueError("bad config found: {}".format(config))
-
-            if name == 'assign':
-                require_domain_keys(config)
-                for v in config.values():
-                    validator.validate_dict_like(v)
-                    if v:
-                        msg = "assign has no config params: {}".format(v)
-                        raise ValueError(msg)
-
-            elif name == 'assign_resample':
-                require_domain_keys(config)
-                for v in config.values():
-                    validator.validate_dict_like(v)
-                    if v.keys() != ['m']:
-                        raise ValueError("bad config found: {}".format(v))
-
-            elif name == 'slice_cluster_hp':
-                require_domain_keys(config)
-                for v in config.values():
-                    validator.validate_dict_like(v)
-                    if v.keys() != ['cparam']:
-                        raise ValueError("bad config found: {}".format(v))
-
-            elif name == 'grid_relation_hp':
-                require_relation_keys(config)
-                for ri, ps in config.iteritems():
-                    if set(ps.keys()) != set(('hpdf', 'hgrid',)):
-                        raise ValueError("bad config found: {}".format(ps))
-                    full = []
-                    for partial in ps['hgrid']:
-                        hp = latent.get_relation_hp(ri)
-                        hp.update(partial)
-                        full.append(hp)
-                    ps['hgrid'] = full
-
-            elif name == 'slice_relation_hp':
-                if config.keys() != ['hparams']:
-                    raise ValueError("bad config found: {}".format(config))
-                validator.validate_dict_like(config['hparams'])
-                require_relation_keys(config['hparams'])
-
-            elif name == 'theta':
-                if config.keys() != ['tparams']:
-                    raise ValueError("bad config found: {}".format(config))
-                validator.validate_dict_like(config['tparams'])
-                require_relation_keys(config['tparams'])
-
-            else:
-                raise ValueError("bad kernel found: {}".format(name))
-
-            self._kernel_config.append((name, config))
+        self._kernel_config = _validate_kernel_config(
+            defn, latent, kernel_config)
+        self._hogwild_reports = []
+        self._split_merge_reports = []
 
     def run(self, r, niters=10000):
         """Run the specified mixturemodel kernel for `niters`, in a single
@@ -296,15 +386,34 @@ class runner(object):
         validator.validate_positive(niters, param_name='niters')
         inds = xrange(len(self._defn.domains()))
         models = [bind(self._latent, i, self._views) for i in inds]
+
+        # consecutive kernels which have a native implementation are batched
+        # into one native_runner, so that a schedule made up only of those
+        # runs entirely in C++ (without holding the GIL)
+        schedule = []
+        for name, config in self._kernel_config:
+            if not _is_native(name, config):
+                schedule.append((name, config))
+                continue
+            if not schedule or not isinstance(schedule[-1], native_runner):
+                schedule.append(native_runner(models))
+            _add_native(schedule[-1], name, config)
+
+        self._hogwild_reports = []
+        self._split_merge_reports = []
+        if len(schedule) == 1 and isinstance(schedule[0], native_runner):
+            schedule[0].run(r, niters)
+            self._hogwild_reports = schedule[0].hogwild_reports()
+            self._split_merge_reports = schedule[0].split_merge_reports()
+            return
+
         for _ in xrange(niters):
-            for name, config in self._kernel_config:
-                if name == 'assign':
-                    for idx in config.keys():
-                        gibbs.assign(models[idx], r)
-                elif name == 'assign_resample':
-                    for idx, v in config.iteritems():
-                        gibbs.assign_resample(models[idx], v['m'], r)
-                elif name == 'slice_cluster_hp':
+            for kernel in schedule:
+                if isinstance(kernel, native_runner):
+                    kernel.run(r, 1)
+                    continue
+                name, config = kernel
+                if name == 'slice_cluster_hp':
                     for idx, v in config.iteritems():
                         slice.hp(models[idx], r, cparam=v['cparam'])
                 elif name == 'grid_relation_hp':
@@ -316,11 +425,39 @@ class runner(object):
                 else:
                     assert False, "should not be reached"
 
+        for kernel in schedule:
+            if isinstance(kernel, native_runner):
+                self._hogwild_reports.extend(kernel.hogwild_reports())
+                self._split_merge_reports.extend(
+                    kernel.split_merge_reports())
+
+    def hogwild_reports(self):
+        """The drift of the hogwild_assign kernels over the last call to
+        :meth:`run`, as ``(domain, report)`` tuples (see
+        ``native_runner.hogwild_reports``). The mean and max number of moves a
+        worker had not seen when it synced can be used to tune max_staleness.
+        """
+        return list(self._hogwild_reports)
+
+    def split_merge_reports(self):
+        """The proposals of the split_merge kernels over the last call to
+        :meth:`run`, as ``(domain, report)`` tuples (see
+        ``native_runner.split_merge_reports``).
+        """
+        return list(self._split_merge_reports)
+
     def get_latent(self):
         """Returns the current value of the underlying state object.
         """
         return copy.deepcopy(self._latent)
 
+    def checkpoint(self, path):
+        """Writes the underlying state object to `path` (see
+        ``state.save_checkpoint``), without the copy :meth:`get_latent`
+        makes. Restore it with ``model.load_checkpoint``.
+        """
+        self._latent.save_checkpoint(path)
+
     @property
     def expensive_state(self):
         return self._views
@@ -333,3 +470,203 @@ class runner(object):
         for view in self._views:
             view.digest(h)
         return h
+
+
+class multi_chain_runner(object):
+    """Runs independent chains of the IRM natively, over a pool of threads.
+
+    The chains share the relation dataviews (and the indices built over
+    them), so memory grows with the suffstats of each chain, not with copies
+    of the data. Only the kernels with a native implementation which does
+    not spawn threads of its own are supported: assign, split_merge, and the
+    slice kernels on scalar hyperparameters.
+
+    Parameters
+    ----------
+
+    defn : ``model_definition``
+        The structural definition.
+
+    views : list
+        A list of the relation dataviews.
+
+    latents : list of ``state``
+        The initialization state of each chain.
+
+    kernel_config : list
+        See ``runner``.
+
+    nthreads : int, optional
+        Defaults to 1.
+    """
+
+    def __init__(self, defn, views, latents, kernel_config, nthreads=1):
+        validator.validate_type(defn, model_definition, 'defn')
+        validator.validate_len(views, len(defn.relations()), 'views')
+        for view in views:
+            validator.validate_type(view, abstract_dataview)
+        validator.validate_nonempty(latents, 'latents')
+        for latent in latents:
+            validator.validate_type(latent, state, 'latents')
+        validator.validate_positive(nthreads, 'nthreads')
+
+        self._defn = defn
+        self._views = views
+        self._latents = [copy.deepcopy(latent) for latent in latents]
+        self._kernel_config = _validate_chain_kernel_config(
+            defn, latents[0], kernel_config)
+
+        self._native = native_multi_chain_runner(
+            self._latents, self._views, nthreads)
+        for name, config in self._kernel_config:
+            _add_native(self._native, name, config)
+
+    def nchains(self):
+        return len(self._latents)
+
+    def run(self, r, niters=10000):
+        """Run every chain for `niters`, without holding the GIL.
+
+        Parameters
+        ----------
+        r : random state
+            Seeds the random state of each chain.
+        niters : int
+
+        """
+        validator.validate_type(r, rng, param_name='r')
+        validator.validate_positive(niters, param_name='niters')
+        self._native.run(r, niters)
+
+    def summaries(self, r):
+        """Per chain: the number of groups of each domain, and the assignment
+        and likelihood scores, as computed natively (see
+        ``native_multi_chain_runner.summaries``).
+        """
+        validator.validate_type(r, rng, param_name='r')
+        return self._native.summaries(r)
+
+    def get_latents(self):
+        """Returns the current value of each chain's state object.
+        """
+        return [copy.deepcopy(latent) for latent in self._latents]
+
+    def checkpoint(self, paths):
+        """Writes each chain's state object to the path of `paths` at its
+        index (see ``runner.checkpoint``).
+        """
+        validator.validate_len(paths, len(self._latents), 'paths')
+        for latent, path in zip(self._latents, paths):
+            latent.save_checkpoint(path)
+
+    @property
+    def expensive_state(self):
+        return self._views
+
+    def expensive_state_digest(self, h):
+        for view in self._views:
+            view.digest(h)
+        return h
+
+
+class tempering_runner(object):
+    """Runs replicas of the IRM at the temperatures of a ladder natively,
+    over a pool of threads, and swaps temperatures between neighboring rungs
+    (replica exchange). The replica at beta = 1 samples the posterior; the
+    hotter ones flatten the likelihood to help it mix.
+
+    Parameters
+    ----------
+
+    defn : ``model_definition``
+        The structural definition.
+
+    views : list
+        A list of the relation dataviews.
+
+    latents : list of ``state``
+        The initialization state of each replica.
+
+    kernel_config : list
+        See ``multi_chain_runner``.
+
+    betas : list of float
+        The inverse temperatures, decreasing from 1, one per replica.
+
+    nthreads : int, optional
+        Defaults to 1.
+
+    swap_every : int, optional
+        Swaps are proposed every `swap_every` iterations. Defaults to 1.
+    """
+
+    def __init__(self, defn, views, latents, kernel_config, betas,
+                 nthreads=1, swap_every=1):
+        validator.validate_type(defn, model_definition, 'defn')
+        validator.validate_len(views, len(defn.relations()), 'views')
+        for view in views:
+            validator.validate_type(view, abstract_dataview)
+        validator.validate_nonempty(latents, 'latents')
+        for latent in latents:
+            validator.validate_type(latent, state, 'latents')
+        validator.validate_len(betas, len(latents), 'betas')
+        validator.validate_positive(nthreads, 'nthreads')
+        validator.validate_positive(swap_every, 'swap_every')
+
+        self._defn = defn
+        self._views = views
+        self._latents = [copy.deepcopy(latent) for latent in latents]
+        self._kernel_config = _validate_chain_kernel_config(
+            defn, latents[0], kernel_config)
+        self._swap_every = swap_every
+
+        self._native = native_tempering_runner(
+            self._latents, self._views, list(betas), nthreads)
+        for name, config in self._kernel_config:
+            _add_native(self._native, name, config)
+
+    def run(self, r, niters=10000):
+        """Run every replica for `niters`, without holding the GIL.
+
+        Parameters
+        ----------
+        r : random state
+        niters : int
+
+        """
+        validator.validate_type(r, rng, param_name='r')
+        validator.validate_positive(niters, param_name='niters')
+        self._native.run(r, niters, self._swap_every)
+
+    def swap_stats(self):
+        """See ``native_tempering_runner.swap_stats``. Low rates between two
+        rungs mean the ladder needs more temperatures there.
+        """
+        return self._native.swap_stats()
+
+    def get_latent(self):
+        """Returns the current value of the replica sampling the posterior.
+        """
+        return copy.deepcopy(self._latents[self._native.replica(0)])
+
+    def checkpoint(self, path):
+        """Writes the replica sampling the posterior to `path` (see
+        ``runner.checkpoint``).
+        """
+        self._latents[self._native.replica(0)].save_checkpoint(path)
+
+    def get_latents(self):
+        """Returns the current value of each replica, from the coldest to
+        the hottest. Only the first one samples the posterior.
+        """
+        return [copy.deepcopy(self._latents[self._native.replica(k)])
+                for k in xrange(len(self._latents))]
+
+    @property
+    def expensive_state(self):
+        return self._views
+
+    def expensive_state_digest(self, h):
+        for view in self._views:
+            view.digest(h)
+        return h
@@ -202,6 +202,9 @@ def build_extra_compile_args():
         ])
     if is_debug_build():
         extra_compile_args.append('-DDEBUG_MODE')
+    if 'MICROSCOPES_IRM_COUNTERS' in os.environ:
+        # see state.counters()
+        extra_compile_args.append('-DMICROSCOPES_IRM_COUNTERS')
 
     return extra_compile_args
 
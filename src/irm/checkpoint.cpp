@@ -0,0 +1,160 @@
+#include <microscopes/irm/checkpoint.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace microscopes::irm::detail;
+
+static const char Magic[8] = {'I', 'R', 'M', 'C', 'K', 'P', 'T', '\0'};
+static const uint32_t Version = 3;
+static const uint32_t ByteOrder = 0x01020304;
+
+static void
+check_errno(bool ok, const string &what)
+{
+  if (!ok)
+    throw runtime_error(what + ": " + strerror(errno));
+}
+
+checkpoint_writer::checkpoint_writer(const string &path)
+  : path_(path), tmp_path_(path + ".tmp"), out_(), buffer_(),
+    written_(), committed_()
+{
+  out_.open(tmp_path_.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!out_)
+    throw runtime_error("could not open " + tmp_path_);
+  buffer_.reserve(BufferSize + 4096);
+}
+
+checkpoint_writer::~checkpoint_writer()
+{
+  if (committed_)
+    return;
+  out_.close();
+  remove(tmp_path_.c_str());
+}
+
+void
+checkpoint_writer::header(size_t ndomains, size_t nrelations)
+{
+  MICROSCOPES_ASSERT(!tell());
+  put_raw(Magic, sizeof(Magic));
+  append(Version);
+  append(ByteOrder);
+  put(ndomains);
+  put(nrelations);
+}
+
+void
+checkpoint_writer::put_bytes(const string &s)
+{
+  put(s.size());
+  put_raw(s.data(), s.size());
+  align();
+}
+
+void
+checkpoint_writer::put_raw(const char *p, size_t n)
+{
+  buffer_.append(p, n);
+  if (buffer_.size() >= BufferSize)
+    flush();
+}
+
+void
+checkpoint_writer::align()
+{
+  static const char zeros[8] = {};
+  const size_t pad = (8 - tell() % 8) % 8;
+  buffer_.append(zeros, pad);
+}
+
+void
+checkpoint_writer::patch(uint64_t offset, const void *p, size_t n)
+{
+  MICROSCOPES_ASSERT(offset + n <= tell());
+  if (offset >= written_) {
+    memcpy(&buffer_[offset - written_], p, n);
+    return;
+  }
+  flush();
+  out_.seekp(offset);
+  out_.write(static_cast<const char *>(p), n);
+  out_.seekp(written_);
+  if (!out_)
+    throw runtime_error("could not write " + tmp_path_);
+}
+
+void
+checkpoint_writer::flush()
+{
+  out_.write(buffer_.data(), buffer_.size());
+  if (!out_)
+    throw runtime_error("could not write " + tmp_path_);
+  written_ += buffer_.size();
+  buffer_.clear();
+}
+
+void
+checkpoint_writer::commit()
+{
+  flush();
+  out_.close();
+  if (!out_)
+    throw runtime_error("could not write " + tmp_path_);
+  check_errno(!rename(tmp_path_.c_str(), path_.c_str()), "rename " + path_);
+  committed_ = true;
+}
+
+mapped_file::mapped_file(const string &path)
+  : data_(), size_()
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  check_errno(fd >= 0, "open " + path);
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    check_errno(false, "stat " + path);
+  }
+  size_ = st.st_size;
+  if (!size_) {
+    close(fd);
+    throw runtime_error("empty checkpoint " + path);
+  }
+  void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  check_errno(p != MAP_FAILED, "mmap " + path);
+  data_ = static_cast<const uint8_t *>(p);
+}
+
+mapped_file::~mapped_file()
+{
+  munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+void
+checkpoint_reader::header(size_t ndomains, size_t nrelations)
+{
+  MICROSCOPES_CHECK(!memcmp(raw(sizeof(Magic)), Magic, sizeof(Magic)),
+      "not a checkpoint");
+  const uint32_t *version = array<uint32_t>(2);
+  MICROSCOPES_CHECK(version[0] == Version, "unsupported checkpoint version");
+  MICROSCOPES_CHECK(version[1] == ByteOrder,
+      "checkpoint was written with another byte order");
+  MICROSCOPES_CHECK(get() == ndomains, "# domains mismatch");
+  MICROSCOPES_CHECK(get() == nrelations, "# relations mismatch");
+}
+
+string
+checkpoint_reader::get_bytes()
+{
+  const size_t n = get();
+  return string(raw(n), n);
+}
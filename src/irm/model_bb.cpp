@@ -0,0 +1,20 @@
+#include <microscopes/irm/model.hpp>
+
+// the states specialized for BetaBernoulli, see state. a translation unit of
+// their own, so that they compile in parallel with model.cpp
+
+namespace microscopes {
+namespace irm {
+
+template class state<-1, distributions::BetaBernoulli>;
+template class state<2, distributions::BetaBernoulli>;
+template class state<3, distributions::BetaBernoulli>;
+template class state<4, distributions::BetaBernoulli>;
+
+template class model<-1, distributions::BetaBernoulli>;
+template class model<2, distributions::BetaBernoulli>;
+template class model<3, distributions::BetaBernoulli>;
+template class model<4, distributions::BetaBernoulli>;
+
+} // namespace irm
+} // namespace microscopes
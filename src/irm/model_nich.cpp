@@ -0,0 +1,20 @@
+#include <microscopes/irm/model.hpp>
+
+// the states specialized for NormalInverseChiSq, see state. a translation unit of
+// their own, so that they compile in parallel with model.cpp
+
+namespace microscopes {
+namespace irm {
+
+template class state<-1, distributions::NormalInverseChiSq>;
+template class state<2, distributions::NormalInverseChiSq>;
+template class state<3, distributions::NormalInverseChiSq>;
+template class state<4, distributions::NormalInverseChiSq>;
+
+template class model<-1, distributions::NormalInverseChiSq>;
+template class model<2, distributions::NormalInverseChiSq>;
+template class model<3, distributions::NormalInverseChiSq>;
+template class model<4, distributions::NormalInverseChiSq>;
+
+} // namespace irm
+} // namespace microscopes
@@ -0,0 +1,490 @@
+#include <microscopes/irm/runner.hpp>
+#include <microscopes/irm/chromatic.hpp>
+#include <microscopes/irm/hogwild.hpp>
+#include <microscopes/irm/tempering.hpp>
+#include <microscopes/common/util.hpp>
+#include <microscopes/common/assert.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+
+using namespace std;
+using namespace microscopes::common;
+using namespace microscopes::irm;
+
+// one univariate slice sampling update of x0 (stepping out, then
+// shrinkage; Neal 2003) under the log density logp
+template <typename F>
+static float
+slice_sample(float x0, float w, F logp, rng_t &rng)
+{
+  // bounds the stepping out to an interval of width at most 2*MaxSteps*w
+  static const size_t MaxSteps = 32;
+
+  uniform_real_distribution<float> unif(0., 1.);
+  const float fx0 = logp(x0);
+  MICROSCOPES_DCHECK(!isnan(fx0) && fx0 > -numeric_limits<float>::infinity(),
+      "slice sampler started outside of the support");
+  const float y = fx0 + log(unif(rng));
+
+  float left = x0 - w * unif(rng);
+  float right = left + w;
+  for (size_t i = 0; i < MaxSteps && logp(left) > y; i++)
+    left -= w;
+  for (size_t i = 0; i < MaxSteps && logp(right) > y; i++)
+    right += w;
+
+  for (;;) {
+    const float x1 = left + (right - left) * unif(rng);
+    if (logp(x1) > y)
+      return x1;
+    if (x1 == x0)
+      // the interval has shrunk down to x0 (float precision)
+      return x0;
+    if (x1 < x0)
+      left = x1;
+    else
+      right = x1;
+  }
+}
+
+runner::runner(const vector<shared_ptr<entity_based_state_object>> &models)
+  : models_(models), kernels_(), perm_(), fresh_(), scores_()
+{
+  MICROSCOPES_DCHECK(models.size(), "no models given");
+  for (const auto &m : models)
+    MICROSCOPES_DCHECK(m.get(), "null model given");
+}
+
+void
+runner::add_assign(size_t domain)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  kernels_.emplace_back(KERNEL_ASSIGN, domain);
+}
+
+void
+runner::add_assign_resample(size_t domain, size_t m)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  MICROSCOPES_DCHECK(m >= 1, "m must be positive");
+  kernel_t k(KERNEL_ASSIGN_RESAMPLE, domain);
+  k.m_ = m;
+  kernels_.push_back(k);
+}
+
+void
+runner::add_chromatic_assign(size_t domain, size_t nthreads, size_t max_batch)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+  MICROSCOPES_DCHECK(max_batch >= 1, "max_batch must be positive");
+  MICROSCOPES_CHECK(dynamic_cast<chromatic_assignable *>(models_[domain].get()),
+      "model does not support chromatic assign");
+  kernel_t k(KERNEL_CHROMATIC_ASSIGN, domain);
+  k.pool_ = make_shared<detail::thread_pool>(nthreads);
+  k.max_batch_ = max_batch;
+  kernels_.push_back(k);
+}
+
+void
+runner::add_hogwild_assign(size_t domain, size_t nthreads, size_t max_staleness)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  MICROSCOPES_DCHECK(nthreads >= 1, "need at least one thread");
+  MICROSCOPES_DCHECK(max_staleness >= 1, "max_staleness must be positive");
+  MICROSCOPES_CHECK(dynamic_cast<hogwild_assignable *>(models_[domain].get()),
+      "model does not support hogwild assign");
+  kernel_t k(KERNEL_HOGWILD_ASSIGN, domain);
+  k.pool_ = make_shared<detail::thread_pool>(nthreads);
+  k.max_staleness_ = max_staleness;
+  kernels_.push_back(k);
+}
+
+vector<pair<size_t, hogwild_report>>
+runner::hogwild_reports() const
+{
+  vector<pair<size_t, hogwild_report>> ret;
+  for (const auto &k : kernels_)
+    if (k.type_ == KERNEL_HOGWILD_ASSIGN)
+      ret.emplace_back(k.id_, k.report_);
+  return ret;
+}
+
+void
+runner::add_split_merge(size_t domain, size_t nproposals, size_t nscans)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  MICROSCOPES_CHECK(dynamic_cast<split_mergeable *>(models_[domain].get()),
+      "model does not support split merge");
+  kernel_t k(KERNEL_SPLIT_MERGE, domain);
+  k.nproposals_ = nproposals;
+  k.nscans_ = nscans;
+  kernels_.push_back(k);
+}
+
+vector<pair<size_t, split_merge_report>>
+runner::split_merge_reports() const
+{
+  vector<pair<size_t, split_merge_report>> ret;
+  for (const auto &k : kernels_)
+    if (k.type_ == KERNEL_SPLIT_MERGE)
+      ret.emplace_back(k.id_, k.split_merge_report_);
+  return ret;
+}
+
+void
+runner::add_slice_cluster_hp(size_t domain,
+                             const string &key,
+                             const log_prior_t &prior,
+                             float w)
+{
+  MICROSCOPES_DCHECK(domain < models_.size(), "invalid domain");
+  MICROSCOPES_DCHECK(prior, "no prior given");
+  MICROSCOPES_DCHECK(w > 0., "w must be positive");
+  kernel_t k(KERNEL_SLICE_CLUSTER_HP, domain);
+  k.key_ = key;
+  k.prior_ = prior;
+  k.w_ = w;
+  kernels_.push_back(k);
+}
+
+void
+runner::add_slice_relation_hp(size_t relation,
+                              const string &key,
+                              const log_prior_t &prior,
+                              float w)
+{
+  MICROSCOPES_DCHECK(relation < models_.front()->ncomponents(), "invalid relation");
+  MICROSCOPES_DCHECK(prior, "no prior given");
+  MICROSCOPES_DCHECK(w > 0., "w must be positive");
+  kernel_t k(KERNEL_SLICE_RELATION_HP, relation);
+  k.key_ = key;
+  k.prior_ = prior;
+  k.w_ = w;
+  kernels_.push_back(k);
+}
+
+void
+runner::run(rng_t &rng, size_t niters)
+{
+  for (size_t i = 0; i < niters; i++) {
+    for (auto &k : kernels_) {
+      switch (k.type_) {
+      case KERNEL_ASSIGN:
+        assign(*models_[k.id_], rng);
+        break;
+      case KERNEL_ASSIGN_RESAMPLE:
+        assign_resample(*models_[k.id_], k.m_, rng);
+        break;
+      case KERNEL_CHROMATIC_ASSIGN:
+        dynamic_cast<chromatic_assignable &>(*models_[k.id_]).chromatic_assign(
+            *k.pool_, k.max_batch_, rng);
+        break;
+      case KERNEL_HOGWILD_ASSIGN:
+        k.report_.merge(
+            dynamic_cast<hogwild_assignable &>(*models_[k.id_]).hogwild_assign(
+              *k.pool_, k.max_staleness_, rng));
+        break;
+      case KERNEL_SPLIT_MERGE:
+        k.split_merge_report_.merge(
+            dynamic_cast<split_mergeable &>(*models_[k.id_]).split_merge(
+              k.nproposals_, k.nscans_, rng));
+        break;
+      case KERNEL_SLICE_CLUSTER_HP:
+        slice_cluster_hp(k, rng);
+        break;
+      case KERNEL_SLICE_RELATION_HP:
+        slice_relation_hp(k, rng);
+        break;
+      }
+    }
+  }
+}
+
+void
+runner::assign(entity_based_state_object &m, rng_t &rng)
+{
+  perm_.resize(m.nentities());
+  iota(perm_.begin(), perm_.end(), 0);
+  shuffle(perm_.begin(), perm_.end(), rng);
+  for (auto eid : perm_) {
+    const size_t gid = m.remove_value(eid, rng);
+    if (!m.groupsize(gid))
+      m.delete_group(gid);
+    // proposes a new group
+    const size_t egid = m.create_group(rng);
+    m.inplace_score_value(scores_, eid, rng);
+    const size_t choice =
+      scores_.first[util::sample_discrete_log(scores_.second, rng)];
+    m.add_value(choice, eid, rng);
+    if (choice != egid)
+      m.delete_group(egid);
+  }
+}
+
+void
+runner::assign_resample(entity_based_state_object &m, size_t nfresh, rng_t &rng)
+{
+  perm_.resize(m.nentities());
+  iota(perm_.begin(), perm_.end(), 0);
+  shuffle(perm_.begin(), perm_.end(), rng);
+  for (auto eid : perm_) {
+    const size_t gid = m.remove_value(eid, rng);
+    if (!m.groupsize(gid))
+      m.delete_group(gid);
+    // the fresh groups draw their parameters from the prior
+    fresh_.clear();
+    for (size_t i = 0; i < nfresh; i++)
+      fresh_.push_back(m.create_group(rng));
+    m.inplace_score_value(scores_, eid, rng);
+    const size_t choice =
+      scores_.first[util::sample_discrete_log(scores_.second, rng)];
+    m.add_value(choice, eid, rng);
+    for (auto egid : fresh_)
+      if (egid != choice)
+        m.delete_group(egid);
+  }
+}
+
+void
+runner::slice_cluster_hp(const kernel_t &k, rng_t &rng)
+{
+  entity_based_state_object &m = *models_[k.id_];
+  value_mutator mut = m.get_cluster_hp_mutator(k.key_);
+  auto logp = [&](float x) {
+    mut.set(x);
+    return k.prior_(x) + m.score_assignment();
+  };
+  const float x0 = mut.accessor().get<float>();
+  try {
+    mut.set(slice_sample(x0, k.w_, logp, rng));
+  } catch (...) {
+    mut.set(x0);
+    throw;
+  }
+}
+
+void
+runner::slice_relation_hp(const kernel_t &k, rng_t &rng)
+{
+  // every model shares the relations of the state
+  entity_based_state_object &m = *models_.front();
+  value_mutator mut = m.get_component_hp_mutator(k.id_, k.key_);
+  auto logp = [&](float x) {
+    mut.set(x);
+    return k.prior_(x) + m.score_likelihood(k.id_, rng);
+  };
+  const float x0 = mut.accessor().get<float>();
+  try {
+    mut.set(slice_sample(x0, k.w_, logp, rng));
+  } catch (...) {
+    mut.set(x0);
+    throw;
+  }
+}
+
+multi_chain_runner::multi_chain_runner(
+    const vector<vector<shared_ptr<entity_based_state_object>>> &chains,
+    size_t nthreads)
+  : chains_(chains), runners_(), pool_(nthreads), seeds_()
+{
+  MICROSCOPES_DCHECK(chains.size(), "no chains given");
+  runners_.reserve(chains.size());
+  for (const auto &c : chains) {
+    MICROSCOPES_CHECK(c.size() == chains.front().size(),
+        "chains differ in domains");
+    runners_.emplace_back(c);
+  }
+}
+
+void
+multi_chain_runner::add_assign(size_t domain)
+{
+  for (auto &r : runners_)
+    r.add_assign(domain);
+}
+
+void
+multi_chain_runner::add_split_merge(size_t domain, size_t nproposals, size_t nscans)
+{
+  for (auto &r : runners_)
+    r.add_split_merge(domain, nproposals, nscans);
+}
+
+void
+multi_chain_runner::add_slice_cluster_hp(size_t domain,
+                                         const string &key,
+                                         const runner::log_prior_t &prior,
+                                         float w)
+{
+  for (auto &r : runners_)
+    r.add_slice_cluster_hp(domain, key, prior, w);
+}
+
+void
+multi_chain_runner::add_slice_relation_hp(size_t relation,
+                                          const string &key,
+                                          const runner::log_prior_t &prior,
+                                          float w)
+{
+  for (auto &r : runners_)
+    r.add_slice_relation_hp(relation, key, prior, w);
+}
+
+void
+multi_chain_runner::reseed(rng_t &rng)
+{
+  seeds_.resize(runners_.size());
+  for (auto &s : seeds_)
+    s = rng();
+}
+
+void
+multi_chain_runner::run(rng_t &rng, size_t niters)
+{
+  reseed(rng);
+  pool_.parallel_for(runners_.size(),
+    [this, niters](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        rng_t r(this->seeds_[i]);
+        this->runners_[i].run(r, niters);
+      }
+    });
+}
+
+vector<multi_chain_runner::chain_summary>
+multi_chain_runner::summaries(rng_t &rng)
+{
+  reseed(rng);
+  vector<chain_summary> ret(chains_.size());
+  pool_.parallel_for(chains_.size(),
+    [this, &ret](size_t, size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        rng_t r(this->seeds_[i]);
+        chain_summary &s = ret[i];
+        for (const auto &m : this->chains_[i]) {
+          s.ngroups_.push_back(m->ngroups());
+          s.score_assignment_ += m->score_assignment();
+        }
+        // every model of a chain shares its relations
+        const auto &m = *this->chains_[i].front();
+        for (size_t rid = 0; rid < m.ncomponents(); rid++)
+          s.score_likelihood_ += m.score_likelihood(rid, r);
+      }
+    });
+  return ret;
+}
+
+tempering_runner::tempering_runner(
+    const vector<vector<shared_ptr<entity_based_state_object>>> &chains,
+    const vector<float> &betas,
+    size_t nthreads)
+  : chains_(chains), betas_(betas), runner_(chains, nthreads),
+    replicas_(chains.size()), attempts_(), accepts_(), parity_(0)
+{
+  MICROSCOPES_DCHECK(chains.size() == betas.size(), "one beta per replica");
+  MICROSCOPES_CHECK(betas.front() == 1., "the ladder must start at beta = 1");
+  for (size_t k = 1; k < betas.size(); k++)
+    MICROSCOPES_CHECK(betas[k] > 0. && betas[k] < betas[k - 1],
+        "the ladder must be decreasing and positive");
+  for (const auto &c : chains)
+    for (const auto &m : c)
+      MICROSCOPES_CHECK(dynamic_cast<temperable *>(m.get()),
+          "model does not support tempering");
+  if (betas.size() > 1) {
+    attempts_.resize(betas.size() - 1);
+    accepts_.resize(betas.size() - 1);
+  }
+  for (size_t k = 0; k < replicas_.size(); k++)
+    set_rung(k, k);
+}
+
+void
+tempering_runner::add_assign(size_t domain)
+{
+  runner_.add_assign(domain);
+}
+
+void
+tempering_runner::add_split_merge(size_t domain, size_t nproposals, size_t nscans)
+{
+  runner_.add_split_merge(domain, nproposals, nscans);
+}
+
+void
+tempering_runner::add_slice_cluster_hp(size_t domain,
+                                       const string &key,
+                                       const runner::log_prior_t &prior,
+                                       float w)
+{
+  runner_.add_slice_cluster_hp(domain, key, prior, w);
+}
+
+void
+tempering_runner::add_slice_relation_hp(size_t relation,
+                                        const string &key,
+                                        const runner::log_prior_t &prior,
+                                        float w)
+{
+  runner_.add_slice_relation_hp(relation, key, prior, w);
+}
+
+void
+tempering_runner::set_rung(size_t replica, size_t k)
+{
+  replicas_[k] = replica;
+  // the models of a replica share its state
+  dynamic_cast<temperable &>(*chains_[replica].front())
+    .set_inverse_temperature(betas_[k]);
+}
+
+void
+tempering_runner::run(rng_t &rng, size_t niters, size_t swap_every)
+{
+  MICROSCOPES_DCHECK(swap_every >= 1, "swap_every must be positive");
+  for (size_t i = 0; i < niters; i += swap_every) {
+    const size_t n = min(swap_every, niters - i);
+    runner_.run(rng, n);
+    if (n == swap_every)
+      propose_swaps(rng);
+  }
+}
+
+void
+tempering_runner::propose_swaps(rng_t &rng)
+{
+  if (replicas_.size() < 2)
+    return;
+  // the likelihoods come back tempered by each replica's beta
+  const auto summaries = runner_.summaries(rng);
+  vector<float> likelihoods(replicas_.size());
+  for (size_t k = 0; k < replicas_.size(); k++)
+    likelihoods[k] = summaries[replicas_[k]].score_likelihood_ / betas_[k];
+
+  uniform_real_distribution<float> unif(0., 1.);
+  for (size_t k = parity_; k + 1 < replicas_.size(); k += 2) {
+    attempts_[k]++;
+    const float logp =
+      (betas_[k] - betas_[k + 1]) * (likelihoods[k + 1] - likelihoods[k]);
+    if (logp < 0. && log(unif(rng)) >= logp)
+      continue;
+    accepts_[k]++;
+    const size_t r = replicas_[k];
+    set_rung(replicas_[k + 1], k);
+    set_rung(r, k + 1);
+  }
+  parity_ ^= 1;
+}
+
+vector<float>
+tempering_runner::swap_rates() const
+{
+  vector<float> ret(attempts_.size());
+  for (size_t k = 0; k < attempts_.size(); k++)
+    ret[k] = attempts_[k] ? float(accepts_[k]) / float(attempts_[k]) : 0.;
+  return ret;
+}
@@ -0,0 +1,209 @@
+#include <microscopes/irm/transport.hpp>
+#include <microscopes/common/assert.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace microscopes::irm;
+
+// how long a rank waits for rank 0 to start listening
+static const chrono::seconds ConnectTimeout(60);
+
+static void
+check_errno(bool ok, const char *what)
+{
+  if (!ok)
+    throw runtime_error(string(what) + ": " + strerror(errno));
+}
+
+static void
+write_all(int fd, const void *buf, size_t n)
+{
+  const char *p = static_cast<const char *>(buf);
+  while (n) {
+    const ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR)
+      continue;
+    check_errno(r > 0, "send");
+    p += r;
+    n -= r;
+  }
+}
+
+static void
+read_all(int fd, void *buf, size_t n)
+{
+  char *p = static_cast<char *>(buf);
+  while (n) {
+    const ssize_t r = recv(fd, p, n, 0);
+    if (r < 0 && errno == EINTR)
+      continue;
+    MICROSCOPES_CHECK(r, "peer closed the connection");
+    check_errno(r > 0, "recv");
+    p += r;
+    n -= r;
+  }
+}
+
+// messages go out length prefixed
+static void
+send_message(int fd, const string &msg)
+{
+  const uint64_t n = msg.size();
+  write_all(fd, &n, sizeof(n));
+  write_all(fd, msg.data(), msg.size());
+}
+
+static string
+recv_message(int fd)
+{
+  uint64_t n;
+  read_all(fd, &n, sizeof(n));
+  string msg(n, '\0');
+  read_all(fd, &msg[0], n);
+  return msg;
+}
+
+static sockaddr_un
+socket_address(const string &path)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  MICROSCOPES_CHECK(path.size() < sizeof(addr.sun_path), "socket path too long");
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+unix_socket_transport::unix_socket_transport(
+    const string &path, size_t rank, size_t size)
+  : path_(path), rank_(rank), size_(size), listen_fd_(-1), peers_()
+{
+  MICROSCOPES_DCHECK(rank < size, "invalid rank");
+  if (size == 1)
+    return;
+  // the destructor does not run for a constructor which throws
+  try {
+    if (!rank)
+      accept_peers();
+    else
+      connect_root();
+  } catch (...) {
+    close_all();
+    throw;
+  }
+}
+
+unix_socket_transport::~unix_socket_transport()
+{
+  close_all();
+}
+
+void
+unix_socket_transport::accept_peers()
+{
+  const sockaddr_un addr = socket_address(path_);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  check_errno(fd >= 0, "socket");
+  if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr))) {
+    // the path may well belong to someone else, so it stays
+    const int error = errno;
+    close(fd);
+    errno = error;
+    check_errno(false, "bind");
+  }
+  listen_fd_ = fd;
+  check_errno(!listen(listen_fd_, size_), "listen");
+  peers_.assign(size_, -1);
+  for (size_t i = 1; i < size_; i++) {
+    int peer;
+    do {
+      peer = accept(listen_fd_, nullptr, nullptr);
+    } while (peer < 0 && errno == EINTR);
+    check_errno(peer >= 0, "accept");
+    // the first thing a rank sends is its rank
+    uint64_t r;
+    try {
+      read_all(peer, &r, sizeof(r));
+    } catch (...) {
+      close(peer);
+      throw;
+    }
+    if (!r || r >= size_ || peers_[r] != -1) {
+      close(peer);
+      throw runtime_error("invalid rank connected");
+    }
+    peers_[r] = peer;
+  }
+}
+
+void
+unix_socket_transport::connect_root()
+{
+  const sockaddr_un addr = socket_address(path_);
+  const auto deadline = chrono::steady_clock::now() + ConnectTimeout;
+  for (;;) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    check_errno(fd >= 0, "socket");
+    if (!connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr))) {
+      peers_.assign(1, fd);
+      break;
+    }
+    const int error = errno;
+    close(fd);
+    errno = error;
+    // rank 0 is not listening yet
+    check_errno(
+        (error == ENOENT || error == ECONNREFUSED || error == EINTR) &&
+        chrono::steady_clock::now() < deadline, "connect");
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  const uint64_t r = rank_;
+  write_all(peers_[0], &r, sizeof(r));
+}
+
+void
+unix_socket_transport::close_all()
+{
+  for (auto fd : peers_)
+    if (fd >= 0)
+      close(fd);
+  peers_.clear();
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+    listen_fd_ = -1;
+  }
+}
+
+vector<string>
+unix_socket_transport::allgather(const string &msg)
+{
+  vector<string> ret(size_);
+  if (size_ == 1) {
+    ret[0] = msg;
+    return ret;
+  }
+  if (rank_) {
+    send_message(peers_[0], msg);
+    for (auto &m : ret)
+      m = recv_message(peers_[0]);
+    return ret;
+  }
+  ret[0] = msg;
+  for (size_t r = 1; r < size_; r++)
+    ret[r] = recv_message(peers_[r]);
+  for (size_t r = 1; r < size_; r++)
+    for (const auto &m : ret)
+      send_message(peers_[r], m);
+  return ret;
+}
@@ -0,0 +1,108 @@
+#include <microscopes/irm/flat_hash_map.hpp>
+#include <microscopes/common/static_vector.hpp>
+#include <microscopes/common/assert.hpp>
+
+#include <map>
+#include <random>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace microscopes::common;
+using namespace microscopes::irm::detail;
+
+typedef static_vector<size_t, 3> tuple_t;
+typedef flat_hash_map<
+  tuple_t, size_t,
+  gid_tuple_hash<tuple_t>,
+  gid_tuple_equal<tuple_t>> table_t;
+
+static tuple_t
+make_tuple3(size_t a, size_t b, size_t c)
+{
+  tuple_t t;
+  t.push_back(a);
+  t.push_back(b);
+  t.push_back(c);
+  return t;
+}
+
+static void
+assert_tables_equal(const table_t &actual, const map<tuple_t, size_t> &expected)
+{
+  MICROSCOPES_CHECK(actual.size() == expected.size(), "size");
+  size_t n = 0;
+  for (const auto &p : actual) {
+    const auto it = expected.find(p.first);
+    MICROSCOPES_CHECK(it != expected.end(), "unexpected key");
+    MICROSCOPES_CHECK(it->second == p.second, "value");
+    n++;
+  }
+  MICROSCOPES_CHECK(n == expected.size(), "iteration");
+  for (const auto &p : expected) {
+    const auto it = actual.find(p.first);
+    MICROSCOPES_CHECK(it != actual.end(), "missing key");
+    MICROSCOPES_CHECK(it->second == p.second, "value");
+  }
+}
+
+// random inserts/erases, checked against std::map
+static void
+test_random_ops()
+{
+  mt19937 r(3);
+  uniform_int_distribution<size_t> gid(0, 15);
+  table_t actual;
+  map<tuple_t, size_t> expected;
+  for (size_t i = 0; i < 100000; i++) {
+    const auto key = make_tuple3(gid(r), gid(r), gid(r));
+    if (bernoulli_distribution(0.6)(r)) {
+      actual[key] = i;
+      expected[key] = i;
+    } else {
+      MICROSCOPES_CHECK(actual.erase(key) == expected.erase(key), "erase");
+    }
+    MICROSCOPES_CHECK(actual.count(key) == expected.count(key), "count");
+  }
+  assert_tables_equal(actual, expected);
+  cout << "test_random_ops completed" << endl;
+}
+
+// erasing while iterating must visit every entry exactly once
+static void
+test_erase_while_iterating()
+{
+  table_t actual;
+  map<tuple_t, size_t> expected;
+  for (size_t i = 0; i < 1000; i++) {
+    actual[make_tuple3(i, i % 7, 0)] = i;
+    if (i % 3)
+      expected[make_tuple3(i, i % 7, 0)] = i;
+  }
+  size_t visited = 0;
+  for (auto it = actual.begin(); it != actual.end(); ) {
+    visited++;
+    if (!(it->second % 3))
+      it = actual.erase(it);
+    else
+      ++it;
+  }
+  MICROSCOPES_CHECK(visited == 1000, "visited");
+  assert_tables_equal(actual, expected);
+
+  // tombstones must not leak into lookups after re-insertion
+  for (size_t i = 0; i < 1000; i += 3) {
+    actual[make_tuple3(i, i % 7, 0)] = i;
+    expected[make_tuple3(i, i % 7, 0)] = i;
+  }
+  assert_tables_equal(actual, expected);
+  cout << "test_erase_while_iterating completed" << endl;
+}
+
+int
+main(void)
+{
+  test_random_ops();
+  test_erase_while_iterating();
+  return 0;
+}
@@ -1,10 +1,20 @@
 #include <microscopes/irm/model.hpp>
+#include <microscopes/irm/runner.hpp>
+#include <microscopes/irm/sharded.hpp>
 #include <microscopes/common/relation/dataview.hpp>
 #include <microscopes/common/random_fwd.hpp>
 #include <microscopes/models/distributions.hpp>
 
+#include <cmath>
+#include <fstream>
+#include <limits>
 #include <random>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
 
 using namespace std;
 using namespace distributions;
@@ -63,6 +73,15 @@ static void assert_sets_equal(const set<T> &as, const set<T> &bs)
                        vector<T>(bs.begin(), bs.end()));
 }
 
+// an a x b row major view over data, masked by mask
+static shared_ptr<dataview>
+make_view(void *data, bool *mask, size_t a, size_t b, primitive_type t = TYPE_B)
+{
+  return shared_ptr<dataview>(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(data), mask, {a, b}, runtime_type(t)));
+}
+
 static void
 test1()
 {
@@ -352,7 +371,7 @@ test4()
       r);
 
   const auto raw = s->serialize();
-  const auto s1 = state<5>::deserialize(defn, raw);
+  const auto s1 = state<5>::deserialize(defn, raw, r);
   MICROSCOPES_CHECK(s->ndomains() == s1->ndomains(), "ndomains");
   for (size_t i = 0; i < s->ndomains(); i++) {
     assert_vectors_equal(s->assignments(i), s1->assignments(i));
@@ -393,6 +412,2143 @@ test4()
   cout << "test4 completed" << endl;
 }
 
+// scoring an entity against a group must agree with the change in the joint
+// likelihood from actually adding the entity to the group (for conjugate
+// models, the joint predictive is the ratio of marginals)
+static void
+test5(bool conjugate)
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({20, 8});
+  const float alpha = 2.0;
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), conjugate),
+       relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), conjugate)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[1],
+      0.8, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[0], domains[1]},
+        runtime_type(TYPE_B)));
+
+  const dataset_t views({rel0view.get(), rel1view.get()});
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(alpha), crp_hp(alpha)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      views,
+      r);
+
+  for (size_t eid = 0; eid < domains[0]; eid++) {
+    const size_t gid = s->remove_value(0, eid, views, r);
+    if (s->empty_groups(0).empty())
+      s->create_group(0);
+    const auto scores = s->score_value(0, eid, views, r);
+    const float before = s->score_likelihood(r);
+
+    float pseudocounts = 0.;
+    for (auto g : scores.first)
+      pseudocounts += s->groupsize(0, g) ?
+        float(s->groupsize(0, g)) : alpha / s->empty_groups(0).size();
+
+    for (size_t i = 0; i < scores.first.size(); i++) {
+      const size_t g = scores.first[i];
+      const float pseudocount = s->groupsize(0, g) ?
+        float(s->groupsize(0, g)) : alpha / s->empty_groups(0).size();
+      s->add_value(0, g, eid, views, r);
+      const float delta = s->score_likelihood(r) - before;
+      s->remove_value(0, eid, views, r);
+      const float expected = logf(pseudocount / pseudocounts) + delta;
+      MICROSCOPES_CHECK(
+          fabs(expected - scores.second[i]) <= 1e-3 * max(1.f, fabs(expected)),
+          "score does not match likelihood delta");
+    }
+
+    s->add_value(0, gid, eid, views, r);
+  }
+
+  cout << "test5 (conjugate=" << conjugate << ") completed" << endl;
+}
+
+// conjugate relations should never hold on to empty blocks
+static void
+test7()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({25});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0,0}, make_shared<distributions_model<BetaBernoulli>>(), true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.3, bernoulli_distribution(0.6), r);
+  unique_ptr<bool[]> rel1(new bool[domains[0]*domains[0]*domains[0]]);
+  unique_ptr<bool[]> mask1(new bool[domains[0]*domains[0]*domains[0]]);
+  for (size_t i = 0; i < domains[0]*domains[0]*domains[0]; i++) {
+    rel1[i] = bernoulli_distribution(0.5)(r);
+    mask1[i] = bernoulli_distribution(0.9)(r);
+  }
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.get()),
+        mask1.get(),
+        {domains[0], domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  auto s = state<3>::initialize(
+      defn,
+      {crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 2.)},
+      {{}},
+      {rel0view.get(), rel1view.get()},
+      r);
+
+  vector<size_t> present;
+  for (size_t i = 0; i < s->nrelations(); i++) {
+    size_t sum = 0;
+    for (auto ident : s->suffstats_identifiers(i))
+      sum += s->get_suffstats_count(i, ident);
+    present.push_back(sum);
+  }
+
+  microscopes::irm::model<3> m(s, 0, {rel0view, rel1view});
+  for (size_t iter = 0; iter < 3; iter++) {
+    for (size_t i = 0; i < m.nentities(); i++) {
+      m.remove_value(i, r);
+      for (auto g : m.empty_groups())
+        m.delete_group(g);
+      m.create_group(r);
+      auto scores = m.score_value(i, r);
+      const auto choice = scores.first[util::sample_discrete_log(scores.second, r)];
+      m.add_value(choice, i, r);
+    }
+  }
+
+  for (size_t i = 0; i < s->nrelations(); i++) {
+    size_t sum = 0;
+    for (auto ident : s->suffstats_identifiers(i)) {
+      MICROSCOPES_CHECK(s->get_suffstats_count(i, ident), "empty block");
+      sum += s->get_suffstats_count(i, ident);
+    }
+    MICROSCOPES_CHECK(sum == present[i], "suff stats don't match up");
+  }
+
+  cout << "test7 completed" << endl;
+}
+
+// a gibbs sweep with group creation/deletion must behave identically with
+// sparse and dense suffstat storage
+static void
+test6()
+{
+  random_device rd;
+  const unsigned seed = rd();
+  rng_t r(seed);
+  const vector<size_t> domains({30, 10});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>())});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[1],
+      0.8, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[0], domains[1]},
+        runtime_type(TYPE_B)));
+
+  const vector<shared_ptr<dataview>> views({rel0view, rel1view});
+
+  auto sparse = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      {rel0view.get(), rel1view.get()},
+      r);
+  auto dense = state<2>::deserialize(defn, sparse->serialize(), r);
+  dense->set_dense_suffstats(0, true);
+  dense->set_dense_suffstats(1, true);
+  MICROSCOPES_CHECK(dense->dense_suffstats(0), "not dense");
+
+  rng_t r0(seed), r1(seed);
+  for (size_t d = 0; d < domains.size(); d++) {
+    microscopes::irm::model<2> m0(sparse, d, views);
+    microscopes::irm::model<2> m1(dense, d, views);
+    for (size_t iter = 0; iter < 3; iter++) {
+      for (size_t i = 0; i < m0.nentities(); i++) {
+        m0.remove_value(i, r0);
+        m1.remove_value(i, r1);
+        for (auto g : m0.empty_groups()) {
+          m0.delete_group(g);
+          m1.delete_group(g);
+        }
+        m0.create_group(r0);
+        m1.create_group(r1);
+        auto scores0 = m0.score_value(i, r0);
+        auto scores1 = m1.score_value(i, r1);
+        assert_vectors_equal(scores0.first, scores1.first);
+        for (size_t k = 0; k < scores0.second.size(); k++)
+          MICROSCOPES_CHECK(almost_eq(scores0.second[k], scores1.second[k]), "scores");
+        const auto choice = scores0.first[util::sample_discrete_log(scores0.second, r0)];
+        util::sample_discrete_log(scores1.second, r1);
+        m0.add_value(choice, i, r0);
+        m1.add_value(choice, i, r1);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < sparse->nrelations(); i++) {
+    assert_vectors_equal(sparse->suffstats_identifiers(i), dense->suffstats_identifiers(i));
+    for (auto ident : sparse->suffstats_identifiers(i))
+      MICROSCOPES_CHECK(sparse->get_suffstats_count(i, ident) ==
+          dense->get_suffstats_count(i, ident), "ss count");
+  }
+  MICROSCOPES_CHECK(
+      fabs(sparse->score_likelihood(r0) - dense->score_likelihood(r1)) <= 1e-2,
+      "likelihood");
+
+  // and back again
+  dense->set_dense_suffstats(0, false);
+  assert_vectors_equal(sparse->suffstats_identifiers(0), dense->suffstats_identifiers(0));
+
+  cout << "test6 completed" << endl;
+}
+
+// groups released to a recycling pool are handed back out, otherwise they
+// are freed
+static void
+test8()
+{
+  rng_t r;
+  const auto hypers = distributions_model<BetaBernoulli>().create_hypers();
+
+  for (bool recycle : {false, true}) {
+    detail::group_pool pool(recycle);
+    vector<detail::group_handle> handles;
+    for (size_t i = 0; i < 10; i++)
+      handles.push_back(pool.acquire(*hypers, r));
+    MICROSCOPES_CHECK(pool.size() == 10, "size");
+
+    set<microscopes::models::group *> released;
+    for (size_t i = 0; i < 10; i += 2) {
+      released.insert(handles[i].get());
+      pool.release(handles[i]);
+      MICROSCOPES_CHECK(!handles[i], "handle not reset");
+    }
+    MICROSCOPES_CHECK(pool.size() == 5, "size");
+
+    for (size_t i = 0; i < 10; i += 2)
+      handles[i] = pool.acquire(*hypers, r);
+    MICROSCOPES_CHECK(pool.size() == 10, "size");
+    if (recycle) {
+      set<microscopes::models::group *> reacquired;
+      for (size_t i = 0; i < 10; i += 2)
+        reacquired.insert(handles[i].get());
+      assert_sets_equal(released, reacquired);
+    }
+
+    for (auto &h : handles)
+      pool.release(h);
+    MICROSCOPES_CHECK(!pool.size(), "size");
+  }
+
+  cout << "test8 completed" << endl;
+}
+
+// the state specialized to BetaBernoulli must agree with the dynamic one,
+// and initialize_and_bind() must only pick it when every relation is BB
+static void
+test9()
+{
+  random_device rd;
+  const unsigned seed = rd();
+  rng_t r(seed);
+  const vector<size_t> domains({30, 10});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>())});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[1],
+      0.8, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[0], domains[1]},
+        runtime_type(TYPE_B)));
+
+  const vector<shared_ptr<dataview>> views({rel0view, rel1view});
+
+  auto dynamic = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      {rel0view.get(), rel1view.get()},
+      r);
+  auto specialized = state<2, BetaBernoulli>::deserialize(defn, dynamic->serialize(), r);
+
+  rng_t r0(seed), r1(seed);
+  for (size_t d = 0; d < domains.size(); d++) {
+    microscopes::irm::model<2> m0(dynamic, d, views);
+    microscopes::irm::model<2, BetaBernoulli> m1(specialized, d, views);
+    for (size_t iter = 0; iter < 2; iter++) {
+      for (size_t i = 0; i < m0.nentities(); i++) {
+        m0.remove_value(i, r0);
+        m1.remove_value(i, r1);
+        for (auto g : m0.empty_groups()) {
+          m0.delete_group(g);
+          m1.delete_group(g);
+        }
+        m0.create_group(r0);
+        m1.create_group(r1);
+        auto scores0 = m0.score_value(i, r0);
+        auto scores1 = m1.score_value(i, r1);
+        assert_vectors_equal(scores0.first, scores1.first);
+        for (size_t k = 0; k < scores0.second.size(); k++)
+          MICROSCOPES_CHECK(almost_eq(scores0.second[k], scores1.second[k]), "scores");
+        const auto choice = scores0.first[util::sample_discrete_log(scores0.second, r0)];
+        util::sample_discrete_log(scores1.second, r1);
+        m0.add_value(choice, i, r0);
+        m1.add_value(choice, i, r1);
+      }
+    }
+  }
+  MICROSCOPES_CHECK(
+      fabs(dynamic->score_likelihood(r0) - specialized->score_likelihood(r1)) <= 1e-2,
+      "likelihood");
+
+  auto bound = initialize_and_bind<2>(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      views,
+      r);
+  MICROSCOPES_CHECK(bound.size() == domains.size(), "bound domains");
+  typedef microscopes::irm::model<2, BetaBernoulli> specialized_model_t;
+  for (const auto &p : bound)
+    MICROSCOPES_CHECK(
+        dynamic_cast<specialized_model_t *>(p.get()),
+        "expected the specialized state");
+
+  // a mix of models must fall back to the dynamic state
+  const model_definition mixed(
+      {domains[0]},
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>())});
+  unique_ptr<float[]> reals(new float[domains[0]*domains[0]]);
+  unique_ptr<bool[]> masks(new bool[domains[0]*domains[0]]);
+  for (size_t i = 0; i < domains[0]*domains[0]; i++) {
+    reals[i] = normal_distribution<float>()(r);
+    masks[i] = bernoulli_distribution(0.5)(r);
+  }
+  shared_ptr<dataview> realsview(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(reals.get()),
+        masks.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_F32)));
+  bound = initialize_and_bind<2>(
+      mixed,
+      {crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp()},
+      {{}},
+      {rel0view, realsview},
+      r);
+  MICROSCOPES_CHECK(
+      dynamic_cast<microscopes::irm::model<2> *>(bound[0].get()),
+      "expected the dynamic state");
+
+  bool threw = false;
+  try {
+    state<2, BetaBernoulli>::unsafe_initialize(mixed);
+  } catch (const runtime_error &) {
+    threw = true;
+  }
+  MICROSCOPES_CHECK(threw, "mismatched relation model accepted");
+
+  cout << "test9 completed" << endl;
+}
+
+// the bound model reads the entity's data from its index instead of slicing
+// the dataviews, which must not change anything
+static void
+test10()
+{
+  random_device rd;
+  const unsigned seed = rd();
+  rng_t r(seed);
+  const vector<size_t> domains({20, 15});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>())});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[1], domains[0],
+      0.7, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[1], domains[0]},
+        runtime_type(TYPE_B)));
+
+  const vector<shared_ptr<dataview>> views({rel0view, rel1view});
+  const dataset_t data({rel0view.get(), rel1view.get()});
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      data,
+      r);
+
+  for (size_t d = 0; d < domains.size(); d++) {
+    microscopes::irm::model<2> m(s, d, views);
+    for (size_t i = 0; i < m.nentities(); i++) {
+      const size_t gid = m.remove_value(i, r);
+      m.create_group(r);
+      rng_t r0(seed + i), r1(seed + i);
+      auto scores0 = s->score_value(d, i, data, r0);
+      auto scores1 = m.score_value(i, r1);
+      assert_vectors_equal(scores0.first, scores1.first);
+      for (size_t k = 0; k < scores0.second.size(); k++)
+        MICROSCOPES_CHECK(almost_eq(scores0.second[k], scores1.second[k]), "scores");
+      m.add_value(gid, i, r);
+      for (auto g : m.empty_groups())
+        m.delete_group(g);
+    }
+  }
+
+  cout << "test10 completed" << endl;
+}
+
+static inline bool
+almost_eq_rel(float a, float b)
+{
+  return fabs(a - b) <= 1e-3 * max(1.f, fabs(a));
+}
+
+// implicit zeros must score exactly like the fully observed relation
+static void
+test11()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({20, 12});
+  const size_t n0 = domains[0], n1 = domains[1];
+
+  auto rel0 = binary_relation_generate(
+      n0, n0, 1., bernoulli_distribution(0.2), r);
+  auto rel1 = binary_relation_generate(
+      n0, n1, 1., bernoulli_distribution(0.1), r);
+
+  // the implicit zero dataviews only observe the true cells
+  unique_ptr<bool[]> mask0(new bool[n0*n0]), mask1(new bool[n0*n1]);
+  for (size_t i = 0; i < n0*n0; i++)
+    mask0[i] = !rel0.first[i];
+  for (size_t i = 0; i < n0*n1; i++)
+    mask1[i] = !rel1.first[i];
+
+  const vector<shared_ptr<dataview>> dense_views({
+      make_view(rel0.first.get(), rel0.second.get(), n0, n0),
+      make_view(rel1.first.get(), rel1.second.get(), n0, n1)});
+  const vector<shared_ptr<dataview>> implicit_views({
+      make_view(rel0.first.get(), mask0.get(), n0, n0),
+      make_view(rel1.first.get(), mask1.get(), n0, n1)});
+
+  const auto make_defn = [&domains](bool implicit) {
+    return model_definition(
+        domains,
+        {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), true, implicit),
+         relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true, implicit)});
+  };
+
+  vector<vector<size_t>> assignments(2);
+  for (size_t i = 0; i < n0; i++)
+    assignments[0].push_back(i % 3);
+  for (size_t i = 0; i < n1; i++)
+    assignments[1].push_back(i % 2);
+
+  auto dense = state<2>::initialize(
+      make_defn(false),
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 2.)},
+      assignments,
+      {dense_views[0].get(), dense_views[1].get()},
+      r);
+  auto implicit = state<2>::initialize(
+      make_defn(true),
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 2.)},
+      assignments,
+      {implicit_views[0].get(), implicit_views[1].get()},
+      r);
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        dense->score_likelihood(i, r), implicit->score_likelihood(i, r)),
+        "likelihood");
+
+  for (size_t d = 0; d < domains.size(); d++) {
+    microscopes::irm::model<2> m0(dense, d, dense_views);
+    microscopes::irm::model<2> m1(implicit, d, implicit_views);
+    for (size_t iter = 0; iter < 2; iter++) {
+      for (size_t i = 0; i < m0.nentities(); i++) {
+        m0.remove_value(i, r);
+        m1.remove_value(i, r);
+        for (auto g : m0.empty_groups()) {
+          m0.delete_group(g);
+          m1.delete_group(g);
+        }
+        m0.create_group(r);
+        m1.create_group(r);
+        auto scores0 = m0.score_value(i, r);
+        auto scores1 = m1.score_value(i, r);
+        assert_vectors_equal(scores0.first, scores1.first);
+        for (size_t k = 0; k < scores0.second.size(); k++)
+          MICROSCOPES_CHECK(almost_eq_rel(scores0.second[k], scores1.second[k]), "scores");
+        const auto choice = scores0.first[util::sample_discrete_log(scores0.second, r)];
+        m0.add_value(choice, i, r);
+        m1.add_value(choice, i, r);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        dense->score_likelihood(i, r), implicit->score_likelihood(i, r)),
+        "likelihood");
+
+  // a round trip through serialization keeps the counts
+  auto implicit1 = state<2>::deserialize(make_defn(true), implicit->serialize(), r);
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        implicit->score_likelihood(i, r), implicit1->score_likelihood(i, r)),
+        "likelihood");
+
+  cout << "test11 completed" << endl;
+}
+
+static float
+log_exponential(float x)
+{
+  return x > 0. ? -x : -numeric_limits<float>::infinity();
+}
+
+static bool
+failing_log_prior(void *, float, float *)
+{
+  return false;
+}
+
+// the native runner must leave behind a consistent state
+static void
+test12()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({25, 10});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>())});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[1],
+      0.8, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[0], domains[1]},
+        runtime_type(TYPE_B)));
+
+  const vector<shared_ptr<dataview>> views({rel0view, rel1view});
+  const dataset_t data({rel0view.get(), rel1view.get()});
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {{}, {}},
+      data,
+      r);
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  for (size_t d = 0; d < domains.size(); d++) {
+    runner.add_assign(d);
+    runner.add_slice_cluster_hp(d, "alpha", log_exponential, 0.5);
+  }
+  runner.add_assign_resample(1, 3);
+  runner.add_slice_relation_hp(0, "alpha", log_exponential, 0.5);
+  runner.add_slice_relation_hp(1, "beta", log_exponential, 0.5);
+  runner.run(r, 20);
+
+  vector<vector<size_t>> assignments;
+  for (size_t d = 0; d < domains.size(); d++) {
+    MICROSCOPES_CHECK(s->empty_groups(d).empty(), "empty groups");
+    MICROSCOPES_CHECK(models[d]->get_cluster_hp_mutator("alpha").accessor().get<float>() > 0., "alpha");
+    size_t n = 0;
+    for (auto g : s->groups(d))
+      n += s->groupsize(d, g);
+    MICROSCOPES_CHECK(n == domains[d], "group sizes");
+    assignments.emplace_back();
+    for (auto g : s->assignments(d)) {
+      MICROSCOPES_CHECK(g >= 0, "unassigned entity");
+      assignments.back().push_back(g);
+    }
+  }
+
+  // the blocks must agree with a state built from scratch out of the same
+  // assignments and hypers
+  auto s1 = state<2>::initialize(
+      defn,
+      {s->get_domain_hp(0), s->get_domain_hp(1)},
+      {s->get_relation_hp(0), s->get_relation_hp(1)},
+      assignments,
+      data,
+      r);
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        s->score_likelihood(i, r), s1->score_likelihood(i, r)),
+        "likelihood");
+
+  // a log prior which fails aborts the run, and puts the hyperparameter back
+  microscopes::irm::runner failing(models);
+  failing.add_slice_cluster_hp(0, "alpha",
+      microscopes::irm::runner::callback_log_prior(failing_log_prior, nullptr), 0.5);
+  const float alpha =
+    models[0]->get_cluster_hp_mutator("alpha").accessor().get<float>();
+  bool aborted = false;
+  try {
+    failing.run(r, 1);
+  } catch (const microscopes::irm::runner::log_prior_error &) {
+    aborted = true;
+  }
+  MICROSCOPES_CHECK(aborted, "run went on past a failed log prior");
+  MICROSCOPES_CHECK(
+      models[0]->get_cluster_hp_mutator("alpha").accessor().get<float>() == alpha,
+      "alpha was left at a trial value");
+
+  cout << "test12 completed" << endl;
+}
+
+// scoring the candidate groups in parallel must not change the scores
+static void
+test13(bool conjugate)
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({60, 15});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), conjugate),
+       relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), conjugate)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[0],
+      0.5, bernoulli_distribution(0.6), r);
+
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[1],
+      0.8, bernoulli_distribution(0.3), r);
+
+  shared_ptr<dataview> rel0view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel0.first.get()),
+        rel0.second.get(),
+        {domains[0], domains[0]},
+        runtime_type(TYPE_B)));
+
+  shared_ptr<dataview> rel1view(
+    new row_major_dense_dataview(
+        reinterpret_cast<uint8_t*>(rel1.first.get()),
+        rel1.second.get(),
+        {domains[0], domains[1]},
+        runtime_type(TYPE_B)));
+
+  const dataset_t data({rel0view.get(), rel1view.get()});
+
+  vector<size_t> assignment0;
+  for (size_t i = 0; i < domains[0]; i++)
+    assignment0.push_back(i % 20);
+
+  auto serial = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.)},
+      {assignment0, {}},
+      data,
+      r);
+  auto parallel = state<2>::deserialize(defn, serial->serialize(), r);
+  parallel->set_score_threads(4);
+  MICROSCOPES_CHECK(parallel->score_threads() == 4, "threads");
+
+  for (size_t i = 0; i < domains[0]; i++) {
+    const size_t gid = serial->remove_value(0, i, data, r);
+    MICROSCOPES_CHECK(parallel->remove_value(0, i, data, r) == gid, "remove");
+    MICROSCOPES_CHECK(serial->create_group(0) == parallel->create_group(0), "create");
+    auto scores0 = serial->score_value(0, i, data, r);
+    auto scores1 = parallel->score_value(0, i, data, r);
+    assert_vectors_equal(scores0.first, scores1.first);
+    for (size_t k = 0; k < scores0.second.size(); k++)
+      MICROSCOPES_CHECK(almost_eq_rel(scores0.second[k], scores1.second[k]), "scores");
+    serial->add_value(0, gid, i, data, r);
+    parallel->add_value(0, gid, i, data, r);
+    const vector<size_t> egids(
+        serial->empty_groups(0).begin(), serial->empty_groups(0).end());
+    for (auto g : egids) {
+      serial->delete_group(0, g);
+      parallel->delete_group(0, g);
+    }
+  }
+
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        serial->score_likelihood(i, r), parallel->score_likelihood(i, r)),
+        "likelihood");
+
+  cout << "test13 completed" << endl;
+}
+
+// spreading an entity's relations over threads must not change anything
+static void
+test14()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({30, 12, 8});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({2,0}, make_shared<distributions_model<NormalInverseChiSq>>()),
+       relation_definition({1,2}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,2}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.5, bernoulli_distribution(0.6), r);
+  auto rel2 = binary_relation_generate(
+      domains[2], domains[0], 0.7, normal_distribution<float>(1., 2.), r);
+  auto rel3 = binary_relation_generate(
+      domains[1], domains[2], 0.7, bernoulli_distribution(0.5), r);
+
+  auto rel4 = binary_relation_generate(
+      domains[0], domains[2], 1., bernoulli_distribution(0.2), r);
+  // implicit zeros: only the true cells are observed
+  unique_ptr<bool[]> mask4(new bool[domains[0]*domains[2]]);
+  for (size_t i = 0; i < domains[0]*domains[2]; i++)
+    mask4[i] = !rel4.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_B),
+      make_view(rel2.first.get(), rel2.second.get(), domains[2], domains[0], TYPE_F32),
+      make_view(rel3.first.get(), rel3.second.get(), domains[1], domains[2], TYPE_B),
+      make_view(rel4.first.get(), mask4.get(), domains[0], domains[2], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  auto serial = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(2., 3.), nich_hp(),
+       beta_bernoulli_hp(1., 1.), beta_bernoulli_hp(1., 4.)},
+      {{}, {}, {}},
+      data,
+      r);
+  auto parallel = state<2>::deserialize(defn, serial->serialize(), r);
+  parallel->set_relation_threads(3);
+  MICROSCOPES_CHECK(parallel->relation_threads() == 3, "threads");
+
+  for (size_t d = 0; d < domains.size(); d++) {
+    microscopes::irm::model<2> m(parallel, d, views);
+    for (size_t i = 0; i < domains[d]; i++) {
+      const size_t gid = serial->remove_value(d, i, data, r);
+      MICROSCOPES_CHECK(m.remove_value(i, r) == gid, "remove");
+      MICROSCOPES_CHECK(serial->create_group(d) == m.create_group(r), "create");
+      auto scores0 = serial->score_value(d, i, data, r);
+      auto scores1 = m.score_value(i, r);
+      auto scores2 = parallel->score_value(d, i, data, r);
+      assert_vectors_equal(scores0.first, scores1.first);
+      assert_vectors_equal(scores0.first, scores2.first);
+      for (size_t k = 0; k < scores0.second.size(); k++) {
+        MICROSCOPES_CHECK(almost_eq_rel(scores0.second[k], scores1.second[k]), "scores");
+        MICROSCOPES_CHECK(almost_eq_rel(scores0.second[k], scores2.second[k]), "scores");
+      }
+      // move every other entity to the new group
+      const size_t to = (i % 2) ? scores0.first.back() : gid;
+      serial->add_value(d, to, i, data, r);
+      m.add_value(to, i, r);
+      const auto egids = m.empty_groups();
+      for (auto g : egids) {
+        serial->delete_group(d, g);
+        m.delete_group(g);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < defn.relations().size(); i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        serial->score_likelihood(i, r), parallel->score_likelihood(i, r)),
+        "likelihood");
+
+  // the implicit zero hyperparameters take effect right away, whether set
+  // or mutated
+  const float before = serial->score_likelihood(4, r);
+  parallel->get_relation_hp_mutator(4, "alpha").set(3.f);
+  parallel->get_relation_hp_mutator(4, "beta").set(4.f);
+  distributions_hypers<BetaBernoulli>::message_type hp4;
+  hp4.set_alpha(3.);
+  hp4.set_beta(4.);
+  serial->set_relation_hp(4, util::protobuf_to_string(hp4));
+  const float after = serial->score_likelihood(4, r);
+  MICROSCOPES_CHECK(!almost_eq_rel(before, after), "implicit hp ignored");
+  MICROSCOPES_CHECK(almost_eq_rel(after, parallel->score_likelihood(4, r)), "implicit hp");
+
+  cout << "test14 completed" << endl;
+}
+
+// a sharded initialize must build the same blocks as a serial one
+static void
+test15()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({40, 25});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>()),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>()),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true),
+       relation_definition({1,1}, make_shared<distributions_model<BetaBernoulli>>(), false)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.7, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  auto rel3 = binary_relation_generate(
+      domains[1], domains[1], 0.6, bernoulli_distribution(0.5), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B),
+      make_view(rel3.first.get(), rel3.second.get(), domains[1], domains[1], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  vector<vector<size_t>> assignments(2);
+  for (size_t i = 0; i < domains[0]; i++)
+    assignments[0].push_back(i % 7);
+  for (size_t i = 0; i < domains[1]; i++)
+    assignments[1].push_back(i % 4);
+
+  const auto init = [&](size_t nthreads) {
+    return state<2>::initialize(
+        defn,
+        {crp_hp(2.0), crp_hp(2.0)},
+        {beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.),
+         beta_bernoulli_hp(1., 1.)},
+        assignments,
+        data,
+        r,
+        nthreads);
+  };
+  auto serial = init(1);
+  auto sharded = init(4);
+
+  for (size_t i = 0; i < defn.relations().size(); i++) {
+    MICROSCOPES_CHECK(
+        serial->suffstats_identifiers(i).size() ==
+        sharded->suffstats_identifiers(i).size(), "# blocks");
+    MICROSCOPES_CHECK(almost_eq_rel(
+        serial->score_likelihood(i, r), sharded->score_likelihood(i, r)),
+        "likelihood");
+  }
+  // counts add up exactly
+  suffstats_bag_t ss0, ss1;
+  for (size_t g0 = 0; g0 < 7; g0++)
+    for (size_t g1 = 0; g1 < 4; g1++) {
+      const bool found = serial->get_suffstats(0, {g0, g1}, ss0);
+      MICROSCOPES_CHECK(found == sharded->get_suffstats(0, {g0, g1}, ss1), "block");
+      MICROSCOPES_CHECK(!found || ss0 == ss1, "suffstats");
+    }
+
+  // and the state keeps working as usual
+  microscopes::irm::model<2> m(sharded, 0, views);
+  for (size_t i = 0; i < domains[0]; i++) {
+    const size_t gid = m.remove_value(i, r);
+    m.add_value(gid, i, r);
+  }
+  for (size_t i = 0; i < defn.relations().size(); i++)
+    MICROSCOPES_CHECK(almost_eq_rel(
+        serial->score_likelihood(i, r), sharded->score_likelihood(i, r)),
+        "likelihood");
+
+  cout << "test15 completed" << endl;
+}
+
+// the chromatic assign kernel must leave a consistent state behind
+static void
+test16()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({40, 12});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  // sparse enough for domain 0 to get several entities per color
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.05, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const vector<hyperparam_bag_t> relation_hps({
+      beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.)});
+  auto s = state<2>::initialize(
+      defn, {crp_hp(2.0), crp_hp(2.0)}, relation_hps, {{}, {}}, data, r);
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  runner.add_chromatic_assign(0, 4, 8);
+  runner.add_chromatic_assign(1, 3, 16);
+  runner.run(r, 10);
+
+  vector<vector<size_t>> assignments;
+  for (size_t d = 0; d < domains.size(); d++) {
+    MICROSCOPES_CHECK(s->empty_groups(d).empty(), "empty groups");
+    size_t n = 0;
+    for (auto g : s->groups(d))
+      n += s->groupsize(d, g);
+    MICROSCOPES_CHECK(n == domains[d], "group sizes");
+    assignments.emplace_back();
+    for (auto g : s->assignments(d)) {
+      MICROSCOPES_CHECK(g >= 0, "unassigned entity");
+      assignments.back().push_back(g);
+    }
+  }
+
+  auto s1 = state<2>::initialize(
+      defn,
+      {s->get_domain_hp(0), s->get_domain_hp(1)},
+      relation_hps,
+      assignments,
+      data,
+      r);
+  for (size_t i = 0; i < defn.relations().size(); i++) {
+    MICROSCOPES_CHECK(
+        s->suffstats_identifiers(i).size() ==
+        s1->suffstats_identifiers(i).size(), "# blocks");
+    MICROSCOPES_CHECK(almost_eq_rel(
+        s->score_likelihood(i, r), s1->score_likelihood(i, r)),
+        "likelihood");
+  }
+
+  cout << "test16 completed" << endl;
+}
+
+// the hogwild assign kernel must leave a consistent state behind, whatever
+// the workers saw
+static void
+test17()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({60, 12});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.1, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const vector<hyperparam_bag_t> relation_hps({
+      beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.)});
+  auto s = state<2>::initialize(
+      defn, {crp_hp(2.0), crp_hp(2.0)}, relation_hps, {{}, {}}, data, r);
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  runner.add_hogwild_assign(0, 4, 3);
+  runner.add_hogwild_assign(1, 1, 5);
+  runner.run(r, 10);
+
+  const auto reports = runner.hogwild_reports();
+  MICROSCOPES_CHECK(reports.size() == 2, "reports");
+  MICROSCOPES_CHECK(reports[0].first == 0, "domain");
+  // 4 workers of 15 entities, syncing every 3
+  MICROSCOPES_CHECK(reports[0].second.nsyncs_ == 10 * 4 * 5, "syncs");
+  MICROSCOPES_CHECK(
+      reports[0].second.mean_pending() <= reports[0].second.max_pending_, "pending");
+  // a single worker is never behind
+  MICROSCOPES_CHECK(reports[1].second.nsyncs_ == 10 * 3, "syncs");
+  MICROSCOPES_CHECK(!reports[1].second.max_pending_, "pending");
+
+  vector<vector<size_t>> assignments;
+  for (size_t d = 0; d < domains.size(); d++) {
+    MICROSCOPES_CHECK(s->empty_groups(d).empty(), "empty groups");
+    size_t n = 0;
+    for (auto g : s->groups(d))
+      n += s->groupsize(d, g);
+    MICROSCOPES_CHECK(n == domains[d], "group sizes");
+    assignments.emplace_back();
+    for (auto g : s->assignments(d)) {
+      MICROSCOPES_CHECK(g >= 0, "unassigned entity");
+      assignments.back().push_back(g);
+    }
+  }
+
+  auto s1 = state<2>::initialize(
+      defn,
+      {s->get_domain_hp(0), s->get_domain_hp(1)},
+      relation_hps,
+      assignments,
+      data,
+      r);
+  for (size_t i = 0; i < defn.relations().size(); i++) {
+    MICROSCOPES_CHECK(
+        s->suffstats_identifiers(i).size() ==
+        s1->suffstats_identifiers(i).size(), "# blocks");
+    MICROSCOPES_CHECK(almost_eq_rel(
+        s->score_likelihood(i, r), s1->score_likelihood(i, r)),
+        "likelihood");
+  }
+
+  cout << "test17 completed" << endl;
+}
+
+// ranks of a sharded run (threads here, over the unix socket transport)
+// must end up with identical replicas, consistent with their assignments
+static void
+test18()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({60, 12});
+  const size_t nranks = 3;
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true),
+       relation_definition({1,1}, make_shared<distributions_model<NormalInverseChiSq>>(), true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[1], 0.7, normal_distribution<float>(1., 2.), r);
+  unique_ptr<bool[]> mask1(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask1[i] = !rel1.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), mask1.get(), domains[1], domains[0], TYPE_B),
+      make_view(rel2.first.get(), rel2.second.get(), domains[1], domains[1], TYPE_F32)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const vector<hyperparam_bag_t> relation_hps({
+      beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(1., 3.), nich_hp()});
+  auto s = state<2>::initialize(
+      defn, {crp_hp(2.0), crp_hp(2.0)}, relation_hps, {{}, {}}, data, r);
+
+  typedef sharded_worker<2> worker_t;
+  ostringstream path;
+  path << "/tmp/microscopes_irm_test18_" << getpid();
+  vector<shared_ptr<state<2>>> replicas(nranks);
+  vector<unsigned long> seeds(nranks);
+  for (auto &seed : seeds)
+    seed = r();
+  vector<thread> ranks;
+  for (size_t rank = 0; rank < nranks; rank++)
+    ranks.emplace_back([&, rank]() {
+      rng_t r(seeds[rank]);
+      unix_socket_transport t(path.str(), rank, nranks);
+      auto replica = worker_t::replicate(defn, rank ? nullptr : s, t, r);
+      vector<size_t> shard;
+      for (size_t eid = rank; eid < domains[0]; eid += nranks)
+        shard.push_back(eid);
+      worker_t worker(replica, 0, shard, data, t);
+      for (size_t i = 0; i < 5; i++)
+        worker.sweep(4, r);
+      replicas[rank] = replica;
+    });
+  for (auto &t : ranks)
+    t.join();
+
+  // group ids differ across replicas, the clusterings do not
+  const auto canonical = [](const vector<ssize_t> &assignments) {
+    map<ssize_t, size_t> relabel;
+    vector<size_t> ret;
+    for (auto g : assignments) {
+      MICROSCOPES_CHECK(g >= 0, "unassigned entity");
+      ret.push_back(relabel.insert(make_pair(g, relabel.size())).first->second);
+    }
+    return ret;
+  };
+  const auto expected = canonical(replicas[0]->assignments(0));
+  for (const auto &replica : replicas) {
+    MICROSCOPES_CHECK(canonical(replica->assignments(0)) == expected, "assignments");
+    MICROSCOPES_CHECK(replica->empty_groups(0).empty(), "empty groups");
+    vector<vector<size_t>> assignments;
+    for (size_t d = 0; d < domains.size(); d++) {
+      assignments.emplace_back();
+      for (auto g : replica->assignments(d))
+        assignments.back().push_back(g);
+    }
+    auto s1 = state<2>::initialize(
+        defn,
+        {replica->get_domain_hp(0), replica->get_domain_hp(1)},
+        relation_hps,
+        assignments,
+        data,
+        r);
+    for (size_t i = 0; i < defn.relations().size(); i++) {
+      MICROSCOPES_CHECK(
+          replica->suffstats_identifiers(i).size() ==
+          s1->suffstats_identifiers(i).size(), "# blocks");
+      MICROSCOPES_CHECK(almost_eq_rel(
+          replica->score_likelihood(i, r), s1->score_likelihood(i, r)),
+          "likelihood");
+    }
+  }
+
+  // a rank 0 whose handshake fails leaves no socket path behind, and one
+  // which cannot bind leaves the path alone
+  bool thrown = false;
+  thread peer([&path]() { unix_socket_transport t(path.str(), 2, 3); });
+  try {
+    unix_socket_transport t(path.str(), 0, 2);
+  } catch (runtime_error &) {
+    thrown = true;
+  }
+  peer.join();
+  MICROSCOPES_CHECK(thrown, "invalid rank accepted");
+  MICROSCOPES_CHECK(access(path.str().c_str(), F_OK), "socket path left behind");
+  ofstream(path.str()).put('x');
+  thrown = false;
+  try {
+    unix_socket_transport t(path.str(), 0, 2);
+  } catch (runtime_error &) {
+    thrown = true;
+  }
+  MICROSCOPES_CHECK(thrown, "bound over an existing path");
+  MICROSCOPES_CHECK(!access(path.str().c_str(), F_OK), "existing path removed");
+  unlink(path.str().c_str());
+
+  cout << "test18 completed" << endl;
+}
+
+// chains bound over the same data share its index, and a multi chain run
+// does not depend on how many threads it was given
+static void
+test19()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({30, 10});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.2, normal_distribution<float>(1., 2.), r);
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const size_t nchains = 5;
+  vector<shared_ptr<state<2>>> states, copies;
+  for (size_t i = 0; i < nchains; i++) {
+    // identical chains, down to the layout of their tables
+    const auto seed = rd();
+    for (auto *p : {&states, &copies}) {
+      rng_t r0(seed);
+      p->push_back(state<2>::initialize(
+          defn,
+          {crp_hp(2.0), crp_hp(2.0)},
+          {beta_bernoulli_hp(2., 2.), nich_hp()},
+          {{}, {}},
+          data,
+          r0));
+    }
+  }
+
+  const auto chains = bind_chains(states, views);
+  MICROSCOPES_CHECK(chains.size() == nchains, "chains");
+  for (size_t d = 0; d < domains.size(); d++) {
+    const auto &m0 = dynamic_cast<const microscopes::irm::model<2> &>(*chains[0][d]);
+    for (size_t i = 1; i < nchains; i++) {
+      const auto &m = dynamic_cast<const microscopes::irm::model<2> &>(*chains[i][d]);
+      MICROSCOPES_CHECK(m.shared_index() == m0.shared_index(), "index not shared");
+    }
+  }
+
+  multi_chain_runner runner(chains, 3);
+  multi_chain_runner serial(bind_chains(copies, views), 1);
+  for (auto *p : {&runner, &serial}) {
+    p->add_assign(0);
+    p->add_assign(1);
+  }
+  const auto seed = rd();
+  rng_t r0(seed), r1(seed);
+  runner.run(r0, 5);
+  serial.run(r1, 5);
+
+  const auto summaries = runner.summaries(r);
+  MICROSCOPES_CHECK(summaries.size() == nchains, "summaries");
+  for (size_t i = 0; i < nchains; i++) {
+    const auto &s = *states[i];
+    float score_assignment = 0.;
+    for (size_t d = 0; d < domains.size(); d++) {
+      MICROSCOPES_CHECK(s.assignments(d) == copies[i]->assignments(d),
+          "chain depends on the number of threads");
+      MICROSCOPES_CHECK(summaries[i].ngroups_[d] == s.ngroups(d), "ngroups");
+      score_assignment += s.score_assignment(d);
+    }
+    MICROSCOPES_CHECK(almost_eq_rel(
+        summaries[i].score_assignment_, score_assignment), "score_assignment");
+    MICROSCOPES_CHECK(almost_eq_rel(
+        summaries[i].score_likelihood_, s.score_likelihood(r)), "score_likelihood");
+  }
+
+  cout << "test19 completed" << endl;
+}
+
+// tempering scales the likelihood terms of the scores, and the tempering
+// runner keeps one replica per rung of its ladder
+static void
+test20()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({20, 8});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask1(new bool[domains[0]*domains[0]]);
+  for (size_t i = 0; i < domains[0]*domains[0]; i++)
+    mask1[i] = !rel1.first[i];
+
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), mask1.get(), domains[0], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const size_t nreplicas = 4;
+  vector<shared_ptr<state<2>>> states;
+  for (size_t i = 0; i < nreplicas; i++)
+    states.push_back(state<2>::initialize(
+        defn,
+        {crp_hp(2.0), crp_hp(2.0)},
+        {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(1., 3.)},
+        {{}, {}},
+        data,
+        r));
+
+  // at beta, an entity scores prior + beta * likelihood, so the prior can
+  // be recovered from any two betas, and must be normalized
+  auto &s = *states.front();
+  const float likelihood = s.score_likelihood(r);
+  const size_t eid = 3;
+  const size_t gid = s.remove_value(0, eid, data, r);
+  s.create_group(0);
+  vector<vector<float>> scores;
+  for (float beta : {1., 0.5, 0.25}) {
+    s.set_inverse_temperature(beta);
+    scores.push_back(s.score_value(0, eid, data, r).second);
+  }
+  float total = -numeric_limits<float>::infinity();
+  for (size_t i = 0; i < scores[0].size(); i++) {
+    const float prior0 = (scores[1][i] - 0.5 * scores[0][i]) / 0.5;
+    const float prior1 = (scores[2][i] - 0.25 * scores[0][i]) / 0.75;
+    MICROSCOPES_CHECK(almost_eq_rel(prior0, prior1), "prior terms");
+    total = max(total, prior0) + log1p(exp(min(total, prior0) - max(total, prior0)));
+  }
+  MICROSCOPES_CHECK(fabs(total) < 1e-3, "prior terms are not normalized");
+  s.add_value(0, gid, eid, data, r);
+  MICROSCOPES_CHECK(almost_eq_rel(s.score_likelihood(r), 0.25 * likelihood),
+      "tempered likelihood");
+  s.set_inverse_temperature(1.);
+
+  const vector<float> betas({1., 0.6, 0.35, 0.2});
+  tempering_runner runner(bind_chains(states, views), betas, 3);
+  runner.add_assign(0);
+  runner.add_assign(1);
+  runner.run(r, 21, 2);
+
+  // 10 rounds of swaps, alternating between the pairs {0, 2} and {1}
+  MICROSCOPES_CHECK(runner.swap_attempts() == vector<size_t>({5, 5, 5}), "attempts");
+  const auto rates = runner.swap_rates();
+  for (size_t k = 0; k + 1 < nreplicas; k++)
+    MICROSCOPES_CHECK(rates[k] >= 0. && rates[k] <= 1., "rates");
+  vector<bool> seen(nreplicas);
+  for (size_t k = 0; k < nreplicas; k++) {
+    const size_t i = runner.replica(k);
+    MICROSCOPES_CHECK(!seen[i], "a replica is on two rungs");
+    seen[i] = true;
+    MICROSCOPES_CHECK(states[i]->inverse_temperature() == betas[k], "beta");
+    for (size_t d = 0; d < domains.size(); d++) {
+      size_t n = 0;
+      for (auto g : states[i]->groups(d))
+        n += states[i]->groupsize(d, g);
+      MICROSCOPES_CHECK(n == domains[d], "group sizes");
+    }
+  }
+
+  cout << "test20 completed" << endl;
+}
+
+// split merge moves must leave a consistent state behind, and find a
+// planted split that single site gibbs would take long to make
+static void
+test21()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({40, 10});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true)});
+
+  // two blocks of domain 0, told apart by both relations
+  const size_t n = domains[0], m = domains[1];
+  unique_ptr<bool[]> data0(new bool[n*m]);
+  unique_ptr<float[]> data1(new float[n*n]);
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < m; j++)
+      data0[i*m + j] = bernoulli_distribution((i < n/2) ? 0.95 : 0.05)(r);
+    for (size_t j = 0; j < n; j++)
+      data1[i*n + j] = normal_distribution<float>(
+          ((i < n/2) == (j < n/2)) ? 5. : -5., 1.)(r);
+  }
+  const vector<shared_ptr<dataview>> views({
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(data0.get()), nullptr, {n, m}, runtime_type(TYPE_B))),
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(data1.get()), nullptr, {n, n}, runtime_type(TYPE_F32)))});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  const vector<hyperparam_bag_t> relation_hps({
+      beta_bernoulli_hp(1., 1.), nich_hp()});
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(1.0), crp_hp(1.0)},
+      relation_hps,
+      {vector<size_t>(n, 0), {}},
+      data,
+      r);
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  runner.add_split_merge(0, 50, 3);
+  runner.run(r, 1);
+  const auto reports = runner.split_merge_reports();
+  MICROSCOPES_CHECK(reports.size() == 1 && reports[0].first == 0, "reports");
+  const auto &report = reports[0].second;
+  MICROSCOPES_CHECK(report.nsplits_ + report.nmerges_ == 50, "proposals");
+  MICROSCOPES_CHECK(report.nsplits_accepted_ >= 1, "the planted split was not found");
+  MICROSCOPES_CHECK(s->ngroups(0) >= 2, "the planted split was not found");
+
+  runner.add_assign(0);
+  runner.add_assign(1);
+  runner.add_split_merge(1, 10, 2);
+  runner.run(r, 5);
+
+  vector<vector<size_t>> assignments;
+  for (size_t d = 0; d < domains.size(); d++) {
+    MICROSCOPES_CHECK(s->empty_groups(d).empty() || d == 1, "empty groups");
+    size_t total = 0;
+    for (auto g : s->groups(d))
+      total += s->groupsize(d, g);
+    MICROSCOPES_CHECK(total == domains[d], "group sizes");
+    assignments.emplace_back();
+    for (auto g : s->assignments(d)) {
+      MICROSCOPES_CHECK(g >= 0, "unassigned entity");
+      assignments.back().push_back(g);
+    }
+  }
+
+  auto s1 = state<2>::initialize(
+      defn,
+      {s->get_domain_hp(0), s->get_domain_hp(1)},
+      relation_hps,
+      assignments,
+      data,
+      r);
+  for (size_t i = 0; i < defn.relations().size(); i++) {
+    MICROSCOPES_CHECK(
+        s->suffstats_identifiers(i).size() ==
+        s1->suffstats_identifiers(i).size(), "# blocks");
+    MICROSCOPES_CHECK(almost_eq_rel(
+        s->score_likelihood(i, r), s1->score_likelihood(i, r)),
+        "likelihood");
+  }
+
+  cout << "test21 completed" << endl;
+}
+
+// the block by block likelihood, which bypasses the relation's cache
+static float
+uncached_likelihood(state<2> &s, size_t relation, rng_t &r)
+{
+  float score = 0.;
+  for (auto id : s.suffstats_identifiers(relation))
+    score += s.score_likelihood(relation, id, r);
+  return score;
+}
+
+static void
+check_cached_likelihood(state<2> &s, rng_t &r)
+{
+  for (size_t i = 0; i < s.nrelations(); i++) {
+    const float expected = uncached_likelihood(s, i, r);
+    // twice: the second call is served from a clean cache
+    MICROSCOPES_CHECK(almost_eq_rel(s.score_likelihood(i, r), expected),
+        "cached likelihood");
+    MICROSCOPES_CHECK(almost_eq_rel(s.score_likelihood(i, r), expected),
+        "cached likelihood");
+  }
+}
+
+// the cached likelihood must follow every way the suffstats and the
+// hyperparameters can change
+static void
+test22()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({30, 12});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.3, normal_distribution<float>(1., 2.), r);
+  const vector<shared_ptr<dataview>> views({
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(rel0.first.get()), rel0.second.get(),
+          {domains[0], domains[1]}, runtime_type(TYPE_B))),
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(rel1.first.get()), rel1.second.get(),
+          {domains[0], domains[0]}, runtime_type(TYPE_F32)))});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp()},
+      {{}, {}},
+      data,
+      r);
+  check_cached_likelihood(*s, r);
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  runner.add_assign(0);
+  runner.add_assign(1);
+  runner.add_split_merge(0, 5, 2);
+  for (size_t i = 0; i < 5; i++) {
+    runner.run(r, 1);
+    check_cached_likelihood(*s, r);
+  }
+
+  // hyperparameters, through a mutator and set
+  s->get_relation_hp_mutator(0, "alpha").set(3.f);
+  check_cached_likelihood(*s, r);
+  s->set_relation_hp(0, beta_bernoulli_hp(1., 4.));
+  check_cached_likelihood(*s, r);
+  runner.add_slice_relation_hp(0, "beta", log_exponential, 0.5);
+  runner.run(r, 2);
+  check_cached_likelihood(*s, r);
+
+  // moving the blocks between storages
+  s->set_dense_suffstats(0, true);
+  check_cached_likelihood(*s, r);
+  runner.run(r, 2);
+  check_cached_likelihood(*s, r);
+
+  // a block set directly, and one handed out for mutation. the blocks no
+  // longer match the data past this point
+  const auto id = s->suffstats_identifiers(1).front();
+  s->set_suffstats(1, id, s->get_suffstats(1, s->suffstats_identifiers(1).back()));
+  check_cached_likelihood(*s, r);
+  s->get_suffstats_mutator(1, id, "mean").set(10.f);
+  check_cached_likelihood(*s, r);
+
+  // mutators kept across calls, as the slice kernels keep theirs
+  auto alpha = s->get_relation_hp_mutator(0, "alpha");
+  auto mean = s->get_suffstats_mutator(1, id, "mean");
+  for (float x : {1.5f, 2.5f}) {
+    alpha.set(x);
+    check_cached_likelihood(*s, r);
+    mean.set(-x);
+    check_cached_likelihood(*s, r);
+  }
+
+  cout << "test22 completed" << endl;
+}
+
+// the running joint must match the full recomputation under every kernel
+// which moves entities, and across hyperparameter changes
+static void
+test23()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({30, 12});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.1, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.)},
+      {{}, {}},
+      data,
+      r);
+
+  const auto check = [&s, &r]() {
+    const float full = s->score_assignment() + s->score_likelihood(r);
+    MICROSCOPES_CHECK(almost_eq_rel(s->score_joint(r), full), "joint");
+  };
+  check();
+
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+
+  microscopes::irm::runner runner(models);
+  runner.add_assign(0);
+  runner.add_chromatic_assign(1, 2, 4);
+  runner.add_slice_cluster_hp(0, "alpha", log_exponential, 0.5);
+  for (size_t i = 0; i < 5; i++) {
+    runner.run(r, 1);
+    check();
+  }
+
+  // the split merge kernel only takes conjugate relations without implicit
+  // zeros, which domain 0 is not part of
+  microscopes::irm::runner runner1(models);
+  runner1.add_hogwild_assign(0, 2, 4);
+  runner1.add_slice_cluster_hp(1, "alpha", log_exponential, 0.5);
+  runner1.run(r, 2);
+  check();
+
+  s->set_domain_hp(1, crp_hp(0.5));
+  check();
+  s->set_inverse_temperature(0.5);
+  check();
+  // a mutator kept across calls, as the slice kernels keep theirs
+  auto alpha = s->get_domain_hp_mutator(0, "alpha");
+  for (float x : {0.7f, 3.f}) {
+    alpha.set(x);
+    check();
+  }
+
+  cout << "test23 completed" << endl;
+}
+
+static void
+test24()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({20, 15});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.7, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[1], domains[0], 0.4, normal_distribution<float>(0., 1.), r);
+  const vector<shared_ptr<dataview>> views({
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(rel0.first.get()), rel0.second.get(),
+          {domains[0], domains[1]}, runtime_type(TYPE_B))),
+      shared_ptr<dataview>(new row_major_dense_dataview(
+          reinterpret_cast<uint8_t*>(rel1.first.get()), rel1.second.get(),
+          {domains[1], domains[0]}, runtime_type(TYPE_F32)))});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp()},
+      {{}, {}},
+      data,
+      r);
+
+  const size_t eid = 3;
+  vector<size_t> observed(2);
+  for (size_t j = 0; j < domains[1]; j++)
+    if (!rel0.second[eid * domains[1] + j])
+      observed[0]++;
+  for (size_t i = 0; i < domains[1]; i++)
+    if (!rel1.second[i * domains[0] + eid])
+      observed[1]++;
+
+  s->reset_counters();
+  const size_t gid = s->remove_value(0, eid, data, r);
+  const size_t empty = s->create_group(0);
+  s->score_value(0, eid, data, r);
+  auto c = s->counters();
+  MICROSCOPES_CHECK(c.domains_.size() == 2 && c.relations_.size() == 2, "shape");
+
+  if (!c.enabled_) {
+    // compiled without MICROSCOPES_IRM_COUNTERS
+    for (const auto &d : c.domains_)
+      MICROSCOPES_CHECK(!d.entities_scored_ && !d.candidates_scored_, "counted");
+    for (const auto &rc : c.relations_)
+      MICROSCOPES_CHECK(!rc.suffstats_lookups_ && !rc.observations_, "counted");
+    s->delete_group(0, empty);
+    s->add_value(0, gid, eid, data, r);
+    cout << "test24 completed (counters disabled)" << endl;
+    return;
+  }
+
+  MICROSCOPES_CHECK(c.domains_[0].entities_scored_ == 1, "entities scored");
+  MICROSCOPES_CHECK(c.domains_[0].candidates_scored_ == s->ngroups(0), "candidates");
+  MICROSCOPES_CHECK(!c.domains_[1].entities_scored_, "domain 1 scored");
+  for (size_t i = 0; i < 2; i++) {
+    // visited once to remove, once to score
+    MICROSCOPES_CHECK(c.relations_[i].observations_ == 2 * observed[i], "observations");
+    MICROSCOPES_CHECK(c.relations_[i].suffstats_hits_ <= c.relations_[i].suffstats_lookups_, "hits");
+    MICROSCOPES_CHECK(!observed[i] || c.relations_[i].suffstats_lookups_, "lookups");
+  }
+
+  // the bound model reads the entity's data off its index instead
+  microscopes::irm::model<2> m(s, 0, views);
+  s->reset_counters();
+  m.score_value(eid, r);
+  c = s->counters();
+  MICROSCOPES_CHECK(c.domains_[0].entities_scored_ == 1, "entities scored");
+  for (size_t i = 0; i < 2; i++)
+    MICROSCOPES_CHECK(c.relations_[i].observations_ == observed[i], "observations");
+
+  s->delete_group(0, empty);
+
+  // every block an entity creates alone is erased again when it leaves
+  s->reset_counters();
+  const size_t egid = s->create_group(0);
+  s->add_value(0, egid, eid, data, r);
+  s->remove_value(0, eid, data, r);
+  s->delete_group(0, egid);
+  c = s->counters();
+  for (size_t i = 0; i < 2; i++) {
+    MICROSCOPES_CHECK(c.relations_[i].blocks_created_ == c.relations_[i].blocks_erased_, "blocks");
+    MICROSCOPES_CHECK(!observed[i] || c.relations_[i].blocks_created_, "blocks created");
+  }
+
+  s->add_value(0, gid, eid, data, r);
+  s->reset_counters();
+  c = s->counters();
+  for (const auto &rc : c.relations_)
+    MICROSCOPES_CHECK(!rc.suffstats_lookups_ && !rc.blocks_created_ &&
+                      !rc.observations_ && !rc.iterate_ns_, "reset");
+
+  cout << "test24 completed" << endl;
+}
+
+// s1 is a restored copy of s. implicit lists the implicit zero relations.
+// ranked restores number the groups of s 0 to ngroups - 1, in order (see
+// save_checkpoint())
+static void
+assert_restored(state<2> &s, state<2> &s1, const set<size_t> &implicit,
+                rng_t &r, bool ranked = false)
+{
+  for (size_t i = 0; i < s.ndomains(); i++) {
+    auto assignments = s.assignments(i);
+    auto groups = s.groups(i);
+    auto empty_groups = s.empty_groups(i);
+    if (ranked) {
+      map<size_t, size_t> rank;
+      for (auto gid : groups)
+        rank.emplace(gid, rank.size());
+      for (auto &gid : assignments)
+        if (gid != -1)
+          gid = rank[gid];
+      for (auto &gid : groups)
+        gid = rank[gid];
+      empty_groups.clear();
+      for (auto gid : s.empty_groups(i))
+        empty_groups.insert(rank[gid]);
+    }
+    assert_vectors_equal(assignments, s1.assignments(i));
+    assert_vectors_equal(groups, s1.groups(i));
+    assert_sets_equal(empty_groups, s1.empty_groups(i));
+    MICROSCOPES_CHECK(s.get_domain_hp(i) == s1.get_domain_hp(i), "domain hp");
+  }
+  for (size_t i = 0; i < s.nrelations(); i++) {
+    MICROSCOPES_CHECK(s.get_relation_hp(i) == s1.get_relation_hp(i), "relation hp");
+    assert_vectors_equal(s.suffstats_identifiers(i), s1.suffstats_identifiers(i));
+    for (auto ident : s.suffstats_identifiers(i)) {
+      MICROSCOPES_CHECK(s.get_suffstats_count(i, ident) ==
+          s1.get_suffstats_count(i, ident), "ss count");
+      if (implicit.count(i))
+        continue;
+      MICROSCOPES_CHECK(s.get_suffstats(i, ident) == s1.get_suffstats(i, ident), "ss");
+    }
+  }
+  MICROSCOPES_CHECK(almost_eq_rel(s.score_joint(r), s1.score_joint(r)), "joint");
+}
+
+static void
+test25()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({40, 25});
+
+  const auto make_defn = [](bool nich) {
+    return model_definition(
+      {40, 25},
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       nich ?
+         relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true) :
+         relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+  };
+  const model_definition defn = make_defn(true);
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.2, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(1.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.)},
+      {{}, {}},
+      data,
+      r);
+
+  // sample a bit, so that gids have gaps, and leave an empty group around
+  vector<shared_ptr<entity_based_state_object>> models;
+  for (size_t d = 0; d < domains.size(); d++)
+    models.emplace_back(make_shared<microscopes::irm::model<2>>(s, d, views));
+  microscopes::irm::runner runner(models);
+  runner.add_assign(0);
+  runner.add_assign(1);
+  runner.run(r, 3);
+  s->create_group(1);
+
+  ostringstream path;
+  path << "/tmp/microscopes_irm_test25_" << getpid();
+  s->save_checkpoint(path.str());
+  auto s1 = state<2>::load_checkpoint(defn, path.str(), r);
+
+  assert_restored(*s, *s1, {2}, r, true);
+  for (size_t i = 0; i < domains.size(); i++) {
+    const auto groups = s1->groups(i);
+    MICROSCOPES_CHECK(groups.size() == s->ngroups(i) &&
+        (groups.empty() || groups.back() == groups.size() - 1), "gaps restored");
+  }
+
+  // the restored state samples on, and creates fresh idents
+  vector<shared_ptr<entity_based_state_object>> models1;
+  for (size_t d = 0; d < domains.size(); d++)
+    models1.emplace_back(make_shared<microscopes::irm::model<2>>(s1, d, views));
+  microscopes::irm::runner runner1(models1);
+  runner1.add_assign(0);
+  runner1.run(r, 2);
+  const float full = s1->score_assignment() + s1->score_likelihood(r);
+  MICROSCOPES_CHECK(almost_eq_rel(s1->score_joint(r), full), "joint after sampling");
+
+  const auto throws = [&path, &r](const model_definition &defn) {
+    try {
+      state<2>::load_checkpoint(defn, path.str(), r);
+    } catch (const runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  MICROSCOPES_CHECK(throws(make_defn(false)), "mismatched relation model accepted");
+  MICROSCOPES_CHECK(!truncate(path.str().c_str(), 100), "truncate");
+  MICROSCOPES_CHECK(throws(defn), "truncated checkpoint accepted");
+  unlink(path.str().c_str());
+  MICROSCOPES_CHECK(throws(defn), "missing checkpoint accepted");
+
+  cout << "test25 completed" << endl;
+}
+
+static void
+test26()
+{
+  random_device rd;
+  rng_t r(rd());
+  const vector<size_t> domains({60, 30});
+
+  const model_definition defn(
+      domains,
+      {relation_definition({0,1}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<NormalInverseChiSq>>(), true),
+       relation_definition({1,0}, make_shared<distributions_model<BetaBernoulli>>(), true, true)});
+
+  auto rel0 = binary_relation_generate(
+      domains[0], domains[1], 0.8, bernoulli_distribution(0.3), r);
+  auto rel1 = binary_relation_generate(
+      domains[0], domains[0], 0.3, normal_distribution<float>(1., 2.), r);
+  auto rel2 = binary_relation_generate(
+      domains[1], domains[0], 1., bernoulli_distribution(0.2), r);
+  unique_ptr<bool[]> mask2(new bool[domains[1]*domains[0]]);
+  for (size_t i = 0; i < domains[1]*domains[0]; i++)
+    mask2[i] = !rel2.first[i];
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), domains[0], domains[1], TYPE_B),
+      make_view(rel1.first.get(), rel1.second.get(), domains[0], domains[0], TYPE_F32),
+      make_view(rel2.first.get(), mask2.get(), domains[1], domains[0], TYPE_B)});
+  dataset_t data;
+  for (const auto &v : views)
+    data.push_back(v.get());
+
+  // many small groups, for many blocks to decode
+  vector<size_t> assignment0(domains[0]), assignment1(domains[1]);
+  for (size_t i = 0; i < domains[0]; i++)
+    assignment0[i] = i % 20;
+  for (size_t i = 0; i < domains[1]; i++)
+    assignment1[i] = i % 10;
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0), crp_hp(1.0)},
+      {beta_bernoulli_hp(2., 2.), nich_hp(), beta_bernoulli_hp(1., 3.)},
+      {assignment0, assignment1},
+      data,
+      r);
+  s->create_group(0);
+
+  const auto raw = s->serialize();
+  for (size_t nthreads : {1, 2, 4}) {
+    auto s1 = state<2>::deserialize(defn, raw, r, nthreads);
+    assert_restored(*s, *s1, {2}, r);
+  }
+
+  ostringstream path;
+  path << "/tmp/microscopes_irm_test26_" << getpid();
+  s->set_dense_suffstats(0, true);
+  s->set_score_threads(2);
+  s->set_relation_threads(3);
+  s->save_checkpoint(path.str());
+  auto s1 = state<2>::load_checkpoint(defn, path.str(), r, 3);
+  unlink(path.str().c_str());
+  assert_restored(*s, *s1, {2}, r, true);
+  MICROSCOPES_CHECK(s1->dense_suffstats(0) && !s1->dense_suffstats(1), "dense");
+  MICROSCOPES_CHECK(s1->score_threads() == 2, "score threads");
+  MICROSCOPES_CHECK(s1->relation_threads() == 3, "relation threads");
+  s1->check_suffstats_index(1);
+
+  // and samples on from there
+  microscopes::irm::model<2> m(s1, 0, views);
+  for (size_t eid = 0; eid < domains[0]; eid++) {
+    const size_t gid = m.remove_value(eid, r);
+    m.add_value(gid, eid, r);
+  }
+  const float full = s1->score_assignment() + s1->score_likelihood(r);
+  MICROSCOPES_CHECK(almost_eq_rel(s1->score_joint(r), full), "joint after moves");
+
+  cout << "test26 completed" << endl;
+}
+
+// the reverse index of the sparse blocks stays in sync with the tables
+// through swap-removes from the middle and the end of its lists, both off
+// emptied conjugate blocks and off erase_group() on a {0,0} relation
+static void
+test27()
+{
+  random_device rd;
+  rng_t r(rd());
+  const size_t n = 12, ngroups = 4;
+
+  const model_definition defn(
+      {n},
+      {relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>(), true),
+       relation_definition({0,0}, make_shared<distributions_model<BetaBernoulli>>())});
+
+  auto rel0 = binary_relation_generate(n, n, 1., bernoulli_distribution(0.5), r);
+  auto rel1 = binary_relation_generate(n, n, 1., bernoulli_distribution(0.5), r);
+  const vector<shared_ptr<dataview>> views({
+      make_view(rel0.first.get(), rel0.second.get(), n, n),
+      make_view(rel1.first.get(), rel1.second.get(), n, n)});
+  const dataset_t data({views[0].get(), views[1].get()});
+
+  vector<size_t> assignment(n);
+  for (size_t i = 0; i < n; i++)
+    assignment[i] = i % ngroups;
+  auto s = state<2>::initialize(
+      defn,
+      {crp_hp(2.0)},
+      {beta_bernoulli_hp(2., 2.), beta_bernoulli_hp(1., 1.)},
+      {assignment},
+      data,
+      r);
+
+  auto check = [&s](size_t nblocks0, size_t nblocks1) {
+    for (size_t i = 0; i < 2; i++)
+      s->check_suffstats_index(i);
+    MICROSCOPES_CHECK(s->suffstats_identifiers(0).size() == nblocks0, "conjugate blocks");
+    MICROSCOPES_CHECK(s->suffstats_identifiers(1).size() == nblocks1, "non-conjugate blocks");
+  };
+  check(ngroups * ngroups, ngroups * ngroups);
+
+  // every cell is observed, so each move leaves every entity assigned.
+  // group 1 sits in the middle of every list, group 3 (the last one
+  // created) at their ends
+  auto move = [&s, &data, &r](size_t eid, size_t gid) {
+    s->remove_value(0, eid, data, r);
+    s->add_value(0, gid, eid, data, r);
+    s->check_suffstats_index(0);
+    s->check_suffstats_index(1);
+  };
+  size_t left = ngroups;
+  for (size_t gid : {1, 3}) {
+    for (size_t eid = gid; eid < n; eid += ngroups)
+      move(eid, 0);
+    left--;
+    // the conjugate blocks went with their last cells, the others wait for
+    // the group
+    check(left * left, (left + 1) * (left + 1));
+    s->delete_group(0, gid);
+    check(left * left, left * left);
+  }
+
+  // and the index takes new blocks after the removals
+  const size_t gid = s->create_group(0);
+  for (size_t eid = 1; eid < n; eid += ngroups)
+    move(eid, gid);
+  check((left + 1) * (left + 1), (left + 1) * (left + 1));
+
+  cout << "test27 completed" << endl;
+}
+
 int
 main(void)
 {
@@ -400,5 +2556,30 @@ main(void)
   test2();
   test3();
   test4();
+  test5(false);
+  test5(true);
+  test6();
+  test7();
+  test8();
+  test9();
+  test10();
+  test11();
+  test12();
+  test13(true);
+  test13(false);
+  test14();
+  test15();
+  test16();
+  test17();
+  test18();
+  test19();
+  test20();
+  test21();
+  test22();
+  test23();
+  test24();
+  test25();
+  test26();
+  test27();
   return 0;
 }
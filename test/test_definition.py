@@ -1,9 +1,12 @@
-from microscopes.irm.definition import model_definition
-from microscopes.models import bb, niw
+from microscopes.irm.definition import model_definition, is_conjugate
+from microscopes.models import bb, bbnc, nich, niw
 
 from nose.tools import (
     assert_equals,
     assert_list_equal,
+    assert_true,
+    assert_false,
+    assert_raises,
 )
 import pickle
 
@@ -18,3 +21,32 @@ def test_model_definition_pickle():
     for model, model1 in zipped_models:
         assert_equals(model.name(), model1.name())
     # XXX(stephentu): check hyperpriors
+
+
+def test_model_definition_implicit_zeros():
+    defn = model_definition(
+        [10, 12], [((0, 1), bb), ((1, 0), bb)], implicit_zeros=[1])
+    assert_equals(defn.implicit_zeros(), [1])
+    defn1 = pickle.loads(pickle.dumps(defn))
+    assert_equals(defn1.implicit_zeros(), [1])
+    assert_equals(model_definition([10], [((0, 0), bb)]).implicit_zeros(), [])
+
+    # only binary bb relations hold implicit zeros
+    assert_raises(ValueError, model_definition,
+                  [10, 12], [((0, 1), nich)], implicit_zeros=[0])
+    assert_raises(ValueError, model_definition,
+                  [10], [((0, 0, 0), bb)], implicit_zeros=[0])
+    assert_raises(ValueError, model_definition,
+                  [10], [((0, 0), bb)], implicit_zeros=[1])
+
+
+def test_is_conjugate():
+    assert_true(is_conjugate(bb))
+    assert_true(is_conjugate(nich))
+    assert_false(is_conjugate(bbnc))
+
+    class unknown(object):
+        def name(self):
+            return 'unknown'
+    # a model which is not known to be conjugate must not be treated as one
+    assert_false(is_conjugate(unknown()))
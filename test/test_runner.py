@@ -17,8 +17,10 @@ from microscopes.common.testutil import (
 
 import itertools as it
 import multiprocessing as mp
+import threading
 
 from nose.plugins.attrib import attr
+from nose.tools import assert_raises, assert_almost_equals
 
 
 def _test_runner_simple(defn, kc_fn):
@@ -63,6 +65,231 @@ def test_runner_default_kernel_config_grid():
     _test_runner_simple(defn, kc_fn)
 
 
+def test_native_runner_threads():
+    # the native runner releases the GIL, so chains can run in threads
+    defn = model_definition([10, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    kc = list(it.chain(
+        runner.default_kernel_config(defn),
+        runner.default_cluster_hp_kernel_config(defn)))
+    prngs = [rng(seed) for seed in xrange(4)]
+    runners = [runner.runner(defn, views, model.initialize(defn, views, r), kc)
+               for r in prngs]
+    threads = [threading.Thread(target=rn.run, args=(r, 10))
+               for rn, r in zip(runners, prngs)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for rn in runners:
+        latent = rn.get_latent()
+        for did in xrange(len(defn.domains())):
+            assert latent.get_domain_hp(did)['alpha'] > 0.
+            assert all(g >= 0 for g in latent.assignments(did))
+
+
+def test_runner_log_prior_raises():
+    # a hyperprior which raises aborts the run with its exception, instead of
+    # leaving the hyperparameter stuck where it was
+    def prior(x):
+        raise ValueError("broken prior")
+    defn = model_definition([10, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latent = model.initialize(defn, views, prng)
+    alpha = latent.get_domain_hp(0)['alpha']
+    kc = [('slice_cluster_hp', {0: {'cparam': {'alpha': (prior, 0.1)}}})]
+    r = runner.runner(defn, views, latent, kc)
+    assert_raises(ValueError, r.run, prng, 1)
+    assert_almost_equals(r.get_latent().get_domain_hp(0)['alpha'], alpha)
+
+
+def test_runner_chromatic_assign():
+    defn = model_definition([10, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latent = model.initialize(defn, views, prng)
+    config = {'nthreads': 2, 'max_batch': 4}
+    kc = [('chromatic_assign', {0: config, 1: config})]
+    r = runner.runner(defn, views, latent, kc)
+    r.run(r=prng, niters=10)
+    latent = r.get_latent()
+    for did in xrange(len(defn.domains())):
+        assert all(g >= 0 for g in latent.assignments(did))
+        assert not latent.empty_groups(did)
+
+
+def test_runner_hogwild_assign():
+    defn = model_definition([30, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latent = model.initialize(defn, views, prng)
+    kc = [('hogwild_assign', {0: {'nthreads': 3, 'max_staleness': 4}})]
+    r = runner.runner(defn, views, latent, kc)
+    r.run(r=prng, niters=5)
+    latent = r.get_latent()
+    assert all(g >= 0 for g in latent.assignments(0))
+    assert not latent.empty_groups(0)
+    reports = r.hogwild_reports()
+    assert len(reports) == 1
+    domain, report = reports[0]
+    assert domain == 0
+    assert report['nsyncs'] >= 5 * 30 / 4
+    assert report['max_pending'] >= report['mean_pending'] >= 0.
+
+
+def test_runner_split_merge():
+    defn = model_definition([30, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latent = model.initialize(defn, views, prng)
+    kc = [('assign', [1]),
+          ('split_merge', {0: {'nproposals': 10, 'nscans': 2}})]
+    r = runner.runner(defn, views, latent, kc)
+    r.run(r=prng, niters=5)
+    latent = r.get_latent()
+    assert all(g >= 0 for g in latent.assignments(0))
+    assert not latent.empty_groups(0)
+    reports = r.split_merge_reports()
+    assert len(reports) == 1
+    domain, report = reports[0]
+    assert domain == 0
+    assert report['nsplits'] + report['nmerges'] == 5 * 10
+    assert report['nsplits_accepted'] <= report['nsplits']
+    assert report['nmerges_accepted'] <= report['nmerges']
+
+
+
+def test_multi_chain_runner():
+    defn = model_definition([30, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latents = [model.initialize(defn, views, prng) for _ in xrange(4)]
+    kc = list(it.chain(
+        runner.default_kernel_config(defn),
+        runner.default_cluster_hp_kernel_config(defn)))
+    r = runner.multi_chain_runner(defn, views, latents, kc, nthreads=2)
+    assert r.nchains() == 4
+    r.run(r=prng, niters=5)
+    latents = r.get_latents()
+    summaries = r.summaries(prng)
+    assert len(summaries) == 4
+    for latent, summary in zip(latents, summaries):
+        assert all(g >= 0 for g in latent.assignments(0))
+        assert summary['ngroups'] == [latent.ngroups(0), latent.ngroups(1)]
+        score = latent.score_assignment(0) + latent.score_assignment(1)
+        assert abs(summary['score_assignment'] - score) <= 1e-3 * abs(score)
+
+
+def test_multi_chain_runner_not_native():
+    defn = model_definition([10, 10], [((0, 0), bbnc), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    latent = model.initialize(defn, views, rng())
+    kc = runner.default_kernel_config(defn)
+    try:
+        runner.multi_chain_runner(defn, views, [latent], kc)
+        assert False, "should not be reached"
+    except ValueError:
+        pass
+
+
+def test_tempering_runner():
+    defn = model_definition([30, 10], [((0, 0), bb), ((0, 1), nich)])
+    views = map(numpy_dataview, toy_dataset(defn))
+    prng = rng()
+    latents = [model.initialize(defn, views, prng) for _ in xrange(3)]
+    kc = runner.default_assign_kernel_config(defn)
+    r = runner.tempering_runner(
+        defn, views, latents, kc, [1., 0.5, 0.25], nthreads=2, swap_every=2)
+    r.run(r=prng, niters=8)
+    stats = r.swap_stats()
+    assert [s['attempts'] for s in stats] == [2, 2]
+    assert all(0. <= s['rate'] <= 1. for s in stats)
+    latent = r.get_latent()
+    assert all(g >= 0 for g in latent.assignments(0))
+    assert len(r.get_latents()) == 3
+
+@attr('slow')
+def test_runner_chromatic_assign_convergence():
+    # batches of one entity are a plain gibbs sweep
+    domains = [4]
+    defn = model_definition(domains, [((0, 0), bb)])
+    prng = rng()
+    relations, posterior = data_with_posterior(defn, prng)
+    views = map(numpy_dataview, relations)
+    latent = model.initialize(defn, views, prng)
+    kc = [('chromatic_assign', {0: {'nthreads': 2, 'max_batch': 1}})]
+    r = runner.runner(defn, views, latent, kc)
+
+    r.run(r=prng, niters=1000)  # burnin
+    product_assignments = tuple(map(list, map(permutation_iter, domains)))
+    idmap = {C: i for i, C in enumerate(it.product(*product_assignments))}
+
+    def sample_fn():
+        r.run(r=prng, niters=10)
+        new_latent = r.get_latent()
+        key = tuple(tuple(permutation_canonical(new_latent.assignments(i)))
+                    for i in xrange(len(domains)))
+        return idmap[key]
+
+    assert_discrete_dist_approx(sample_fn, posterior, ntries=100)
+
+
+@attr('slow')
+def test_runner_chromatic_assign_batched_convergence():
+    # the entities of domain 0 share no cell, so a batch holds all of them:
+    # without the metropolis-hastings test, every entity would land in a
+    # group of its own
+    domains = [4, 3]
+    defn = model_definition(domains, [((0, 1), bb)])
+    prng = rng()
+    relations, posterior = data_with_posterior(defn, prng)
+    views = map(numpy_dataview, relations)
+    latent = model.initialize(defn, views, prng)
+    kc = [('chromatic_assign', {0: {'nthreads': 2, 'max_batch': 4}}),
+          ('assign', {1: {}})]
+    r = runner.runner(defn, views, latent, kc)
+
+    r.run(r=prng, niters=1000)  # burnin
+    product_assignments = tuple(map(list, map(permutation_iter, domains)))
+    idmap = {C: i for i, C in enumerate(it.product(*product_assignments))}
+
+    def sample_fn():
+        r.run(r=prng, niters=10)
+        new_latent = r.get_latent()
+        key = tuple(tuple(permutation_canonical(new_latent.assignments(i)))
+                    for i in xrange(len(domains)))
+        return idmap[key]
+
+    assert_discrete_dist_approx(sample_fn, posterior, ntries=100)
+
+
+@attr('slow')
+def test_runner_split_merge_convergence():
+    # split merge alone is irreducible
+    domains = [4]
+    defn = model_definition(domains, [((0, 0), bb)])
+    prng = rng()
+    relations, posterior = data_with_posterior(defn, prng)
+    views = map(numpy_dataview, relations)
+    latent = model.initialize(defn, views, prng)
+    kc = [('split_merge', {0: {'nproposals': 1, 'nscans': 2}})]
+    r = runner.runner(defn, views, latent, kc)
+
+    r.run(r=prng, niters=1000)  # burnin
+    product_assignments = tuple(map(list, map(permutation_iter, domains)))
+    idmap = {C: i for i, C in enumerate(it.product(*product_assignments))}
+
+    def sample_fn():
+        r.run(r=prng, niters=10)
+        new_latent = r.get_latent()
+        key = tuple(tuple(permutation_canonical(new_latent.assignments(i)))
+                    for i in xrange(len(domains)))
+        return idmap[key]
+
+    assert_discrete_dist_approx(sample_fn, posterior, ntries=100)
+
+
 @attr('slow')
 def test_runner_default_kernel_config_convergence():
     domains = [4]
@@ -1,11 +1,14 @@
 import pickle
 import copy
 import itertools as it
+import os
+import tempfile
+import warnings
 
 from microscopes.irm.definition import model_definition
 from microscopes.irm import model
 from microscopes.irm.testutil import toy_dataset
-from microscopes.models import bb
+from microscopes.models import bb, bbnc
 from microscopes.common.rng import rng
 from microscopes.common.relation.dataview import numpy_dataview
 
@@ -77,3 +80,118 @@ def test_state_copy():
     s2 = copy.deepcopy(s1)
     assert_is_not(s1, s2)
     _assert_structure_equals(defn, s1, s2, views, r)
+
+
+def test_state_dense_suffstats():
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bb)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s1 = model.initialize(defn, views, r)
+    s2 = copy.copy(s1)
+    for rid in xrange(s2.nrelations()):
+        s2.set_dense_suffstats(rid, True)
+        assert s2.dense_suffstats(rid)
+    _assert_structure_equals(defn, s1, s2, views, r)
+
+
+def test_state_settings_kept_by_copies():
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bb)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s1 = model.initialize(defn, views, r)
+    s1.set_dense_suffstats(1, True)
+    s1.set_score_threads(2)
+    s1.set_relation_threads(3)
+
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    try:
+        s1.save_checkpoint(path)
+        restored = model.load_checkpoint(defn, path, r=r)
+    finally:
+        os.unlink(path)
+
+    for s2 in (copy.copy(s1), copy.deepcopy(s1),
+               pickle.loads(pickle.dumps(s1)), restored):
+        assert not s2.dense_suffstats(0)
+        assert s2.dense_suffstats(1)
+        assert_equals(s2.score_threads(), 2)
+        assert_equals(s2.relation_threads(), 3)
+
+
+def test_state_counters():
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bb)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s = model.initialize(defn, views, r)
+    s.reset_counters()
+    bound = model.bind(s, 0, views)
+    gid = bound.remove_value(0, r)
+    bound.add_value(gid, 0, r)
+
+    c = s.counters()
+    assert_equals(len(c['domains']), s.ndomains())
+    assert_equals(len(c['relations']), s.nrelations())
+    for rc in c['relations']:
+        assert rc['suffstats_hits'] <= rc['suffstats_lookups']
+        if not c['enabled']:
+            assert_equals(rc['suffstats_lookups'], 0)
+            assert_equals(rc['observations'], 0)
+    if c['enabled']:
+        assert sum(rc['observations'] for rc in c['relations']) > 0
+
+    s.reset_counters()
+    c = s.counters()
+    for rc in c['relations']:
+        assert_equals(rc['observations'], 0)
+        assert_equals(rc['iterate_ns'], 0)
+
+
+def test_state_checkpoint():
+    # bbnc is neither of the models with a columnar layout, so its
+    # suffstats go in as bags
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bbnc)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s1 = model.initialize(defn, views, r)
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    try:
+        s1.save_checkpoint(path)
+        s2 = model.load_checkpoint(defn, path, r=r)
+    finally:
+        os.unlink(path)
+    _assert_structure_equals(defn, s1, s2, views, r)
+
+
+def test_state_deserialize_without_rng_deprecated():
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bbnc)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s1 = model.initialize(defn, views, r)
+    with warnings.catch_warnings(record=True) as caught:
+        warnings.simplefilter('always')
+        # copies draw their own rng
+        pickle.loads(pickle.dumps(s1))
+        copy.copy(s1)
+        copy.deepcopy(s1)
+        assert_equals(len(caught), 0)
+        s2 = model.deserialize(defn, s1.serialize())
+        assert_equals([w.category for w in caught], [DeprecationWarning])
+    _assert_structure_equals(defn, s1, s2, views, r)
+
+
+def test_state_deserialize_bulk():
+    defn = model_definition([5, 4], [((0, 0), bb), ((0, 1), bbnc)])
+    r = rng()
+    relations = toy_dataset(defn)
+    views = map(numpy_dataview, relations)
+    s1 = model.initialize(defn, views, r)
+    for nthreads in (1, 2):
+        s2 = model.deserialize(defn, s1.serialize(), r=r, nthreads=nthreads)
+        _assert_structure_equals(defn, s1, s2, views, r)